@@ -0,0 +1,200 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ENCODERS_H
+#define ENCODERS_H
+#include <QByteArray>
+#include <QVector>
+
+// The encoding side of the archive formats in helperfuncs.h, for building
+// synthetic inputs.  Only the benchmarks need these; the player never
+// writes archives.
+
+// Numerical Recipes LCG; fixed seed so every run sees the same data.
+class Random
+{
+    public:
+        Random(quint32 seed = 12345) : _state(seed) {}
+        quint32 next() { _state = _state * 1664525u + 1013904223u; return _state; }
+    private:
+        quint32 _state;
+};
+
+// MSB first, the order BitReader reads in.
+class BitWriter
+{
+    public:
+        BitWriter() : current(0), count(0) {}
+        void putBits(uint value, int len)
+        {
+            for (int i = len - 1; i >= 0; --i)
+            {
+                current = (current << 1) | ((value >> i) & 1);
+                if (++count == 8)
+                {
+                    data.append(static_cast<char>(current));
+                    current = 0;
+                    count = 0;
+                }
+            }
+        }
+        // What BitReader::getUInt32() reads: the byte count - 1 in two bits,
+        // then the value.
+        void putUInt32(quint32 value)
+        {
+            int bytes = 1;
+            while (bytes < 4 && (value >> (bytes * 8)) != 0)
+                ++bytes;
+            putBits(bytes - 1, 2);
+            putBits(value, bytes * 8);
+        }
+        QByteArray finish()
+        {
+            if (count != 0)
+                data.append(static_cast<char>(current << (8 - count)));
+            current = 0;
+            count = 0;
+            return data;
+        }
+    private:
+        QByteArray data;
+        uint current;
+        int count;
+};
+
+// Greedy encoder for the format lzDecompress() reads: a set bit and a
+// literal byte, or a clear bit, a 13-bit dictionary address and a 4-bit
+// length - 3.  The dictionary holds output byte n at (n + 1) & 0x1fff
+// and address 0 ends the stream.
+inline QByteArray lzCompress(const QByteArray& plain)
+{
+    const int window = 0x2000;
+    const int minMatch = 3;
+    const int maxMatch = 18;
+    QVector<int> head(1 << 16, -1);
+    BitWriter writer;
+    const int size = plain.size();
+    const uchar* p = reinterpret_cast<const uchar*>(plain.constData());
+    int pos = 0;
+    while (pos < size)
+    {
+        int bestLength = 0;
+        int bestAddress = 0;
+        if (pos + minMatch <= size)
+        {
+            const int hash = (p[pos] << 8 ^ p[pos + 1] << 4 ^ p[pos + 2]) & 0xffff;
+            const int candidate = head[hash];
+            head[hash] = pos;
+            const int address = (candidate + 1) & (window - 1);
+            if (candidate >= 0 && pos - candidate < window && address != 0)
+            {
+                int length = 0;
+                while (length < maxMatch && pos + length < size && p[candidate + length] == p[pos + length])
+                    ++length;
+                if (length >= minMatch)
+                {
+                    bestLength = length;
+                    bestAddress = address;
+                }
+            }
+        }
+        if (bestLength == 0)
+        {
+            writer.putBits(1, 1);
+            writer.putBits(p[pos], 8);
+            ++pos;
+            continue;
+        }
+        writer.putBits(0, 1);
+        writer.putBits(bestAddress, 13);
+        writer.putBits(bestLength - minMatch, 4);
+        pos += bestLength;
+    }
+    writer.putBits(0, 1);
+    writer.putBits(0, 13);
+    return writer.finish();
+}
+
+// Inverse of remixDecode(): the same walk over the blocks, with the read
+// and write sides swapped.  remixDecode() drops the last byte of odd sized
+// data inside len, so callers pad to an even size first.
+inline QByteArray remixEncode(const QByteArray& plaintext, char mask_init, char mask_step, int remix_step, int len)
+{
+    int size = plaintext.size();
+    QByteArray ciphertext(plaintext);
+    char mask = mask_init;
+    int write_cursor = 0;
+    int read_cursor = 0;
+    for (int j = size & ~1; j > 0 && len > 0; j -= remix_step, len -= remix_step)
+    {
+        if (j < remix_step)
+            remix_step = j;
+        int read_cursor_copy = read_cursor;
+        read_cursor = read_cursor_copy + remix_step - 1;
+        for (int i = (remix_step >> 1) ; i > 0; --i)
+        {
+            ciphertext[write_cursor] = plaintext[read_cursor] ^ mask;
+            ++write_cursor;
+            read_cursor -= 2;
+            mask += mask_step;
+        }
+        read_cursor = read_cursor_copy + remix_step - 2;
+        for (int i = (remix_step >> 1) ; i > 0; --i)
+        {
+            ciphertext[write_cursor] = plaintext[read_cursor] ^ mask;
+            ++write_cursor;
+            read_cursor -= 2;
+            mask += mask_step;
+        }
+        read_cursor = read_cursor_copy + remix_step;
+    }
+    return ciphertext;
+}
+
+// Inverse of remixDecodeV2().
+inline QByteArray remixEncodeV2(const QByteArray& plaintext, char mask_init, char mask_step, int remix_step, int len)
+{
+    QByteArray ciphertext(plaintext);
+    char mask = mask_init;
+    int write_cursor = 0;
+    int read_cursor = 0;
+    for (int j = qMin(len, plaintext.size()) & ~1; j > 0; j -= remix_step)
+    {
+        if (remix_step > j)
+            remix_step = j;
+        int read_cursor_copy = read_cursor + remix_step;
+        read_cursor = read_cursor_copy - 1;
+        for (int i = ((remix_step + 1) >> 1) ; i > 0; --i)
+        {
+            ciphertext[write_cursor] = plaintext[read_cursor] ^ mask;
+            mask += mask_step;
+            ++write_cursor;
+            read_cursor -= 2;
+        }
+        read_cursor = read_cursor_copy - 2;
+        for (int i = (remix_step >> 1) ; i > 0; --i)
+        {
+            ciphertext[write_cursor] = plaintext[read_cursor] ^ mask;
+            mask += mask_step;
+            ++write_cursor;
+            read_cursor -= 2;
+        }
+        read_cursor = read_cursor_copy;
+    }
+    return ciphertext;
+}
+
+#endif // ENCODERS_H
@@ -0,0 +1,632 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QCoreApplication>
+#include <QByteArray>
+#include <QIODevice>
+#include <QStringList>
+#include <QFile>
+#include <QDir>
+#include <QtEndian>
+#include <cstdio>
+#include <vorbis/vorbisenc.h>
+
+#include "helperfuncs.h"
+#include "encoders.h"
+
+// Writes synthetic game directories that the loader plugins accept, one for
+// each archive format:
+//
+//     th06   PBG3 archive of .pos loop files, plain wave files beside it
+//     th07   PBG4 archive, compressed thbgm.fmt, raw thbgm.dat
+//     th08   PBGX archive, thbgm.fmt encrypted and compressed
+//     th10   THA1 archive
+//     th12   THA1 archive with the second cipher
+//     th075  wave files carrying SoundForge loop chunks in th075bgm.dat
+//     th105  XORed Ogg Vorbis and .sfl loop files in an MT encrypted archive
+//     th123  the same as th105
+//
+// The audio is a triangle wave and noise, different for every track, with
+// the loop from a quarter in to an eighth before the end.  Nothing from the
+// games is needed; the track names only have to match what each loader
+// looks up.
+//
+//     fixtures [--seconds N] <output directory>
+
+namespace
+{
+    const uint _samplerate = 44100;
+    const uint _channels = 2;
+    const uint _blockwidth = 4;
+
+    struct Track
+    {
+        QByteArray pcm;
+        quint32 frames;
+        quint32 loopBegin;
+        quint32 loopEnd;
+    };
+
+    Track synthesizeTrack(uint index, uint seconds)
+    {
+        Track track;
+        track.frames = seconds * _samplerate;
+        track.loopBegin = track.frames / 4;
+        track.loopEnd = track.frames - track.frames / 8;
+        track.pcm.resize(track.frames * _blockwidth);
+
+        // Integer only, so every platform writes the same bytes.
+        Random random(index + 1);
+        quint32 phase[_channels] = {0, 0};
+        const quint32 step[_channels] = {
+            (220u + 20u * (index % 12)) * (0xffffffffu / _samplerate),
+            (330u + 15u * (index % 16)) * (0xffffffffu / _samplerate),
+        };
+        uchar* out = reinterpret_cast<uchar*>(track.pcm.data());
+        for (quint32 i = 0; i < track.frames; ++i)
+        {
+            for (uint c = 0; c < _channels; ++c)
+            {
+                const int triangle = qAbs(static_cast<int>(phase[c] >> 16) - 32768) * 2 - 32768;
+                const int noise = static_cast<int>(random.next() >> 20) - 2048;
+                qToLittleEndian<qint16>(triangle / 4 + noise, out);
+                out += 2;
+                phase[c] += step[c];
+            }
+        }
+        return track;
+    }
+
+    QList<Track> synthesizeTracks(uint count, uint seconds)
+    {
+        QList<Track> tracks;
+        for (uint i = 0; i < count; ++i)
+            tracks << synthesizeTrack(i, seconds);
+        return tracks;
+    }
+
+    void append16(QByteArray& data, quint16 value)
+    {
+        uchar buffer[2];
+        qToLittleEndian(value, buffer);
+        data.append(reinterpret_cast<const char*>(buffer), 2);
+    }
+
+    void append32(QByteArray& data, quint32 value)
+    {
+        uchar buffer[4];
+        qToLittleEndian(value, buffer);
+        data.append(reinterpret_cast<const char*>(buffer), 4);
+    }
+
+    void set32(QByteArray& data, int pos, quint32 value)
+    {
+        qToLittleEndian(value, reinterpret_cast<uchar*>(data.data() + pos));
+    }
+
+    void appendChunk(QByteArray& data, const char* marker, const QByteArray& payload)
+    {
+        data.append(marker, 4);
+        append32(data, payload.size());
+        data.append(payload);
+        if (payload.size() & 1)
+            data.append('\0');
+    }
+
+    // The 16 byte PCMWAVEFORMAT of 44.1kHz 16-bit stereo, also stored in the
+    // thbgm.fmt entries.
+    QByteArray waveFormat()
+    {
+        QByteArray format;
+        append16(format, 1);
+        append16(format, _channels);
+        append32(format, _samplerate);
+        append32(format, _samplerate * _blockwidth);
+        append16(format, _blockwidth);
+        append16(format, 16);
+        return format;
+    }
+
+    // The cue and LIST/adtl/ltxt chunks Sound Forge writes for a region,
+    // which is what SFLParser() reads the loop from.
+    QByteArray loopChunks(quint32 loopBegin, quint32 loopEnd)
+    {
+        QByteArray cue;
+        append32(cue, 1);           // cue points
+        append32(cue, 1);           // name
+        append32(cue, loopBegin);   // position
+        cue.append("data", 4);
+        append32(cue, 0);           // chunk start
+        append32(cue, 0);           // block start
+        append32(cue, loopBegin);   // sample offset
+
+        QByteArray ltxt;
+        append32(ltxt, 1);          // name
+        append32(ltxt, loopEnd - loopBegin);
+        ltxt.append("rgn ", 4);
+        append16(ltxt, 0);          // country
+        append16(ltxt, 0);          // language
+        append16(ltxt, 0);          // dialect
+        append16(ltxt, 0);          // code page
+        QByteArray adtl("adtl");
+        appendChunk(adtl, "ltxt", ltxt);
+
+        QByteArray chunks;
+        appendChunk(chunks, "cue ", cue);
+        appendChunk(chunks, "LIST", adtl);
+        return chunks;
+    }
+
+    QByteArray riff(const QByteArray& chunks)
+    {
+        QByteArray data("RIFF");
+        append32(data, chunks.size() + 4);
+        data.append("WAVE", 4);
+        data.append(chunks);
+        return data;
+    }
+
+    QByteArray waveFile(const Track& track, bool withLoop)
+    {
+        QByteArray chunks;
+        appendChunk(chunks, "fmt ", waveFormat());
+        appendChunk(chunks, "data", track.pcm);
+        if (withLoop)
+            chunks.append(loopChunks(track.loopBegin, track.loopEnd));
+        return riff(chunks);
+    }
+
+    QByteArray sflFile(const Track& track)
+    {
+        return riff(loopChunks(track.loopBegin, track.loopEnd));
+    }
+
+    QByteArray oggVorbis(const Track& track, int serial)
+    {
+        vorbis_info vi;
+        vorbis_info_init(&vi);
+        if (vorbis_encode_init_vbr(&vi, _channels, _samplerate, 0.3f) != 0)
+        {
+            vorbis_info_clear(&vi);
+            return QByteArray();
+        }
+        vorbis_comment vc;
+        vorbis_comment_init(&vc);
+        vorbis_dsp_state vd;
+        vorbis_analysis_init(&vd, &vi);
+        vorbis_block vb;
+        vorbis_block_init(&vd, &vb);
+        ogg_stream_state os;
+        ogg_stream_init(&os, serial);
+
+        QByteArray ogg;
+        ogg_page page;
+        {
+            ogg_packet header;
+            ogg_packet comment;
+            ogg_packet code;
+            vorbis_analysis_headerout(&vd, &vc, &header, &comment, &code);
+            ogg_stream_packetin(&os, &header);
+            ogg_stream_packetin(&os, &comment);
+            ogg_stream_packetin(&os, &code);
+            while (ogg_stream_flush(&os, &page))
+            {
+                ogg.append(reinterpret_cast<const char*>(page.header), page.header_len);
+                ogg.append(reinterpret_cast<const char*>(page.body), page.body_len);
+            }
+        }
+
+        const uchar* in = reinterpret_cast<const uchar*>(track.pcm.constData());
+        const long chunk = 4096;
+        for (long done = 0; ; )
+        {
+            const long frames = qMin<long>(chunk, track.frames - done);
+            if (frames > 0)
+            {
+                float** buffer = vorbis_analysis_buffer(&vd, frames);
+                for (long i = 0; i < frames; ++i)
+                {
+                    for (uint c = 0; c < _channels; ++c)
+                    {
+                        buffer[c][i] = qFromLittleEndian<qint16>(in) * (1.0f / 32768.0f);
+                        in += 2;
+                    }
+                }
+            }
+            vorbis_analysis_wrote(&vd, frames);
+            while (vorbis_analysis_blockout(&vd, &vb) == 1)
+            {
+                vorbis_analysis(&vb, NULL);
+                vorbis_bitrate_addblock(&vb);
+                ogg_packet packet;
+                while (vorbis_bitrate_flushpacket(&vd, &packet))
+                {
+                    ogg_stream_packetin(&os, &packet);
+                    while (ogg_stream_pageout(&os, &page))
+                    {
+                        ogg.append(reinterpret_cast<const char*>(page.header), page.header_len);
+                        ogg.append(reinterpret_cast<const char*>(page.body), page.body_len);
+                    }
+                }
+            }
+            if (frames <= 0)
+                break;
+            done += frames;
+        }
+        while (ogg_stream_flush(&os, &page))
+        {
+            ogg.append(reinterpret_cast<const char*>(page.header), page.header_len);
+            ogg.append(reinterpret_cast<const char*>(page.body), page.body_len);
+        }
+
+        ogg_stream_clear(&os);
+        vorbis_block_clear(&vb);
+        vorbis_dsp_clear(&vd);
+        vorbis_comment_clear(&vc);
+        vorbis_info_clear(&vi);
+        return ogg;
+    }
+
+    // The ThbgmData table and the thbgm.dat it describes.  Loop points are
+    // stored in bytes.
+    QByteArray thbgmTable(const QString& wavName, const char* const* ids, const QList<Track>& tracks, QByteArray& thbgm)
+    {
+        QByteArray table;
+        thbgm.clear();
+        for (int i = 0; i < tracks.size(); ++i)
+        {
+            QByteArray name = wavName.arg(ids[i]).toLatin1().leftJustified(16, '\0', true);
+            table.append(name);
+            append32(table, thbgm.size());
+            append32(table, 0);     // checksum, unused
+            append32(table, tracks.at(i).loopBegin * _blockwidth);
+            append32(table, tracks.at(i).loopEnd * _blockwidth);
+            table.append(waveFormat());
+            append32(table, 0);
+            thbgm.append(tracks.at(i).pcm);
+        }
+        return table;
+    }
+
+    // A PBG4/PBGX/THA1 file table entry: the name, then offset, size and a
+    // reserved word.  THA1 pads the name to four bytes.
+    QByteArray archiveEntry(const char* name, quint32 offset, quint32 size, bool aligned)
+    {
+        QByteArray entry(name);
+        entry.append('\0');
+        while (aligned && (entry.size() & 3) != 0)
+            entry.append('\0');
+        append32(entry, offset);
+        append32(entry, size);
+        append32(entry, 0);
+        return entry;
+    }
+
+    QByteArray padToEven(QByteArray data)
+    {
+        if (data.size() & 1)
+            data.append('\0');
+        return data;
+    }
+
+    bool writeFile(const QDir& dir, const QString& name, const QByteArray& data)
+    {
+        QFile file(dir.filePath(name));
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+        {
+            std::fprintf(stderr, "%s: %s\n", qPrintable(file.fileName()), qPrintable(file.errorString()));
+            return false;
+        }
+        return true;
+    }
+
+    bool writeTh06(const QDir& dir, uint seconds)
+    {
+        const uint count = 17;
+        QList<Track> tracks = synthesizeTracks(count, seconds);
+        if (!dir.mkpath("bgm"))
+            return false;
+
+        QByteArray archive("PBG3");
+        archive.append(QByteArray(9, '\0'));
+        BitWriter header;
+        for (uint i = 0; i < count; ++i)
+        {
+            const QString number = QString("%1").arg(i + 1, 2, 10, QLatin1Char('0'));
+            if (!writeFile(dir, QString("bgm/th06_%1.wav").arg(number), waveFile(tracks.at(i), false)))
+                return false;
+
+            QByteArray pos;
+            append32(pos, tracks.at(i).loopBegin);
+            append32(pos, tracks.at(i).loopEnd);
+            const QByteArray compressed = lzCompress(pos);
+            quint32 checksum = 0;
+            for (int j = 0; j < compressed.size(); ++j)
+                checksum += static_cast<uchar>(compressed.at(j));
+
+            header.putUInt32(0);    // time
+            header.putUInt32(0);    // time
+            header.putUInt32(checksum);
+            header.putUInt32(archive.size());
+            header.putUInt32(pos.size());
+            foreach (char c, QString("th06_%1.pos").arg(number).toLatin1())
+                header.putBits(static_cast<uchar>(c), 8);
+            header.putBits(0, 8);
+            archive.append(compressed);
+        }
+        BitWriter description;
+        description.putUInt32(count);
+        description.putUInt32(archive.size());
+        archive.replace(4, 9, description.finish().leftJustified(9, '\0', true));
+        archive.append(header.finish());
+        return writeFile(dir, QString::fromWCharArray(L"\u7d05\u9b54\u90f7MD.DAT"), archive);
+    }
+
+    bool writeTh07(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "01", "02", "03", "04", "05", "06", "07", "08", "09", "10",
+            "11", "12", "13", "13b", "16", "17", "18", "19", "14", "15",
+        };
+        QByteArray thbgm;
+        const QByteArray table = thbgmTable("th07_%1.wav", ids, synthesizeTracks(sizeof(ids) / sizeof(ids[0]), seconds), thbgm);
+
+        QByteArray archive("PBG4");
+        archive.append(QByteArray(12, '\0'));
+        QByteArray header = archiveEntry("thbgm.fmt", archive.size(), table.size(), false);
+        archive.append(lzCompress(table));
+        // the loader takes the compressed size from the entry that follows
+        header.append(archiveEntry("readme.txt", archive.size(), 4, false));
+        archive.append(lzCompress("none"));
+        set32(archive, 4, 2);
+        set32(archive, 8, archive.size());
+        set32(archive, 12, header.size());
+        archive.append(lzCompress(header));
+        return writeFile(dir, "Th07.dat", archive) && writeFile(dir, "Thbgm.dat", thbgm);
+    }
+
+    bool writeTh08(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "01", "00", "03", "04", "05", "06", "07", "08", "09", "10",
+            "11", "12", "13", "14", "15", "13b", "18", "19", "16", "17", "20",
+        };
+        QByteArray thbgm;
+        const QByteArray table = thbgmTable("th08_%1.wav", ids, synthesizeTracks(sizeof(ids) / sizeof(ids[0]), seconds), thbgm);
+
+        QByteArray archive("PBGX");
+        archive.append(QByteArray(12, '\0'));
+        QByteArray header = archiveEntry("thbgm.fmt", archive.size(), table.size(), false);
+        // the last byte of the magic picks the cipher, 'T' is one the games use
+        QByteArray fmt = QByteArray("THBT") + remixEncode(padToEven(table), 0x51, 0xe9, 0x40, 0x3000);
+        archive.append(lzCompress(fmt));
+        header.append(archiveEntry("readme.txt", archive.size(), 4, false));
+        archive.append(lzCompress("none"));
+
+        QByteArray preHeader;
+        append32(preHeader, 2 + 123456);
+        append32(preHeader, archive.size() + 345678);
+        append32(preHeader, 0x2000 + 567891);
+        archive.replace(4, 12, remixEncode(preHeader, 0x1b, 0x37, 0xc, 0x400));
+        archive.append(remixEncode(padToEven(lzCompress(header)), 0x3e, 0x9b, 0x80, 0x400));
+        return writeFile(dir, "th08.dat", archive) && writeFile(dir, "thbgm.dat", thbgm);
+    }
+
+    // thbgm.fmt always uses key 7 of the loader's KeyData, which differs
+    // between th10 and th12.
+    bool writeTha1(const QDir& dir, const QString& fileName, const QString& wavName,
+            const char* const* ids, uint count, const int key[4], bool v2, uint seconds)
+    {
+        QByteArray (*encode)(const QByteArray&, char, char, int, int) = v2 ? remixEncodeV2 : remixEncode;
+        QByteArray thbgm;
+        const QByteArray table = thbgmTable(wavName, ids, synthesizeTracks(count, seconds), thbgm);
+
+        QByteArray archive(16, '\0');
+        const QByteArray fmt = encode(padToEven(lzCompress(table)), key[0], key[1], key[2], key[3]);
+        Q_ASSERT(fmt.size() != table.size());
+        const QByteArray header = archiveEntry("thbgm.fmt", archive.size(), table.size(), true);
+        archive.append(fmt);
+
+        const QByteArray compressedHeader = padToEven(lzCompress(header));
+        QByteArray preHeader("THA1");
+        append32(preHeader, header.size() + 123456789);
+        append32(preHeader, compressedHeader.size() + 987654321);
+        append32(preHeader, 1 + 135792468);
+        archive.replace(0, 16, encode(preHeader, 0x1b, 0x37, 0x10, 0x10));
+        archive.append(encode(compressedHeader, 0x3e, 0x9b, 0x80, compressedHeader.size()));
+        return writeFile(dir, fileName, archive) && writeFile(dir, "thbgm.dat", thbgm);
+    }
+
+    bool writeTh10(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "02", "00", "01", "03", "04", "05", "06", "07", "08", "09",
+            "10", "11", "12", "15", "16", "13", "14", "17",
+        };
+        static const int key[4] = {0x99, 0x37, 0x400, 0x2000};
+        return writeTha1(dir, "th10.dat", "th10_%1.wav", ids, sizeof(ids) / sizeof(ids[0]), key, false, seconds);
+    }
+
+    bool writeTh12(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "01", "00", "02", "04", "05", "07", "08", "09", "10", "13",
+            "14", "16", "17", "18", "19", "20", "21",
+        };
+        static const int key[4] = {0x35, 0x79, 0x400, 0x3c00};
+        return writeTha1(dir, "th12.dat", "th12_%1.wav", ids, sizeof(ids) / sizeof(ids[0]), key, true, seconds);
+    }
+
+    bool writeTh075(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "sys00_op", "00a", "00b", "01a", "01b", "02a", "02b", "03a", "03b", "04a",
+            "04b", "05a", "05b", "06a", "07a", "00c", "08a", "09a", "53", "sys99_ed",
+            "51", "52", "54", "56", "57", "58", "67", "62", "59", "68",
+            "60", "61", "65", "63",
+        };
+        const uint count = sizeof(ids) / sizeof(ids[0]);
+        const int descriptionSize = 108;
+        QList<Track> tracks = synthesizeTracks(count, seconds);
+
+        QByteArray header;
+        QByteArray data;
+        const int dataBegin = 2 + count * descriptionSize;
+        for (uint i = 0; i < count; ++i)
+        {
+            const QByteArray wav = waveFile(tracks.at(i), true);
+            header.append(QString("wave\\bgm\\%1.wav").arg(ids[i]).toLatin1().leftJustified(100, '\0', true));
+            append32(header, wav.size());
+            append32(header, dataBegin + data.size());
+            data.append(wav);
+        }
+        // the same running XOR Th075Loader undoes
+        quint8 mask = 0x64;
+        quint8 step = 0x64;
+        for (int i = 0; i < header.size(); ++i)
+        {
+            header.data()[i] ^= mask;
+            mask += step;
+            step += 0x4d;
+        }
+        QByteArray archive;
+        append16(archive, count);
+        return writeFile(dir, "th075bgm.dat", archive + header + data);
+    }
+
+    // th105 and th123: every file is XORed with a key taken from its
+    // offset, and the file table with the MT stream mtHeaderDecrypt()
+    // produces, which undoes itself.
+    bool writeTasofro(const QDir& dir, const QString& fileName, const char* const* ids, uint count, uint seconds)
+    {
+        QList<Track> tracks = synthesizeTracks(count, seconds);
+        QList<QByteArray> names;
+        QList<QByteArray> files;
+        for (uint i = 0; i < count; ++i)
+        {
+            const QByteArray ogg = oggVorbis(tracks.at(i), i + 1);
+            if (ogg.isEmpty())
+            {
+                std::fprintf(stderr, "vorbis encoder failed\n");
+                return false;
+            }
+            names << QByteArray(ids[i]) + ".ogg" << QByteArray(ids[i]) + ".sfl";
+            files << ogg << sflFile(tracks.at(i));
+        }
+
+        int headerSize = 0;
+        foreach (const QByteArray& name, names)
+            headerSize += 9 + name.size();
+        QByteArray header;
+        QByteArray data;
+        const quint32 dataBegin = 6 + headerSize;
+        for (int i = 0; i < files.size(); ++i)
+        {
+            const quint32 offset = dataBegin + data.size();
+            append32(header, offset);
+            append32(header, files.at(i).size());
+            header.append(static_cast<char>(names.at(i).size()));
+            header.append(names.at(i));
+            QByteArray file = files.at(i);
+            void* key = reinterpret_cast<void*>(static_cast<quintptr>(((offset >> 1) & 0xff) | 0x23));
+            for (int j = 0; j < file.size(); ++j)
+                file.data()[j] = xorDecoder(key, file.at(j));
+            data.append(file);
+        }
+        mtHeaderDecrypt(header.data(), header.size());
+
+        QByteArray archive;
+        append16(archive, files.size());
+        append32(archive, header.size());
+        return writeFile(dir, fileName, archive + header + data);
+    }
+
+    bool writeTh105(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "data/bgm/op", "data/bgm/sr", "data/bgm/ta00", "data/bgm/ta01", "data/bgm/ta02",
+            "data/bgm/ta03", "data/bgm/ta04", "data/bgm/ta05", "data/bgm/ta06", "data/bgm/ta07",
+            "data/bgm/ta08", "data/bgm/st00", "data/bgm/st01", "data/bgm/st02", "data/bgm/st03",
+            "data/bgm/st04", "data/bgm/st05", "data/bgm/st06", "data/bgm/st10", "data/bgm/st11",
+            "data/bgm/st12", "data/bgm/st13", "data/bgm/st14", "data/bgm/st15", "data/bgm/st16",
+            "data/bgm/st17", "data/bgm/st18", "data/bgm/st19", "data/bgm/st20", "data/bgm/st21",
+            "data/bgm/st22",
+        };
+        return writeTasofro(dir, "th105b.dat", ids, sizeof(ids) / sizeof(ids[0]), seconds);
+    }
+
+    bool writeTh123(const QDir& dir, uint seconds)
+    {
+        static const char* const ids[] = {
+            "data/bgm/op2", "data/bgm/sr2", "data/bgm/select", "data/bgm/st30", "data/bgm/st31",
+            "data/bgm/st32", "data/bgm/st33", "data/bgm/st34", "data/bgm/st35", "data/bgm/st36",
+            "data/bgm/st40", "data/bgm/st41", "data/bgm/st42", "data/bgm/st43", "data/bgm/st99",
+            "data/bgm/ta00", "data/bgm/ta01", "data/bgm/ta03", "data/bgm/ta04", "data/bgm/ta05",
+            "data/bgm/ta06", "data/bgm/ta20", "data/bgm/ta21", "data/bgm/ta22",
+        };
+        return writeTasofro(dir, "th123b.dat", ids, sizeof(ids) / sizeof(ids[0]), seconds);
+    }
+
+    struct Fixture
+    {
+        const char* name;
+        bool (*write)(const QDir&, uint);
+    };
+
+    const Fixture _fixtures[] = {
+        {"th06", writeTh06},
+        {"th07", writeTh07},
+        {"th08", writeTh08},
+        {"th10", writeTh10},
+        {"th12", writeTh12},
+        {"th075", writeTh075},
+        {"th105", writeTh105},
+        {"th123", writeTh123},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments().mid(1);
+    uint seconds = 4;
+    if (arguments.size() >= 2 && arguments.first() == "--seconds")
+    {
+        seconds = qMax(1U, arguments.at(1).toUInt());
+        arguments = arguments.mid(2);
+    }
+    if (arguments.size() != 1)
+    {
+        std::fprintf(stderr, "usage: fixtures [--seconds N] <output directory>\n");
+        return 2;
+    }
+
+    QDir output(arguments.first());
+    for (uint i = 0; i < sizeof(_fixtures) / sizeof(_fixtures[0]); ++i)
+    {
+        const Fixture& fixture = _fixtures[i];
+        if (!output.mkpath(fixture.name))
+        {
+            std::fprintf(stderr, "cannot create %s\n", qPrintable(output.filePath(fixture.name)));
+            return 1;
+        }
+        std::printf("%s\n", fixture.name);
+        std::fflush(stdout);
+        if (!fixture.write(QDir(output.filePath(fixture.name)), seconds))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QCoreApplication>
+#include <QByteArray>
+#include <QIODevice>
+#include <QVector>
+#include <QTime>
+#include <QStringList>
+#include <cstdio>
+
+#include "helperfuncs.h"
+#include "musicdata.h"
+#include "sampleops.h"
+#include "encoders.h"
+
+// Times the codec and DSP kernels on synthetic input that is the same on
+// every run.  Each kernel is repeated until it has run for at least
+// _minimumTime ms and reported as input throughput, and for the audio
+// kernels also as time per stereo frame.
+//
+//     kernels [filter...]
+//
+// runs only the kernels whose name contains one of the filters.
+
+namespace
+{
+    const int _minimumTime = 500;
+    const int _dataSize = 4 << 20;
+    const int _frames = 1 << 16;
+    const uint _channels = 2;
+
+    // Text-like bytes with plenty of repeats, roughly as compressible as the
+    // archive headers and bgm tables.
+    QByteArray syntheticData(int size)
+    {
+        static const char* words[] = {
+            "thbgm", ".fmt", ".wav", ".ogg", "loop", "data/bgm/", "st0", "ed",
+            "title", "boss", "ending", "staffroll",
+        };
+        const int wordCount = sizeof(words) / sizeof(words[0]);
+        Random random;
+        QByteArray data;
+        data.reserve(size);
+        while (data.size() < size)
+        {
+            quint32 r = random.next();
+            if ((r >> 28) < 3)
+                data.append(static_cast<char>(r >> 8));
+            else
+                data.append(words[(r >> 8) % wordCount]);
+        }
+        data.resize(size);
+        return data;
+    }
+
+    template <typename T>
+    QVector<T> syntheticAudio(qint64 frames);
+
+    template <>
+    QVector<qint16> syntheticAudio<qint16>(qint64 frames)
+    {
+        Random random;
+        QVector<qint16> audio(frames * _channels);
+        for (int i = 0; i < audio.size(); ++i)
+            audio[i] = static_cast<qint16>(random.next() >> 16);
+        return audio;
+    }
+
+    template <>
+    QVector<float> syntheticAudio<float>(qint64 frames)
+    {
+        Random random;
+        QVector<float> audio(frames * _channels);
+        for (int i = 0; i < audio.size(); ++i)
+            audio[i] = static_cast<qint32>(random.next()) * (1.0f / 2147483648.0f);
+        return audio;
+    }
+
+    // Keeps results alive so the compiler cannot drop the work.
+    volatile int _sink;
+
+    class Benchmark
+    {
+        public:
+            virtual ~Benchmark() {}
+            virtual const char* name() const = 0;
+            // bytes of input per run
+            virtual qint64 bytes() const = 0;
+            // stereo frames per run, 0 for the non-audio kernels
+            virtual qint64 frames() const { return 0; }
+            virtual void run() = 0;
+    };
+
+    template <typename Function>
+    class ByteBenchmark : public Benchmark
+    {
+        public:
+            ByteBenchmark(const char* name, const QByteArray& input, Function function) :
+                _name(name), _input(input), _function(function) {}
+            const char* name() const { return _name; }
+            qint64 bytes() const { return _input.size(); }
+            void run() { _sink = _function(_input); }
+        private:
+            const char* _name;
+            QByteArray _input;
+            Function _function;
+    };
+
+    template <typename Function>
+    Benchmark* byteBenchmark(const char* name, const QByteArray& input, Function function)
+    {
+        return new ByteBenchmark<Function>(name, input, function);
+    }
+
+    template <typename T, typename Function>
+    class AudioBenchmark : public Benchmark
+    {
+        public:
+            AudioBenchmark(const char* name, Function function) :
+                _name(name), _input(syntheticAudio<T>(_frames)), _work(_input), _function(function) {}
+            const char* name() const { return _name; }
+            qint64 bytes() const { return _input.size() * sizeof(T); }
+            qint64 frames() const { return _frames; }
+            void run()
+            {
+                // restore the input so a fade or gain never runs on its own output
+                qMemCopy(_work.data(), _input.constData(), bytes());
+                _function(_work.data(), _frames);
+                _sink = static_cast<int>(_work.at(_frames));
+            }
+        private:
+            const char* _name;
+            QVector<T> _input;
+            QVector<T> _work;
+            Function _function;
+    };
+
+    template <typename T, typename Function>
+    Benchmark* audioBenchmark(const char* name, Function function)
+    {
+        return new AudioBenchmark<T, Function>(name, function);
+    }
+
+    // The kernels, as plain functions so they can be handed to the templates.
+    int runLzDecompress(const QByteArray& input) { return lzDecompress(input, _dataSize).size(); }
+    int runLzDecompressChecksum(const QByteArray& input) { int checksum; return lzDecompressChecksum(checksum, input, _dataSize).size() + checksum; }
+    int runLzDecompressDictSize(const QByteArray& input) { return lzDecompressDictSize(input, 0x2000, _dataSize).size(); }
+    int runRemixDecode(const QByteArray& input) { return remixDecode(input, 0x3e, 0x9b, 0x80, input.size()).size(); }
+    int runRemixDecodeV2(const QByteArray& input) { return remixDecodeV2(input, 0x3e, 0x9b, 0x80, input.size()).size(); }
+    int runMtHeaderDecrypt(const QByteArray& input)
+    {
+        QByteArray header(input);
+        mtHeaderDecrypt(header.data(), header.size());
+        return header.at(0);
+    }
+    int runArchiveDecoder(const QByteArray& input)
+    {
+        // what MusicFile::_readData() does to every read from an archive
+        const ArchiveMusicData archive(QString(), 0, input.size(), NULL, xorDecoder,
+                reinterpret_cast<void*>(static_cast<quintptr>(0x5b)));
+        QByteArray data(input);
+        archive.decode(data.data(), data.size());
+        return data.at(0);
+    }
+
+    template <typename T>
+    void runFade(T* data, qint64 frames)
+    {
+        // LoopMusicFile's fade-out, run over its last buffer
+        SampleOps::applyFade(data, frames, _channels, frames, frames, false, true);
+    }
+
+    template <typename T>
+    void runGainRamp(T* data, qint64 frames)
+    {
+        // MusicPlayer's callback volume ramp, fading from full to half
+        SampleOps::applyGainRamp(data, frames, _channels, 1.0, 0.5, 0.5 / frames);
+    }
+
+    void runInt16ToInt32(qint16* data, qint64 frames)
+    {
+        static QVector<qint32> out(_frames * _channels);
+        SampleOps::int16ToInt32(data, out.data(), frames * _channels);
+        _sink = out.at(frames);
+    }
+
+    void measure(Benchmark* benchmark)
+    {
+        benchmark->run(); // warm up
+        QTime time;
+        time.start();
+        qint64 runs = 0;
+        int elapsed;
+        do
+        {
+            benchmark->run();
+            ++runs;
+        } while ((elapsed = time.elapsed()) < _minimumTime);
+
+        const double seconds = elapsed * 0.001;
+        const double megabytes = static_cast<double>(benchmark->bytes()) * runs / (1024.0 * 1024.0);
+        if (benchmark->frames() != 0)
+        {
+            const double nsPerFrame = seconds * 1e9 / (static_cast<double>(benchmark->frames()) * runs);
+            std::printf("%-28s %10.1f MB/s %10.2f ns/frame\n", benchmark->name(), megabytes / seconds, nsPerFrame);
+        }
+        else
+            std::printf("%-28s %10.1f MB/s\n", benchmark->name(), megabytes / seconds);
+        std::fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList filters = app.arguments().mid(1);
+
+    const QByteArray plain = syntheticData(_dataSize);
+    const QByteArray compressed = lzCompress(plain);
+    if (lzDecompress(compressed, plain.size()) != plain)
+    {
+        std::fprintf(stderr, "lzCompress does not round trip\n");
+        return 1;
+    }
+
+    QList<Benchmark*> benchmarks;
+    benchmarks
+        << byteBenchmark("lzDecompress", compressed, runLzDecompress)
+        << byteBenchmark("lzDecompressChecksum", compressed, runLzDecompressChecksum)
+        << byteBenchmark("lzDecompressDictSize", compressed, runLzDecompressDictSize)
+        << byteBenchmark("remixDecode", plain, runRemixDecode)
+        << byteBenchmark("remixDecodeV2", plain, runRemixDecodeV2)
+        << byteBenchmark("mtHeaderDecrypt", plain, runMtHeaderDecrypt)
+        << byteBenchmark("archive decoder", plain, runArchiveDecoder)
+        << audioBenchmark<qint16>("fade int16", runFade<qint16>)
+        << audioBenchmark<float>("fade float", runFade<float>)
+        << audioBenchmark<qint16>("gain ramp int16", runGainRamp<qint16>)
+        << audioBenchmark<float>("gain ramp float", runGainRamp<float>)
+        << audioBenchmark<qint16>("int16 to int32", runInt16ToInt32);
+
+    foreach (Benchmark* benchmark, benchmarks)
+    {
+        bool selected = filters.isEmpty();
+        foreach (const QString& filter, filters)
+            selected = selected || QString(benchmark->name()).contains(filter, Qt::CaseInsensitive);
+        if (selected)
+            measure(benchmark);
+    }
+    qDeleteAll(benchmarks);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QApplication>
+#include <QStringList>
+#include <QSemaphore>
+#include <QDir>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "pluginloader.h"
+#include "musicfile_ogg.h"
+#include "musicfile_wav.h"
+#include "threadmusicfile.h"
+#include "audiosink_null.h"
+#include "telemetry.h"
+#include "tracefile.h"
+
+// Plays the game directories written by the fixtures tool through the chain
+// the player uses: loader plugin, MusicFile, LoopMusicFile, ThreadMusicFile
+// and the null sink, which pulls as fast as the decoder delivers.  For every
+// directory it reports how long the loader takes to open it, and for every
+// loop count how many times faster than real time the first tracks play.
+//
+//     pipeline [--tracks N] [--loops 1,2,...] [--runs N] <fixtures directory>
+//
+// The settings are kept apart from the player's, so every run uses the
+// defaults.  Underruns should stay 0; the sink waits for the decoder rather
+// than playing silence.
+
+namespace
+{
+    struct _Playback
+    {
+        ThreadMusicFile* file;
+        QSemaphore done;
+    };
+
+    unsigned long _render(void* output, unsigned long frames, PaTime, bool /*realtime*/, void* userData)
+    {
+        _Playback* playback = static_cast<_Playback*>(userData);
+        ThreadMusicFile* file = playback->file;
+        file->waitForData(frames, 1000);
+        memset(output, 0, frames * file->blockwidth());
+        const qint64 read = file->sampleRead(static_cast<char*>(output), frames);
+        if (read > 0)
+            return read;
+        playback->done.release();
+        return 0;
+    }
+
+    // Returns the wall time in microseconds, or -1 when the track does not
+    // open.
+    qint64 play(const MusicData& musicData, uint loops, qint64& frames, uint& samplerate)
+    {
+        ThreadMusicFile file(musicData, loops);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            std::fprintf(stderr, "%s: %s\n", qPrintable(musicData.fileName()), qPrintable(file.errorString()));
+            return -1;
+        }
+        frames = file.sampleSize();
+        samplerate = file.samplerate();
+
+        _Playback playback;
+        playback.file = &file;
+        AudioSink_Null sink;
+        const qint64 begin = Telemetry::now();
+        sink.open(file.channels(), file.samplerate(), file.sampleFormat(), _render, &playback);
+        sink.start();
+        playback.done.acquire();
+        const qint64 duration = Telemetry::now() - begin;
+        sink.close();
+        file.close();
+        return duration;
+    }
+
+    // The loader that accepts the directory, and the median time its open()
+    // takes; -1 when none does.
+    qint64 openTime(PluginLoader& loader, const QString& path, uint runs, QString& title)
+    {
+        title.clear();
+        for (int id = 0; id < loader.size() && title.isEmpty(); ++id)
+        {
+            loader.clear();
+            if (loader.load(loader.title(id), path))
+                title = loader.title(id);
+        }
+        if (title.isEmpty())
+            return -1;
+        QList<qint64> times;
+        for (uint i = 0; i < runs; ++i)
+        {
+            loader.clear();
+            const qint64 begin = Telemetry::now();
+            loader.load(title, path);
+            times << Telemetry::now() - begin;
+        }
+        std::sort(times.begin(), times.end());
+        return times.at(times.size() / 2);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    QApplication app(argc, argv, false);
+    app.setOrganizationName("Touhou Music Player");
+    app.setApplicationName("Touhou Music Player Benchmarks");
+
+    uint tracks = 2;
+    uint runs = 5;
+    QList<uint> loopCounts;
+    loopCounts << 1 << 2;
+    QStringList arguments = app.arguments().mid(1);
+    while (arguments.size() >= 2 && arguments.first().startsWith("--"))
+    {
+        const QString option = arguments.takeFirst();
+        const QString value = arguments.takeFirst();
+        if (option == "--tracks")
+            tracks = qMax(1U, value.toUInt());
+        else if (option == "--runs")
+            runs = qMax(1U, value.toUInt());
+        else if (option == "--loops")
+        {
+            loopCounts.clear();
+            foreach (const QString& loops, value.split(',', QString::SkipEmptyParts))
+                loopCounts << qMax(1U, loops.toUInt());
+        }
+        else
+            arguments.clear();
+    }
+    if (arguments.size() != 1 || loopCounts.isEmpty())
+    {
+        std::fprintf(stderr, "usage: pipeline [--tracks N] [--loops 1,2,...] [--runs N] <fixtures directory>\n");
+        return 2;
+    }
+
+    MusicFileFactory::registerMusicFile(".ogg", MusicFile_Ogg::createFunction);
+    MusicFileFactory::registerMusicFile(".wav", MusicFile_Wav::createFunction);
+
+#ifdef TOUHOU_TRACE
+    TraceFile traceFile;
+    traceFile.install();
+#endif
+
+    PluginLoader loader;
+    if (loader.size() == 0)
+    {
+        std::fprintf(stderr, "no loader plugins next to %s\n", qPrintable(app.applicationFilePath()));
+        return 1;
+    }
+
+    QDir fixtures(arguments.first());
+    std::printf("%-8s %-6s %10s %6s %7s %9s %9s %9s %9s\n",
+        "fixture", "format", "open ms", "loops", "tracks", "audio s", "wall s", "realtime", "underrun");
+    int result = 0;
+    foreach (const QString& name, fixtures.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name))
+    {
+        QString title;
+        const qint64 open = openTime(loader, fixtures.filePath(name), runs, title);
+        if (open < 0)
+        {
+            std::fprintf(stderr, "%s: no loader accepts it\n", qPrintable(name));
+            result = 1;
+            continue;
+        }
+        const QString format = loader.musicData(0).suffix();
+        foreach (uint loops, loopCounts)
+        {
+            const int underruns = Telemetry::underruns();
+            qint64 audio = 0;
+            qint64 wall = 0;
+            uint played = 0;
+            for (int i = 0; i < loader.musicSize() && played < tracks; ++i, ++played)
+            {
+                qint64 frames;
+                uint samplerate;
+                const qint64 duration = play(loader.musicData(i), loops, frames, samplerate);
+                if (duration < 0)
+                {
+                    result = 1;
+                    break;
+                }
+                audio += frames * 1000000 / samplerate;
+                wall += duration;
+            }
+            std::printf("%-8s %-6s %10.2f %6u %7u %9.2f %9.3f %8.1fx %9d\n",
+                qPrintable(name), qPrintable(format), open * 0.001, loops, played,
+                audio * 1e-6, wall * 1e-6, (wall > 0) ? static_cast<double>(audio) / wall : 0.0,
+                Telemetry::underruns() - underruns);
+            std::fflush(stdout);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,72 @@
+# This file is part of Touhou Music Player.
+#
+# Touhou Music Player is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Touhou Music Player is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+
+TEMPLATE      = app
+TARGET        = pipeline
+# PluginLoader looks for plugins/ beside the binary.
+DESTDIR       = ../..
+CONFIG       += console
+CONFIG       -= app_bundle
+CONFIG       += debug_and_release
+INCLUDEPATH  += ../../include
+HEADERS      += ../../include/pluginloader.h \
+                ../../include/audiosink.h \
+                ../../include/audiosink_null.h \
+                ../../include/lockfree.h \
+                ../../include/sampleops.h \
+                ../../include/resampler.h \
+                ../../include/musicfile.h \
+                ../../include/musicfile_wav.h \
+                ../../include/musicfile_ogg.h \
+                ../../include/loopmusicfile.h \
+                ../../include/threadmusicfile.h \
+                ../../include/decodethread.h \
+                ../../include/threadpolicy.h \
+                ../../include/jobscheduler.h \
+                ../../include/telemetry.h \
+                ../../include/trace.h \
+                ../../include/tracefile.h \
+                ../../include/musicdata.h \
+                ../../include/loaderinterface.h
+SOURCES      += main.cpp \
+                ../../src/pluginloader.cpp \
+                ../../src/audiosink.cpp \
+                ../../src/audiosink_null.cpp \
+                ../../src/resampler.cpp \
+                ../../src/musicfile.cpp \
+                ../../src/musicfile_wav.cpp \
+                ../../src/musicfile_ogg.cpp \
+                ../../src/loopmusicfile.cpp \
+                ../../src/threadmusicfile.cpp \
+                ../../src/decodethread.cpp \
+                ../../src/threadpolicy.cpp \
+                ../../src/jobscheduler.cpp \
+                ../../src/telemetry.cpp \
+                ../../src/tracefile.cpp
+
+trace {
+    DEFINES += TOUHOU_TRACE
+}
+
+win32 {
+    LIBS        += -LC:\dev\lib -lportaudio_x86 -llibogg -llibvorbis -llibvorbisfile
+    INCLUDEPATH += C:\dev\include
+}
+
+unix {
+    CONFIG    += link_pkgconfig
+    PKGCONFIG += portaudio-2.0 vorbisfile
+    !macx:LIBS += -lrt
+}
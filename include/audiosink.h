@@ -0,0 +1,83 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <portaudio.h>
+#include "musicfile.h"
+
+class AudioSinkFactory;
+
+// Where MusicPlayer sends its audio.  A sink pulls buffers from the render
+// function on a thread of its own once started; the render function returns
+// how many frames it rendered, the rest of the buffer is silence, and 0 when
+// there is nothing more to play.  Sinks not paced by a device pass
+// realtime false, and the render function may then wait for its source
+// instead of rendering silence.  Errors are reported as PortAudio
+// error codes so MusicPlayer can classify them the same way for every sink.
+class AudioSink
+{
+    private:
+        AudioSink(const AudioSink&);
+        AudioSink& operator=(const AudioSink&);
+    public:
+        typedef unsigned long (*RenderFunction)(void* output, unsigned long frames, PaTime outputTime, bool realtime, void* userData);
+
+        virtual ~AudioSink() {}
+
+        // Reuses what is already open when the parameters did not change.
+        virtual bool open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+                RenderFunction render, void* userData) = 0;
+        virtual void close() = 0;
+        virtual bool start() = 0;
+        virtual bool stop() = 0;
+        virtual bool isOpen() const = 0;
+        // Same time base as the outputTime handed to the render function,
+        // callable from any thread.
+        virtual PaTime time() const = 0;
+        virtual PaTime outputLatency() const { return 0.0; }
+
+        // Frames per render call, 0 lets the sink decide.  Takes effect on
+        // the next open().
+        uint bufferFrames() const { return _bufferFrames; }
+        void setBufferFrames(uint frames) { _bufferFrames = frames; }
+
+        PaError error() const { return _error; }
+        QString errorString() const { return _errorString; }
+    protected:
+        AudioSink() : _bufferFrames(0), _error(paNoError) {}
+        void setError(PaError error, const QString& errorString) { _error = error; _errorString = errorString; }
+    private:
+        uint _bufferFrames;
+        PaError _error;
+        QString _errorString;
+};
+
+class AudioSinkFactory
+{
+    public:
+        typedef AudioSink* (*CreateFunction)();
+        static int registerAudioSink(const QString& name, CreateFunction createFunction);
+        static AudioSink* createAudioSink(const QString& name);
+        static QStringList nameList();
+    private:
+        static QHash<QString, CreateFunction> functionHash;
+};
+
+#endif // AUDIOSINK_H
@@ -0,0 +1,73 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUDIOSINK_NULL_H
+#define AUDIOSINK_NULL_H
+#include <QThread>
+#include "audiosink.h"
+#include "lockfree.h"
+
+class _AudioSink_NullThread;
+
+// Pulls audio on its own thread and throws it away, either as fast as the
+// pipeline delivers or paced to the sample rate when Playback/Sink Realtime
+// is set.  The clock is the number of frames pulled.  Unless paced, the
+// render function is asked to wait for the decoder rather than play
+// silence, so runs are reproducible without a sound device.
+class AudioSink_Null : public AudioSink
+{
+    public:
+        AudioSink_Null();
+        virtual ~AudioSink_Null();
+
+        virtual bool open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+                RenderFunction render, void* userData);
+        virtual void close();
+        virtual bool start();
+        virtual bool stop();
+        virtual bool isOpen() const { return _buffer != NULL; }
+        virtual PaTime time() const { return _clock.load(); }
+
+        qint64 framesPulled() const { return static_cast<qint64>(_clock.load() * _samplerate + 0.5); }
+
+        static AudioSink* createFunction() { return new AudioSink_Null(); }
+    protected:
+        // Called on the pull thread with every rendered buffer.
+        virtual bool consume(const char* /*data*/, unsigned long /*frames*/) { return true; }
+
+        uint channels() const { return _channels; }
+        uint samplerate() const { return _samplerate; }
+        MusicFile::SampleFormat sampleFormat() const { return _format; }
+        uint blockwidth() const { return _channels * ((_format == MusicFile::Float32Format) ? 4 : 2); }
+    private:
+        friend class _AudioSink_NullThread;
+        bool _pull();
+
+        _AudioSink_NullThread* _thread;
+        char* _buffer;
+        unsigned long _framesPerBuffer;
+        uint _channels;
+        uint _samplerate;
+        MusicFile::SampleFormat _format;
+        bool _realtime;
+        RenderFunction _render;
+        void* _userData;
+        qint64 _frames;
+        SeqLockValue<PaTime> _clock;
+        volatile bool _stopRequested;
+};
+
+#endif // AUDIOSINK_NULL_H
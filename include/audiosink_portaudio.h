@@ -0,0 +1,80 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUDIOSINK_PORTAUDIO_H
+#define AUDIOSINK_PORTAUDIO_H
+#include <QThread>
+#include <QStringList>
+#include <portaudio.h>
+#include "audiosink.h"
+
+// Owns one PortAudio output stream.  PortAudio itself is initialized on the
+// first open() and the stream is kept open across stop()/start(), so pausing
+// does not renegotiate the device.  A new stream is only opened when the
+// device or the stream format changes.
+class AudioSink_PortAudio : public AudioSink
+{
+    public:
+        AudioSink_PortAudio();
+        virtual ~AudioSink_PortAudio() { close(); }
+
+        virtual bool open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+                RenderFunction render, void* userData);
+        virtual void close();
+        virtual bool start();
+        virtual bool stop();
+        virtual bool isOpen() const { return _stream != NULL; }
+        virtual PaTime time() const { return (_stream == NULL) ? 0.0 : Pa_GetStreamTime(_stream); }
+        virtual PaTime outputLatency() const;
+
+        static bool acquire(PaError* error = NULL);
+        static void release();
+        static int defaultDevice();
+        static QStringList deviceNames();
+
+        static AudioSink* createFunction() { return new AudioSink_PortAudio(); }
+    private:
+        static int streamCallback(const void* input, void* output, unsigned long frames,
+                const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData);
+        bool _setPaError(PaError error);
+
+        PaStream* _stream;
+        bool _acquired;
+        int _device;
+        uint _channels;
+        uint _samplerate;
+        PaSampleFormat _format;
+        unsigned long _framesPerBuffer;
+        PaTime _latency;
+        RenderFunction _render;
+        void* _userData;
+};
+
+// Enumerates the output devices away from the GUI thread; querying every host
+// API can take a noticeable time on some systems.
+class DeviceEnumerator : public QThread
+{
+    Q_OBJECT
+    public:
+        DeviceEnumerator(QObject* parent = 0) : QThread(parent) {}
+        ~DeviceEnumerator() { wait(); }
+    signals:
+        void devicesEnumerated(const QStringList& devices, int defaultDevice);
+    protected:
+        virtual void run();
+};
+
+#endif // AUDIOSINK_PORTAUDIO_H
@@ -0,0 +1,43 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUDIOSINK_WAV_H
+#define AUDIOSINK_WAV_H
+#include <QFile>
+#include "audiosink_null.h"
+
+// A null sink that records everything it pulls to Playback/Sink File.  The
+// file stays open while the stream format does not change, so consecutive
+// tracks end up in one file just as they would reach the device.
+class AudioSink_Wav : public AudioSink_Null
+{
+    public:
+        AudioSink_Wav() {}
+        virtual ~AudioSink_Wav() { close(); }
+
+        virtual bool open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+                RenderFunction render, void* userData);
+        virtual void close();
+
+        static AudioSink* createFunction() { return new AudioSink_Wav(); }
+    protected:
+        virtual bool consume(const char* data, unsigned long frames);
+    private:
+        void _writeHeader(quint32 dataSize);
+        QFile _file;
+};
+
+#endif // AUDIOSINK_WAV_H
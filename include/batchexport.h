@@ -0,0 +1,105 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BATCHEXPORT_H
+#define BATCHEXPORT_H
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QByteArray>
+#include <QEventLoop>
+#include <QFile>
+#include "musicdata.h"
+
+class Job;
+class QTemporaryFile;
+class QDir;
+
+// The headless mode started by --export: loads one game directory and saves
+// the selected tracks on the JobScheduler, as many at a time as it has
+// workers.  The files go to a directory, or with --output - are written to
+// stdout one after another in track order.
+//
+// An output directory keeps a manifest with a fingerprint of everything each
+// file was made from; tracks whose files are there with the same fingerprint
+// are skipped, and when every track is exported the files no track makes any
+// more are removed.  One directory holds one game.
+class BatchExport : public QObject
+{
+    Q_OBJECT
+
+    public:
+        BatchExport(QObject* parent = NULL);
+        ~BatchExport();
+        // Whether the command line asks for it; checked before QApplication
+        // is created, which then needs no window system.
+        static bool isRequested(int argc, char** argv);
+        // Takes QApplication::arguments(); returns the exit code.
+        int exec(const QStringList& arguments);
+    private slots:
+        void jobFinished(bool success);
+    private:
+        struct Task
+        {
+            MusicData musicData;
+            // what it is called, and where the saver writes it
+            QString name;
+            QString fileName;
+            // every file written, the first is name, with its fingerprint
+            QStringList outputs;
+            QList<QByteArray> fingerprints;
+            QTemporaryFile* temporary;
+            bool done;
+            bool success;
+        };
+
+        bool _parse(QStringList arguments);
+        bool _select(int size);
+        QByteArray _fingerprint(const MusicData& musicData, int format) const;
+        void _sync(const QDir& directory);
+        void _writeManifest(const QDir& directory);
+        void _submitNext();
+        bool _writeFinished();
+
+        QString _title;
+        QString _path;
+        QString _format;
+        QString _output;
+        QString _tracks;
+        uint _loop;
+        int _jobs;
+        bool _loopTags;
+        bool _force;
+
+        QStringList _filters;
+        QStringList _suffixes;
+        // per format, whether the loop count matters
+        QList<bool> _rendersLoops;
+        QHash<QString, QByteArray> _manifest;
+        QFile _stdout;
+        QList<Task> _tasks;
+        QList<int> _selection;
+        QHash<Job*, int> _running;
+        int _next;
+        int _finished;
+        int _written;
+        bool _failed;
+        QEventLoop _eventLoop;
+};
+
+#endif // BATCHEXPORT_H
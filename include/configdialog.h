@@ -27,7 +27,7 @@
 class QDialogButtonBox;
 class QTabWidget;
 class PluginLoader;
-class MusicPlayer;
+class DeviceEnumerator;
 
 class GeneralConfigTab : public QWidget
 {
@@ -54,12 +54,42 @@ class PlaybackConfigTab : public QWidget
     Q_OBJECT
     public:
         PlaybackConfigTab(QWidget *parent = 0);
-        void addDevice(const QString& name) { deviceComboBox->addItem(name); }
-        int device() const { return deviceComboBox->currentIndex(); }
-        void setDevice(int id) { deviceComboBox->setCurrentIndex(id); }
+        int device() const { return deviceComboBox->isEnabled() ? deviceComboBox->currentIndex() : deviceId; }
+        void setDevice(int id) { deviceId = id; if (deviceComboBox->isEnabled()) deviceComboBox->setCurrentIndex(id); }
+        uint sampleRate() const { return sampleRateComboBox->itemData(sampleRateComboBox->currentIndex()).toUInt(); }
+        void setSampleRate(uint rate);
+        int resamplerQuality() const { return qualityComboBox->currentIndex(); }
+        void setResamplerQuality(int quality) { qualityComboBox->setCurrentIndex(quality); }
         bool checkValues();
+    public slots:
+        void setDevices(const QStringList& devices, int defaultDevice);
+    private slots:
+        void sampleRateChanged(int index);
     private:
         QComboBox* deviceComboBox;
+        QComboBox* sampleRateComboBox;
+        QComboBox* qualityComboBox;
+        int deviceId;
+};
+
+class ExportConfigTab : public QWidget
+{
+    Q_OBJECT
+    public:
+        ExportConfigTab(QWidget *parent = 0);
+        bool loopTags() const { return loopTagsCheckBox->isChecked(); }
+        void setLoopTags(bool value) { loopTagsCheckBox->setChecked(value); }
+        int flacCompressionLevel() const { return flacLevelComboBox->currentIndex(); }
+        void setFlacCompressionLevel(int level) { flacLevelComboBox->setCurrentIndex(level); }
+        bool flacVerify() const { return flacVerifyCheckBox->isChecked(); }
+        void setFlacVerify(bool value) { flacVerifyCheckBox->setChecked(value); }
+        bool directIo() const { return directIoCheckBox->isChecked(); }
+        void setDirectIo(bool value) { directIoCheckBox->setChecked(value); }
+    private:
+        QCheckBox* loopTagsCheckBox;
+        QComboBox* flacLevelComboBox;
+        QCheckBox* flacVerifyCheckBox;
+        QCheckBox* directIoCheckBox;
 };
 
 class ConfigDialog : public QDialog
@@ -67,7 +97,7 @@ class ConfigDialog : public QDialog
     Q_OBJECT
 
     public:
-        ConfigDialog(const PluginLoader *const _pluginLoader, const MusicPlayer *const _musicPlayer, QWidget *parent = 0);
+        ConfigDialog(const PluginLoader *const _pluginLoader, QWidget *parent = 0);
         ~ConfigDialog() {}
 
         QSize sizeHint() const {
@@ -83,9 +113,10 @@ class ConfigDialog : public QDialog
         void saveSettings();
 
         const PluginLoader *const pluginLoader;
-        const MusicPlayer *const musicPlayer;
+        DeviceEnumerator* deviceEnumerator;
         GeneralConfigTab* generalConfigTab;
         PlaybackConfigTab* playbackConfigTab;
+        ExportConfigTab* exportConfigTab;
         QTabWidget* tabWidget;
         QDialogButtonBox* buttonBox;
 };
@@ -0,0 +1,66 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DECODETHREAD_H
+#define DECODETHREAD_H
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include <QString>
+
+class ThreadMusicFile;
+
+// The one thread that decodes for every open ThreadMusicFile in the process,
+// whichever player it belongs to.  Each round it serves the file that is
+// closest to running dry, one chunk at a time.  It exists while at least one
+// file is registered.
+class DecodeThread : public QThread
+{
+    Q_OBJECT
+    private:
+        DecodeThread();
+        DecodeThread(const DecodeThread&);
+        DecodeThread& operator=(const DecodeThread&);
+    public:
+        ~DecodeThread();
+
+        static void add(ThreadMusicFile* file);
+        // Returns once the thread is no longer touching file.
+        static void remove(ThreadMusicFile* file);
+        // Called by a file whose buffer drained or that was seeked.
+        static void wake();
+        // The scheduling the thread actually got, see ThreadPolicy; empty
+        // while no thread is running.
+        static QString policy();
+    protected:
+        virtual void run();
+    private:
+        ThreadMusicFile* _next() const;
+
+        static QMutex _instanceMutex;
+        static DecodeThread* _instance;
+
+        QMutex _mutex;
+        QWaitCondition _work;
+        QWaitCondition _idle;
+        QList<ThreadMusicFile*> _files;
+        ThreadMusicFile* _current;
+        bool _stopped;
+        QString _policy;
+};
+
+#endif // DECODETHREAD_H
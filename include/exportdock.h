@@ -0,0 +1,54 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EXPORTDOCK_H
+#define EXPORTDOCK_H
+#include <QDockWidget>
+#include <QHash>
+
+class QTreeWidget;
+class QTreeWidgetItem;
+class QPushButton;
+class Job;
+class MusicSaverJob;
+
+// The exports queued on the JobScheduler, each with its progress, and the
+// buttons that cancel them.  Finished ones stay listed until cleared.
+class ExportDock : public QDockWidget
+{
+    Q_OBJECT
+    public:
+        ExportDock(QWidget* parent = NULL);
+        // Lists job and submits it.
+        void submit(MusicSaverJob* job);
+        int runningCount() const { return _items.size(); }
+    public slots:
+        void cancelSelected();
+        void cancelAll();
+        void clearFinished();
+    private slots:
+        void jobProgress(int percent);
+        void jobFinished(bool success);
+        void updateButtons();
+    private:
+        QTreeWidget* _tree;
+        QPushButton* _cancelButton;
+        QPushButton* _clearButton;
+        // the jobs not finished yet
+        QHash<Job*, QTreeWidgetItem*> _items;
+};
+
+#endif // EXPORTDOCK_H
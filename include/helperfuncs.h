@@ -17,6 +17,7 @@
 #ifndef HELPERFUNCS_H
 #define HELPERFUNCS_H
 #include <QtEndian>
+#include "trace.h"
 
 struct ThbgmData
 {
@@ -108,6 +109,7 @@ class ChecksumBitReader : public BitReader
 
 QByteArray lzDecompress(const QByteArray& compressed, int decompressdSize = 0)
 {
+    TRACE_ZONE("lzDecompress");
     QByteArray decompressd;
     decompressd.reserve(decompressdSize);
     QByteArray dict(0x2000, '\0');
@@ -142,6 +144,7 @@ QByteArray lzDecompress(const QByteArray& compressed, int decompressdSize = 0)
 
 QByteArray lzDecompressChecksum(int& checksum, const QByteArray& compressed, int decompressdSize)
 {
+    TRACE_ZONE("lzDecompressChecksum");
     QByteArray decompressd;
     decompressd.reserve(decompressdSize);
     QByteArray dict(0x2000, '\0');
@@ -179,6 +182,7 @@ QByteArray lzDecompressChecksum(int& checksum, const QByteArray& compressed, int
 
 QByteArray lzDecompressDictSize(const QByteArray& compressed, size_t dictSize, int decompressdSize = 0)
 {
+    TRACE_ZONE("lzDecompressDictSize");
     QByteArray decompressd;
     decompressd.reserve(decompressdSize);
     QByteArray dict(dictSize, '\0');
@@ -212,6 +216,187 @@ QByteArray lzDecompressDictSize(const QByteArray& compressed, size_t dictSize, i
 }
 
 
+// The PBGX/THA1 cipher: the data is processed in blocks of remix_step bytes,
+// XORed with a running mask and stored from the end of the block backwards,
+// interleaved.  Only the first len bytes are encrypted.
+QByteArray remixDecode(const QByteArray& ciphertext, char mask_init, char mask_step, int remix_step, int len)
+{
+    TRACE_ZONE("decrypt");
+    int size = ciphertext.size();
+    QByteArray plaintext(qMin(len, size), '\0');
+    plaintext.append(ciphertext.mid(len, size - len));
+    char mask = mask_init;
+    int read_cursor = 0;
+    int write_cursor = 0;
+    for (int j = size & ~1; j > 0 && len > 0; j -= remix_step, len -= remix_step)
+    {
+        if (j < remix_step)
+            remix_step = j;
+        int write_cursor_copy = write_cursor;
+        write_cursor = write_cursor_copy + remix_step - 1;
+        for (int i = (remix_step >> 1) ; i > 0; --i)
+        {
+            plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
+            ++read_cursor;
+            write_cursor -= 2;
+            mask += mask_step;
+        }
+        write_cursor = write_cursor_copy + remix_step - 2;
+        for (int i = (remix_step >> 1) ; i > 0; --i)
+        {
+            plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
+            ++read_cursor;
+            write_cursor -= 2;
+            mask += mask_step;
+        }
+        write_cursor = write_cursor_copy + remix_step;
+    }
+    return plaintext;
+}
+
+// The THA1 variant used since th12, which also handles odd block sizes.
+QByteArray remixDecodeV2(const QByteArray& ciphertext, char mask_init, char mask_step, int remix_step, int len)
+{
+    TRACE_ZONE("decrypt");
+    int size = ciphertext.size();
+    QByteArray plaintext(qMin(len, size) & ~1, '\0');
+    char mask = mask_init;
+    int read_cursor = 0;
+    int write_cursor = 0;
+    for (int j = plaintext.size(); j > 0; j -= remix_step)
+    {
+        if (remix_step > j)
+            remix_step = j;
+        int write_cursor_copy = write_cursor + remix_step;
+        write_cursor = write_cursor_copy - 1;
+        for (int i = ((remix_step + 1) >> 1) ; i > 0; --i)
+        {
+            plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
+            mask += mask_step;
+            ++read_cursor;
+            write_cursor -= 2;
+        }
+        write_cursor = write_cursor_copy - 2;
+        for (int i = (remix_step >> 1) ; i > 0; --i)
+        {
+            plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
+            mask += mask_step;
+            ++read_cursor;
+            write_cursor -= 2;
+        }
+        write_cursor = write_cursor_copy;
+    }
+    plaintext.append(ciphertext.mid(plaintext.size()));
+    return plaintext;
+}
+
+// Mersenne Twister state used by the Tasofro archive headers.
+void mtMaskInit(int mask[0x270], int s)
+{
+    mask[0] = s + 6;
+
+    for (int i = 1; i < 0x270; ++i)
+    {
+        uint m = mask[i - 1];
+        m >>= 0x1E;
+        m ^= mask[i-1];
+        m *= 0x6C078965;
+        m += i;
+        mask[i] = m;
+    }
+}
+
+void mtMaskUpdate(int mask[0x270])
+{
+    for (int i = 0; i < 0xE3; ++i)
+    {
+        uint m = mask[i + 1];
+        m ^= mask[i];
+        m &= 0x7FFFFFFF;
+        m ^= mask[i];
+        int p = m;
+        m >>= 1;
+        p &= 1;
+        m ^= ((p) ? 0x9908B0DF : 0);
+        m ^= mask[0x18C+i+1];
+        mask[i] = m;
+    }
+
+    for (int i = 0xE3; i < 0x26F; i++)
+    {
+        uint m = mask[i];
+        m ^= mask[i+1];
+        m &= 0x7FFFFFFF;
+        m ^= mask[i];
+        int p = m;
+        p &= 1;
+        p = ((p) ? 0x9908B0DF : 0);
+        p ^= mask[i-0xE3];
+        m >>= 1;
+        p ^= m;
+        mask[i] = p;
+    }
+
+    int p = mask[0x26F];
+    uint m = mask[0];
+    m ^= p;
+    m &= 0x7FFFFFFF;
+    m ^= p;
+    p = m;
+    m >>= 1;
+    p &= 1;
+    m ^= ((p) ? 0x9908B0DF : 0);
+    m ^= mask[0x18C];
+    mask[0x26F] = m;
+}
+
+char mtMaskGet(int mask[0x270], int n)
+{
+    int m = mask[n % 0x270];
+    uint p = m;
+    p >>= 0xB;
+    m ^= p;
+    uint s = m;
+    s &= 0xFF3A58AD;
+    s <<= 7;
+    m ^= s;
+    p = m;
+    p &= 0xFFFFDF8C;
+    p <<= 0xF;
+    m ^= p;
+    s = m;
+    s >>= 0x12;
+    s ^= m;
+
+    return s;
+}
+
+// Decrypts a Tasofro archive header in place.
+void mtHeaderDecrypt(char* data, int size)
+{
+    TRACE_ZONE("header decrypt");
+    int mask[0x270];
+    mtMaskInit(mask, size);
+
+    unsigned char c1 = 0xC5, c2 = 0x83;
+
+    for (int i = 0; i < size; i++)
+    {
+        if (i % 0x270 == 0) mtMaskUpdate(mask);
+        data[i] ^= mtMaskGet(mask, i);
+        data[i] ^= c1;
+        c1 += c2;
+        c2 += 0x53;
+    }
+}
+
+// ArchiveMusicData::decoder for Tasofro archives; userData holds the key.
+char xorDecoder(void* p, char c)
+{
+    return c ^ static_cast<char>(reinterpret_cast<quintptr>(p));
+}
+
+
     enum
     {
         HAVE_RIFF  = 0x01,
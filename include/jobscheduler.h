@@ -0,0 +1,111 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+
+class _JobWorker;
+
+// A unit of background work.  Subclasses implement run(), which is called on
+// a worker thread and should poll setProgress() or isCanceled() often enough
+// that cancel() takes effect quickly.  The signals arrive queued in the
+// thread that created the job, or in the application thread for jobs created
+// by another job; the scheduler deletes the job afterwards.
+class Job : public QObject
+{
+    Q_OBJECT
+    public:
+        // Lower values are served first; add levels as features need them,
+        // every one is scanned on each take.
+        enum Priority
+        {
+            ExportPriority,
+            PriorityCount,
+        };
+
+        Job(Priority priority, QObject* parent = NULL);
+        virtual ~Job() {}
+
+        Priority priority() const { return _priority; }
+        bool isCanceled() const { return static_cast<int>(_canceled) != 0; }
+        int progress() const { return _progress; }
+        QString errorString() const { return _errorString; }
+    public slots:
+        void cancel() { _canceled.fetchAndStoreRelease(1); }
+    signals:
+        // percent, 0 to 100
+        void progressChanged(int percent);
+        void finished(bool success);
+    protected:
+        virtual bool run() = 0;
+        // Returns false once the job is canceled.
+        bool setProgress(qint64 done, qint64 total);
+        void setErrorString(const QString& errorString) { _errorString = errorString; }
+    private:
+        friend class JobScheduler;
+        void _execute();
+
+        Priority _priority;
+        QAtomicInt _canceled;
+        QAtomicInt _progress;
+        QString _errorString;
+};
+
+// The process wide pool every background feature runs its jobs on.  Each
+// worker keeps its own queue per priority and, when that runs dry, steals
+// from the others, highest priority first.  Workers run below normal priority
+// and leave one core free, so they never compete with the decode thread.
+class JobScheduler
+{
+    private:
+        JobScheduler();
+        JobScheduler(const JobScheduler&);
+        JobScheduler& operator=(const JobScheduler&);
+    public:
+        ~JobScheduler();
+
+        // Takes ownership of job.
+        static void submit(Job* job);
+        // Cancels every job and waits for the workers; call before exit.
+        static void shutdown();
+        static int workerCount();
+        // How many workers the pool starts with; 0, the default, keeps one
+        // core free.  Takes effect the next time the pool starts.
+        static void setWorkerCount(int count);
+    private:
+        friend class _JobWorker;
+        Job* _take(int worker);
+        void _work(int worker);
+
+        static QMutex _instanceMutex;
+        static JobScheduler* _instance;
+        static int _workerCount;
+
+        QList<_JobWorker*> _workers;
+        QMutex _mutex;
+        QWaitCondition _wake;
+        int _pending;
+        int _nextWorker;
+        bool _stopped;
+};
+
+#endif // JOBSCHEDULER_H
@@ -0,0 +1,98 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+#include <QAtomicInt>
+
+// Bounded single producer, single consumer queue.  Neither side ever blocks,
+// so it is safe to use from the PortAudio callback.
+template <typename T, int Capacity>
+class LockFreeQueue
+{
+    private:
+        LockFreeQueue(const LockFreeQueue&);
+        LockFreeQueue& operator=(const LockFreeQueue&);
+    public:
+        LockFreeQueue() : _head(0), _tail(0) {}
+
+        // producer side
+        bool push(const T& value)
+        {
+            int tail = _tail;
+            int next = (tail + 1) % (Capacity + 1);
+            if (next == _head.fetchAndAddAcquire(0))
+                return false;
+            _items[tail] = value;
+            _tail.fetchAndStoreRelease(next);
+            return true;
+        }
+
+        // consumer side
+        bool pop(T& value)
+        {
+            int head = _head;
+            if (head == _tail.fetchAndAddAcquire(0))
+                return false;
+            value = _items[head];
+            _head.fetchAndStoreRelease((head + 1) % (Capacity + 1));
+            return true;
+        }
+
+        bool isEmpty() const { return static_cast<int>(_head) == static_cast<int>(_tail); }
+    private:
+        QAtomicInt _head;
+        QAtomicInt _tail;
+        T _items[Capacity + 1];
+};
+
+// A value with a single writer that any thread may read without locking.
+// Qt has no 64-bit atomics, so positions and clocks are published through a
+// sequence counter instead; readers retry while a write is in progress.
+template <typename T>
+class SeqLockValue
+{
+    private:
+        SeqLockValue(const SeqLockValue&);
+        SeqLockValue& operator=(const SeqLockValue&);
+    public:
+        SeqLockValue(const T& value = T()) : _sequence(0), _value(value) {}
+
+        void store(const T& value)
+        {
+            _sequence.fetchAndAddOrdered(1);
+            _value = value;
+            _sequence.fetchAndAddOrdered(1);
+        }
+
+        T load() const
+        {
+            forever
+            {
+                int sequence = _sequence.fetchAndAddAcquire(0);
+                if (sequence & 1)
+                    continue;
+                T value = _value;
+                if (_sequence.testAndSetOrdered(sequence, sequence))
+                    return value;
+            }
+        }
+    private:
+        mutable QAtomicInt _sequence;
+        T _value;
+};
+
+#endif // LOCKFREE_H
@@ -16,8 +16,45 @@
  */
 #ifndef LOOPMUSICFILE_H
 #define LOOPMUSICFILE_H
+#include <QSharedData>
+#include <QMutex>
+#include <QByteArray>
 #include "musicfile.h"
 
+class QTemporaryFile;
+
+// The loop body of a track, decoded once and shared by the LoopMusicFiles of
+// an export, so every repetition after the first is a copy.  Bodies too big
+// to keep in memory go to a mapped temporary file.  Long ones are decoded in
+// segments on the JobScheduler, each by a MusicFile of its own.
+class LoopCache : public QSharedData
+{
+    private:
+        LoopCache(const LoopCache&);
+        LoopCache& operator=(const LoopCache&);
+
+    public:
+        // With wholeTrack the intro is kept too, and the LoopMusicFiles that
+        // share the cache decode nothing after the first has opened.
+        explicit LoopCache(bool wholeTrack = false);
+        ~LoopCache();
+        bool isWholeTrack() const { return _wholeTrack; }
+
+    private:
+        friend class LoopMusicFile;
+        // Decodes samples from begin on the first call, with musicFile and
+        // more opened from musicData; later calls share it.
+        bool _fill(const MusicData& musicData, MusicFile* musicFile, qint64 begin, qint64 samples);
+
+        const bool _wholeTrack;
+        QMutex _mutex;
+        QByteArray _memory;
+        QTemporaryFile* _spill;
+        const char* _data;
+        uint _blockwidth;
+        QString _errorString;
+};
+
 class LoopMusicFile: public QObject
 {
     Q_OBJECT
@@ -32,6 +69,12 @@ class LoopMusicFile: public QObject
 
         bool open(MusicFile::OpenMode mode);
         QString errorString() const { return _errorString; }
+        // Overrides Playback/Fadeout Time; call before open().
+        void setFadeoutTime(uint msec) { _fadeoutTime = msec; }
+        // Repeats the loop from cache instead of decoding it again; open()
+        // fills the cache if nothing has yet.  Call before open().
+        void setLoopCache(LoopCache* cache) { _loopCache = cache; }
+        LoopCache* loopCache() const { return _loopCache.data(); }
 
         qint64 samplePos() const { return _samples; };
         qint64 sampleSize() const { return _totalSamples; };
@@ -43,6 +86,11 @@ class LoopMusicFile: public QObject
         uint samplerate() const { Q_ASSERT(_musicFile != NULL); return _musicFile->samplerate(); }
         uint bytewidth() const { Q_ASSERT(_musicFile != NULL); return _musicFile->bytewidth(); }
         uint blockwidth() const { Q_ASSERT(_musicFile != NULL); return _musicFile->blockwidth(); }
+        MusicFile::SampleFormat sampleFormat() const { Q_ASSERT(_musicFile != NULL); return _musicFile->sampleFormat(); }
+        void setSampleFormat(MusicFile::SampleFormat format) { Q_ASSERT(_musicFile != NULL); _musicFile->setSampleFormat(format); }
+        qint64 bytesRead() const { Q_ASSERT(_musicFile != NULL); return _musicFile->bytesRead(); }
+        qint64 loopBegin() const { Q_ASSERT(_musicFile != NULL); return _musicFile->loopBegin(); }
+        qint64 loopEnd() const { Q_ASSERT(_musicFile != NULL); return _musicFile->loopEnd(); }
         uint loop() const { return _loop; }
         uint totalLoop() const { return _totalLoop; }
 
@@ -50,6 +98,7 @@ class LoopMusicFile: public QObject
         void setErrorString(QString newErrorString) { _errorString = newErrorString; }
 
     private:
+        qint64 _cachedRead(char* buffer, qint64 needSample);
         uint _samplesToLoop(qint64& samples);
         void _setLoop(uint newLoop);
         void _setSamplesAndLoop(qint64 newSamples);
@@ -59,7 +108,9 @@ class LoopMusicFile: public QObject
         uint _totalLoop;
         uint _fadeoutTime;
         qint64 _fadeoutSamples;
+        MusicData _musicData;
         MusicFile* _musicFile;
+        QExplicitlySharedDataPointer<LoopCache> _loopCache;
         QString _errorString;
 };
 
@@ -32,6 +32,9 @@ class QLabel;
 class PluginLoader;
 class PlaylistModel;
 class SpinBoxDelegate;
+class StatsDock;
+class ExportDock;
+class TelemetryWriter;
 
 class MainWindow : public QMainWindow
 {
@@ -45,6 +48,9 @@ class MainWindow : public QMainWindow
 
     protected:
         void closeEvent(QCloseEvent *event);
+        void changeEvent(QEvent *event);
+        void showEvent(QShowEvent *event);
+        void hideEvent(QHideEvent *event);
 
     private slots:
         void loadFile();
@@ -73,6 +79,7 @@ class MainWindow : public QMainWindow
         void _loadSettingLoadOnStartup();
         void _loadSettingPluginLoaderPath();
         void _loadSettingPlaylist();
+        void _updateTickInterval();
 
         QSlider *seekSlider;
         QSlider *volumeSlider;
@@ -84,6 +91,9 @@ class MainWindow : public QMainWindow
         MusicPlayer *musicPlayer;
         PlaylistModel *playlistModel;
         SpinBoxDelegate *spinBoxDelegate;
+        StatsDock *statsDock;
+        ExportDock *exportDock;
+        TelemetryWriter *telemetryWriter;
         QString loadingTitle;
 
         QAction *playAction;
@@ -40,6 +40,14 @@ struct ArchiveMusicData : public QSharedData
     {
         Q_ASSERT(dataBegin_ <= dataEnd_);
     }
+    // Undoes the archive's encoding of size bytes read from it, in place.
+    void decode(char* data, qint64 size) const
+    {
+        if (decoder == NULL)
+            return;
+        for (qint64 i = 0; i < size; ++i)
+            data[i] = decoder(userData, data[i]);
+    }
     QString archiveFileName;
     qint64 dataBegin;
     qint64 dataEnd;
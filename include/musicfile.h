@@ -35,6 +35,11 @@ class MusicFile : public QIODevice
 /* outer layer */
     public:
         typedef QIODevice::OpenMode OpenMode;
+        enum SampleFormat
+        {
+            Int16Format,
+            Float32Format,
+        };
 
         virtual ~MusicFile() {}
 
@@ -66,7 +71,11 @@ class MusicFile : public QIODevice
         uint samplerate() const { return _samplerate; }
         uint bytewidth() const { return _bytewidth; }
         uint blockwidth() const { return _blockwidth; }
-
+        // The format open() decodes into; set it before opening the file.
+        SampleFormat sampleFormat() const { return _sampleFormat; }
+        void setSampleFormat(SampleFormat format) { Q_ASSERT(!isOpen()); _sampleFormat = format; }
+        // Bytes taken from the underlying file so far, for statistics.
+        qint64 bytesRead() const { return _bytesRead; }
 
 /* middle layer */
     protected:
@@ -79,6 +88,7 @@ class MusicFile : public QIODevice
         uint _samplerate;
         uint _bytewidth;
         uint _blockwidth;
+        SampleFormat _sampleFormat;
 
         bool _loop;
         qint64 _loopBegin;
@@ -86,6 +96,7 @@ class MusicFile : public QIODevice
         QString _title;
         QString _album;
         QExplicitlySharedDataPointer<ArchiveMusicData> _archiveMusicData;
+        qint64 _bytesRead;
 
 
 /* inner layer */
@@ -16,6 +16,7 @@
  */
 #ifndef MUSICFILE_WAV_H
 #define MUSICFILE_WAV_H
+#include <QByteArray>
 #include "musicfile.h"
 
 class MusicFile_Wav : public MusicFile
@@ -39,6 +40,7 @@ class MusicFile_Wav : public MusicFile
             _LittleEndian,
             _BigEndian,
         };
+        typedef void (*ConvertFunction)(const char* in, char* out, qint64 samples, uint channels);
 
     protected:
         virtual qint64 readData(char * data, qint64 maxSize);
@@ -49,10 +51,18 @@ class MusicFile_Wav : public MusicFile
         bool _getFieldFromFile(U &data);
         void _removeLeadingZeros();
         void _initializeAsRawData();
+        ConvertFunction _converter() const;
         _Endian _endian;
         uint _format;
+        uint _bitwidth;
         uint _bytespersec;
         uint _blockalign;
+        // width of the samples in the file, _bytewidth is what readData()
+        // hands out
+        uint _sourceBytewidth;
+        uint _sourceBlockwidth;
+        ConvertFunction _convert;
+        QByteArray _sourceBuffer;
 
         qint64 _dataBegin;
         qint64 _dataSize;
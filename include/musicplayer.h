@@ -62,15 +62,14 @@ class MusicPlayer: public QObject
         MusicPlayerErrorType errorType() const;
         QString errorString() const;
         qreal volume() const;
-        qint64 samples() const { if (_file == NULL) return 0; return _file->samplePos(); }
+        qint64 samples() const;
+        uint samplerate() const { if (_file == NULL) return 44100; return _file->samplerate(); }
         qint64 totalSamples() const { if (_file == NULL) return 0; return _file->sampleSize(); }
         uint loop() const { if (_file == NULL) return 0; return _file->loop(); }
         uint totalLoop() const { if (_file == NULL) return 0; return _file->totalLoop(); }
         uint remainLoop() const { return totalLoop() - loop(); }
-
-        int deviceCount() const;
-        int defaultDevice() const;
-        QString device(int id) const;
+        uint tickInterval() const { return _tickInterval; }
+        void setTickInterval(uint msec);
     signals:
         void tick(qint64 samples);
         void stateChanged(MusicPlayerState newstate, MusicPlayerState oldstate);
@@ -86,6 +85,7 @@ class MusicPlayer: public QObject
         void stop();
         void seek(qint64 samples);
         void setVolume(qreal newVolume);
+        void fadeTo(qreal newVolume, int msec);
     private slots:
         void _next();
         void _tick();
@@ -93,8 +93,11 @@ class MusicPlayer: public QObject
     private:
         void _load();
         void _unload();
+        void _collectRetired();
+        void _scheduleTick();
         void _setState(MusicPlayerState newState);
 
+        _MusicPlayerImpl* _impl;
         QList<QueuedMusic> _queue;
         ThreadMusicFile* _file;
         MusicPlayerState _state;
@@ -19,22 +19,74 @@
 #include <QString>
 #include <QStringList>
 #include <QHash>
+#include <QSharedData>
 #include "musicdata.h"
+#include "jobscheduler.h"
 
 class MusicSaverFactory;
+class LoopMusicFile;
+class LoopCache;
 
 class MusicSaver
 {
     public:
+        // Called as the file is written; returning false aborts the save.
+        typedef bool (*ProgressFunction)(qint64 done, qint64 total, void* userData);
+
         virtual bool save(const QString& filename, MusicData musicData, uint loop) = 0;
         virtual QString suffix() = 0;
-        virtual ~MusicSaver() {}
+        // False for savers that copy the track as stored, for which the loop
+        // count, the fade and loop tags make no difference.
+        virtual bool rendersLoops() const { return true; }
+        virtual ~MusicSaver();
         QString errorString() const { return _errorString; }
+        void setProgressFunction(ProgressFunction progress, void* userData) { _progress = progress; _progressData = userData; }
+        // With loop tags the intro and one loop are written once, without
+        // the fade, and the loop points are tagged for the player to repeat;
+        // the loop count passed to save() is ignored.  Defaults to
+        // Export/Loop Tags.
+        bool loopTags() const { return _loopTags; }
+        void setLoopTags(bool loopTags) { _loopTags = loopTags; }
+        // Renders from cache, a whole track cache shared with other savers,
+        // instead of decoding; see MusicSaver_Tee.
+        void setLoopCache(LoopCache* cache);
+        // "01.Title.wav", without what file systems refuse.
+        static QString trackFileName(const MusicData& musicData, const QString& suffix);
     protected:
         MusicSaver();
         void setErrorString(QString newErrorString) { _errorString = newErrorString; }
+        // Savers call this once per buffer and stop when it returns false.
+        bool reportProgress(qint64 done, qint64 total);
+        // What LoopMusicFile should render for loop, and sets it up for that:
+        // no fade with loop tags, the cache set with setLoopCache(), or else
+        // the loop decoded once into a new cache when it repeats.  Call
+        // before open().
+        uint renderLoops(uint loop) const { return _loopTags ? 1 : loop; }
+        void prepare(LoopMusicFile& musicFile) const;
     private:
         QString _errorString;
+        ProgressFunction _progress;
+        void* _progressData;
+        bool _loopTags;
+        QExplicitlySharedDataPointer<LoopCache> _loopCache;
+};
+
+// Runs a save on the JobScheduler at export priority.
+class MusicSaverJob : public Job
+{
+    public:
+        // Takes ownership of saver.
+        MusicSaverJob(MusicSaver* saver, const QString& filename, const MusicData& musicData, uint loop, QObject* parent = NULL);
+        ~MusicSaverJob();
+        QString fileName() const { return _fileName; }
+    protected:
+        virtual bool run();
+    private:
+        static bool _progress(qint64 done, qint64 total, void* userData);
+        MusicSaver* _saver;
+        QString _fileName;
+        MusicData _musicData;
+        uint _loop;
 };
 
 class MusicSaverFactory
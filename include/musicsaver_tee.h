@@ -0,0 +1,43 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MUSICSAVER_TEE_H
+#define MUSICSAVER_TEE_H
+#include <QList>
+#include "musicsaver.h"
+
+// Saves one track with several savers at once, each to the file name with
+// its own suffix.  The track is decoded a single time into a LoopCache that
+// all of them render from, and the savers run in parallel on the
+// JobScheduler and on the saving thread.  Each keeps its own settings.
+class MusicSaver_Tee : public MusicSaver
+{
+    public:
+        // Takes ownership of savers, of which there must be at least one.
+        MusicSaver_Tee(const QList<MusicSaver*>& savers);
+        ~MusicSaver_Tee();
+        // Replaces suffix() at the end of filename with the suffix of each
+        // saver.
+        virtual bool save(const QString& filename, MusicData musicData, uint loop);
+        virtual QString suffix() { return _savers.first()->suffix(); }
+        static QString filterString() { return QObject::tr("WAV and FLAC, decoded once (*.wav *.flac)"); }
+        static MusicSaver* createFunction();
+    private:
+        static bool _partProgress(qint64 done, qint64 total, void* userData);
+        QList<MusicSaver*> _savers;
+};
+
+#endif // MUSICSAVER_TEE_H
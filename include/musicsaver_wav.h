@@ -18,13 +18,28 @@
 #define MUSICSAVER_WAV_H
 #include "musicsaver.h"
 
+// Writes RF64 instead of RIFF when the data does not fit in 4 GB.
 class MusicSaver_Wav : public MusicSaver
 {
     public:
+        MusicSaver_Wav() : _wave64(false) {}
         virtual bool save(const QString& filename, MusicData musicData, uint loop);
         virtual QString suffix() { return ".wav"; }
         static QString filterString() { return QObject::tr("Uncompressed PCM (*.wav)"); }
         static MusicSaver* createFunction() { return new MusicSaver_Wav(); }
+    protected:
+        MusicSaver_Wav(bool wave64) : _wave64(wave64) {}
+    private:
+        bool _wave64;
+};
+
+class MusicSaver_W64 : public MusicSaver_Wav
+{
+    public:
+        MusicSaver_W64() : MusicSaver_Wav(true) {}
+        virtual QString suffix() { return ".w64"; }
+        static QString filterString() { return QObject::tr("Sony Wave64 (*.w64)"); }
+        static MusicSaver* createFunction() { return new MusicSaver_W64(); }
 };
 
 #endif // MUSICSAVER_WAV_H
@@ -0,0 +1,75 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+#include <QtGlobal>
+
+// Polyphase windowed sinc resampler for interleaved float frames.  The ratio
+// is kept as the exact fraction outputRate / inputRate, so output frame n is
+// always input time n * inputRate / outputRate and positions can be mapped
+// back and forth without drift.  All memory is allocated up front; process()
+// never allocates and takes no locks.
+class Resampler
+{
+    private:
+        Resampler(const Resampler&);
+        Resampler& operator=(const Resampler&);
+    public:
+        enum Quality
+        {
+            FastQuality,
+            MediumQuality,
+            BestQuality,
+        };
+
+        Resampler(uint channels, uint inputRate, uint outputRate, Quality quality, qint64 maxInputFrames);
+        ~Resampler();
+
+        uint channels() const { return _channels; }
+        uint inputRate() const { return _inputRate; }
+        uint outputRate() const { return _outputRate; }
+
+        qint64 toOutputFrames(qint64 inputFrames) const { return (inputFrames * _up + _down - 1) / _down; }
+        qint64 toInputFrames(qint64 outputFrames) const { return outputFrames * _down / _up; }
+        // Upper bound of what one process() call may produce.
+        qint64 maxOutputFrames(qint64 inputFrames) const { return (inputFrames + _taps) * _up / _down + 1; }
+
+        // Restarts at output frame pos with an empty history and returns the
+        // input frame the caller has to feed from.
+        qint64 seek(qint64 pos);
+        // Consumes all of input, which must not be longer than the
+        // maxInputFrames given to the constructor.
+        qint64 process(const float* input, qint64 inputFrames, float* output);
+    private:
+        const float* _filter(uint phase) const;
+
+        uint _channels;
+        uint _inputRate;
+        uint _outputRate;
+        uint _up;
+        uint _down;
+        int _taps;
+        uint _phases;
+        float* _filters;
+        qint64 _capacity;
+        float** _history;
+        qint64 _read;
+        qint64 _fill;
+        uint _phase;
+};
+
+#endif // RESAMPLER_H
@@ -0,0 +1,158 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SAMPLEOPS_H
+#define SAMPLEOPS_H
+#include <QtGlobal>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAMPLEOPS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Sample kernels shared by the playback and export paths.  Counts are in
+// samples (frames * channels) unless the name says otherwise.
+namespace SampleOps
+{
+    inline void int16ToFloat(const qint16* in, float* out, qint64 count)
+    {
+        const float scale = 1.0f / 32768.0f;
+        qint64 i = 0;
+#ifdef SAMPLEOPS_SSE2
+        const __m128 vscale = _mm_set1_ps(scale);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = in[i] * scale;
+    }
+
+    inline void floatToInt16(const float* in, qint16* out, qint64 count)
+    {
+        qint64 i = 0;
+#ifdef SAMPLEOPS_SSE2
+        // cvtps rounds to nearest and packs saturates, which is the clipping.
+        const __m128 vscale = _mm_set1_ps(32768.0f);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), vscale));
+            __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), vscale));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            float v = in[i] * 32768.0f;
+            out[i] = (v >= 32767.0f) ? 32767 : (v <= -32768.0f) ? -32768 : static_cast<qint16>(v + ((v < 0.0f) ? -0.5f : 0.5f));
+        }
+    }
+
+    inline void int16ToInt32(const qint16* in, qint32* out, qint64 count)
+    {
+        qint64 i = 0;
+#ifdef SAMPLEOPS_SSE2
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = in[i];
+    }
+
+    inline void applyGain(float* data, qint64 count, float gain)
+    {
+        qint64 i = 0;
+#ifdef SAMPLEOPS_SSE2
+        const __m128 vgain = _mm_set1_ps(gain);
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), vgain));
+#endif
+        for (; i < count; ++i)
+            data[i] *= gain;
+    }
+
+    inline void applyGain(qint16* data, qint64 count, float gain)
+    {
+        for (qint64 i = 0; i < count; ++i)
+            data[i] *= gain;
+    }
+
+    inline float dotProduct(const float* a, const float* b, int count)
+    {
+        int i = 0;
+        float result = 0.0f;
+#ifdef SAMPLEOPS_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        float partial[4];
+        _mm_storeu_ps(partial, sum);
+        result = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif
+        for (; i < count; ++i)
+            result += a[i] * b[i];
+        return result;
+    }
+
+    // Moves gain towards target by step per frame, then holds it.  Returns
+    // the gain reached at the end of the buffer.
+    template <typename T>
+    inline qreal applyGainRamp(T* data, qint64 frames, uint channels, qreal gain, qreal target, qreal step)
+    {
+        qint64 i = 0;
+        for (; i < frames && gain != target; ++i)
+        {
+            for (uint j = 0; j < channels; ++j)
+                data[i * channels + j] *= gain;
+            if (gain < target)
+                gain = (gain <= target - step) ? gain + step : target;
+            else
+                gain = (gain >= target + step) ? gain - step : target;
+        }
+        if (i < frames && gain != 1.0)
+            applyGain(data + i * channels, (frames - i) * channels, static_cast<float>(gain));
+        return gain;
+    }
+
+    // Scales frames by factor(i) = f(remain / length), counting remain down
+    // from first; used for fade in and fade out.
+    template <typename T>
+    inline void applyFade(T* data, qint64 frames, uint channels, qint64 remain, qint64 length, bool fadeIn, bool squareRoot)
+    {
+        for (qint64 i = 0; i < frames; ++i, --remain)
+        {
+            qreal factor = static_cast<qreal>(remain) / length;
+            if (fadeIn)
+                factor = 1.0 - factor;
+            if (squareRoot)
+                factor = std::sqrt(factor);
+            for (uint j = 0; j < channels; ++j)
+                data[i * channels + j] *= factor;
+        }
+    }
+}
+
+#endif // SAMPLEOPS_H
@@ -0,0 +1,55 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STATSDOCK_H
+#define STATSDOCK_H
+#include <QDockWidget>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+class QTreeWidget;
+class QTreeWidgetItem;
+class QTimer;
+class Histogram;
+
+// Shows Telemetry while it is visible.
+class StatsDock : public QDockWidget
+{
+    Q_OBJECT
+    public:
+        StatsDock(QWidget* parent = NULL);
+    protected:
+        void showEvent(QShowEvent* event);
+        void hideEvent(QHideEvent* event);
+    private slots:
+        void refresh();
+    private:
+        // name and value of every row in a group, in order
+        typedef QList<QPair<QString, QString> > Values;
+
+        QTreeWidgetItem* _addGroup(const QString& name);
+        QString _histogram(const Histogram& histogram) const;
+        void _update(QTreeWidgetItem* group, const Values& values);
+
+        QTreeWidget* _tree;
+        QTimer* _timer;
+        QTreeWidgetItem* _output;
+        QTreeWidgetItem* _decode;
+        QTreeWidgetItem* _tracks;
+};
+
+#endif // STATSDOCK_H
@@ -0,0 +1,127 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <QObject>
+#include <QAtomicInt>
+#include <QString>
+#include <QHash>
+#include <QMutex>
+
+class QFile;
+class QTimer;
+
+// Counts values into power of two buckets: bucket 0 holds 0, bucket i holds
+// [2^(i-1), 2^i).  Adding never blocks, so the stream callback may use it.
+class Histogram
+{
+    private:
+        Histogram(const Histogram&);
+        Histogram& operator=(const Histogram&);
+    public:
+        enum { BucketCount = 32 };
+
+        Histogram();
+
+        void add(qint64 value);
+        void reset();
+
+        int count() const { return _count; }
+        int maximum() const { return _maximum; }
+        // Upper bound of the bucket holding the given fraction of values.
+        qint64 percentile(qreal fraction) const;
+        // {"count":..,"p50":..,"p99":..,"max":..}
+        QString toJson() const;
+    private:
+        QAtomicInt _buckets[BucketCount];
+        QAtomicInt _count;
+        QAtomicInt _maximum;
+};
+
+// Process wide playback statistics.  Times are in microseconds.  The
+// members written from the stream callback are atomics; per format and per
+// track figures come from the decode thread and sit behind a mutex.
+class Telemetry
+{
+    private:
+        Telemetry();
+    public:
+        struct DecodeStats
+        {
+            qint64 frames;
+            qint64 audioTime;   // frames / samplerate, in microseconds
+            qint64 decodeTime;  // wall time spent decoding
+            DecodeStats() : frames(0), audioTime(0), decodeTime(0) {}
+            qreal realtimeFactor() const { return (decodeTime > 0) ? static_cast<qreal>(audioTime) / decodeTime : 0.0; }
+        };
+
+        // Monotonic clock, unaffected by changes to the wall clock.
+        static qint64 now();
+
+        static void recordCallback(qint64 duration, qint64 interval, qint64 expectedInterval);
+        static void recordUnderrun() { _underruns.ref(); }
+        // Lookahead fill, 0 to 1000.
+        static void recordRingFill(int permille);
+        static void recordLoopSeek(qint64 duration) { _loopSeek.add(duration); }
+        static void recordDecode(const QString& format, qint64 frames, uint samplerate, qint64 duration);
+        static void recordTrackBytes(const QString& track, qint64 bytes);
+
+        static int callbacks() { return _callbacks; }
+        static int underruns() { return _underruns; }
+        static int ringFill() { return _ringFill; }
+        // Lowest fill since the last call.
+        static int takeRingFillLow();
+        static const Histogram& callbackDuration() { return _callbackDuration; }
+        static const Histogram& callbackJitter() { return _callbackJitter; }
+        static const Histogram& loopSeek() { return _loopSeek; }
+        static QHash<QString, DecodeStats> decodeStats();
+        static QHash<QString, qint64> trackBytes();
+
+        // Everything above as one line of JSON.
+        static QString toJson();
+    private:
+        static QAtomicInt _callbacks;
+        static QAtomicInt _underruns;
+        static QAtomicInt _ringFill;
+        static QAtomicInt _ringFillLow;
+        static Histogram _callbackDuration;
+        static Histogram _callbackJitter;
+        static Histogram _loopSeek;
+        static QMutex _mutex;
+        static QHash<QString, DecodeStats> _decodeStats;
+        static QHash<QString, qint64> _trackBytes;
+};
+
+// Appends Telemetry::toJson() to General/Statistics File every
+// General/Statistics Interval milliseconds; "-" writes to stderr and an
+// interval of 0 turns it off.
+class TelemetryWriter : public QObject
+{
+    Q_OBJECT
+    public:
+        TelemetryWriter(QObject* parent = NULL);
+        ~TelemetryWriter();
+    public slots:
+        void reloadSettings();
+    private slots:
+        void write();
+    private:
+        QTimer* _timer;
+        QFile* _file;
+};
+
+#endif // TELEMETRY_H
@@ -17,12 +17,27 @@
 #ifndef THREADMUSICFILE_H
 #define THREADMUSICFILE_H
 #include <QWaitCondition>
-#include <QMutexLocker>
-#include <QThread>
-#include <QQueue>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QObject>
 #include "loopmusicfile.h"
+#include "lockfree.h"
+#include "resampler.h"
 
-class ThreadMusicFile : public QThread
+// Decodes a LoopMusicFile ahead of the playback position on the shared
+// DecodeThread.
+// The decoded audio is kept in a ring that also holds some history behind
+// the playback position, so seeking anywhere inside that window is served
+// from memory.  Seeks outside it are handed to the decoder thread; reads
+// return silence until it catches up and then fade back in.
+//
+// The decoder fills the ring and the reader empties it without a lock:
+// sampleRead() and sampleSeek() are meant for the stream callback and must
+// be called from one thread only.
+//
+// With an output sample rate configured, the decoder thread also resamples
+// every track to that rate, and all positions are in output frames.
+class ThreadMusicFile : public QObject
 {
     Q_OBJECT
     private:
@@ -36,32 +51,69 @@ class ThreadMusicFile : public QThread
         void close();
         QString errorString() const { Q_ASSERT(_musicFile != NULL); return _musicFile->errorString(); }
 
-        qint64 samplePos() const { return _samplePos; }
-        qint64 sampleSize() const { Q_ASSERT(_musicFile != NULL); return _musicFile->sampleSize(); }
+        qint64 samplePos() const { return _samplePos.load(); }
+        qint64 sampleSize() const;
         bool sampleSeek(qint64 pos);
         qint64 sampleRead(char* buffer, qint64 maxSample);
+        bool waitForData(qint64 samples, ulong msec);
 
         uint channels() const { Q_ASSERT(_musicFile != NULL); return _musicFile->channels(); }
-        uint samplerate() const { Q_ASSERT(_musicFile != NULL); return _musicFile->samplerate(); }
+        uint samplerate() const;
         uint bytewidth() const { Q_ASSERT(_musicFile != NULL); return _musicFile->bytewidth(); }
         uint blockwidth() const { Q_ASSERT(_musicFile != NULL); return _musicFile->blockwidth(); }
+        MusicFile::SampleFormat sampleFormat() const { Q_ASSERT(_musicFile != NULL); return _musicFile->sampleFormat(); }
         uint loop() const { Q_ASSERT(_musicFile != NULL); return _musicFile->loop(); }
         uint totalLoop() const { Q_ASSERT(_musicFile != NULL); return _musicFile->totalLoop(); }
 
-        int bufferSize() const { QMutexLocker locker(&_bufferMutex); return _buffer.size(); }
-    protected:
-        virtual void run();
+        int bufferSize() const { return qMax<qint64>(0, _window.load().end - _samplePos.load()) * blockwidth(); }
     private:
-        bool _fillBuffer();
+        friend class DecodeThread;
+        // [begin, end) is what the ring holds for a generation, and end is
+        // where the decoder is.
+        struct _Window
+        {
+            _Window() : begin(0), end(0), generation(0), ended(false) {}
+            qint64 begin;
+            qint64 end;
+            int generation;
+            // the decoder reached the end of the track, or failed
+            bool ended;
+        };
+        qreal _decodeUrgency() const;
+        void _decodeStep();
+        void _restart(qint64 pos);
+        void _copyToRing(const char* data, qint64 pos, qint64 samples);
+        void _copyFromRing(char* data, qint64 pos, qint64 samples) const;
+        void _fadeIn(char* data, qint64 samples);
+        void _lockBuffers();
+        void _unlockBuffers();
         LoopMusicFile* _musicFile;
-        QQueue<char> _buffer;
+        // names for the statistics
+        QString _format;
+        QString _title;
+        Resampler* _resampler;
         char *_fileBuffer;
-        qint64 _bufferSampleSize;
-        mutable QMutex _bufferMutex;
-        QWaitCondition _bufferNotFull;
-        qint64 _samplePos;
-        qint64 _buuferSamplePos;
-        volatile bool _stoped;
+        char *_resampleBuffer;
+        char *_ring;
+        qint64 _ringSampleSize;
+        qint64 _lookaheadSampleSize;
+        qint64 _fadeSampleSize;
+        // only for waitForData(), signaled whenever the window changes
+        QMutex _bufferMutex;
+        QWaitCondition _bufferNotEmpty;
+        // written by the decode thread, read from anywhere
+        SeqLockValue<_Window> _window;
+        // A seek the ring cannot serve stores the target and moves the
+        // generation; the decode thread then starts a new window there.
+        // Both are written by the reader only, as are the two below.
+        SeqLockValue<qint64> _seekTarget;
+        QAtomicInt _generation;
+        qint64 _fadeRemain;
+        SeqLockValue<qint64> _samplePos;
+        // only touched by the decode thread
+        int _decodedGeneration;
+        bool _opened;
+        bool _memoryLocked;
 };
 
 #endif // THREADMUSICFILE_H
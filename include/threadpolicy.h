@@ -0,0 +1,59 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef THREADPOLICY_H
+#define THREADPOLICY_H
+#include <QThread>
+#include <QString>
+
+// Scheduling for the threads that keep audio flowing, read from the
+// "Playback" settings group under a role name:
+//   "<role> Priority"    QThread::Priority, default HighestPriority
+//   "<role> Scheduling"  "Normal", "RoundRobin" or "Fifo", default Normal
+//   "<role> CPU"         CPU to pin the thread to, -1 for any
+// Real time scheduling usually needs privileges; when it is refused the
+// thread keeps the plain priority and obtained() says so.
+class ThreadPolicy
+{
+    public:
+        enum Scheduling
+        {
+            NormalScheduling,
+            RoundRobinScheduling,
+            FifoScheduling,
+        };
+
+        ThreadPolicy(const QString& role);
+
+        // Applies the policy to the calling thread, which must be thread.
+        void apply(QThread* thread);
+        // What apply() actually got, e.g. "Fifo 10, CPU 1".
+        QString obtained() const { return _obtained; }
+
+        // "Lock Memory" in the same group; keeps decoded audio from being
+        // paged out under memory pressure.
+        static bool memoryLockingEnabled();
+        static bool lockMemory(const void* address, size_t size);
+        static void unlockMemory(const void* address, size_t size);
+    private:
+        QString _role;
+        QThread::Priority _priority;
+        Scheduling _scheduling;
+        int _cpu;
+        QString _obtained;
+};
+
+#endif // THREADPOLICY_H
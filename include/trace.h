@@ -0,0 +1,92 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+#include <QtGlobal>
+
+// Trace zones for profiling, written as Chrome trace events that
+// chrome://tracing and Perfetto can open.  Build with "qmake CONFIG+=trace"
+// to define TOUHOU_TRACE; otherwise TRACE_ZONE expands to nothing.
+//
+//     void f()
+//     {
+//         TRACE_ZONE("f");
+//         ...
+//     }
+//
+// The name must be a string literal.  The application installs the sink at
+// startup; the loader plugins find it through the application object, so
+// the zones in helperfuncs.h and the plugins need no setup of their own.
+#ifdef TOUHOU_TRACE
+#include <QCoreApplication>
+#include <QVariant>
+#include <QAtomicPointer>
+
+class TraceSink
+{
+    public:
+        virtual ~TraceSink() {}
+        virtual qint64 now() = 0;
+        virtual void complete(const char* name, qint64 begin, qint64 duration) = 0;
+
+        static TraceSink* instance()
+        {
+            // Every plugin has its own copy of this function, so the sink is
+            // handed around as a property of the application object.  The
+            // property is the address of a pointer that outlives the sink
+            // and is cleared when it goes away, so caching it is safe.
+            static QAtomicPointer<TraceSink>* sink = NULL;
+            if (sink == NULL && QCoreApplication::instance() != NULL)
+                sink = reinterpret_cast<QAtomicPointer<TraceSink>*>(QCoreApplication::instance()->property("traceSink").value<qulonglong>());
+            return (sink != NULL) ? static_cast<TraceSink*>(*sink) : NULL;
+        }
+};
+
+class TraceZone
+{
+    private:
+        TraceZone(const TraceZone&);
+        TraceZone& operator=(const TraceZone&);
+    public:
+        TraceZone(const char* name) :
+            _name(name),
+            _begin(-1)
+        {
+            TraceSink* sink = TraceSink::instance();
+            if (sink != NULL)
+                _begin = sink->now();
+        }
+        ~TraceZone()
+        {
+            // Looked up again, the sink may be gone by now.
+            TraceSink* sink = TraceSink::instance();
+            if (sink != NULL && _begin >= 0)
+                sink->complete(_name, _begin, sink->now() - _begin);
+        }
+    private:
+        const char* _name;
+        qint64 _begin;
+};
+
+#define TRACE_ZONE_CONCAT2(a, b) a##b
+#define TRACE_ZONE_CONCAT(a, b) TRACE_ZONE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_ZONE_CONCAT(_traceZone, __LINE__)(name)
+#else
+#define TRACE_ZONE(name) ((void)0)
+#endif
+
+#endif // TRACE_H
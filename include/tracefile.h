@@ -0,0 +1,110 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+#include "trace.h"
+#ifdef TOUHOU_TRACE
+#include <QFile>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QThreadStorage>
+#include <QByteArray>
+#include "lockfree.h"
+
+// Collects the zones of the whole process into one Chrome trace file,
+// $TOUHOU_TRACE_FILE or touhou-musicplayer.trace.json.
+//
+// complete() never locks or touches the file: every thread has its own
+// queue, and a writer thread drains them into the file.  Zones that find
+// their queue full, or more than MaxThreads threads alive, are dropped and
+// counted.
+class TraceFile : public TraceSink
+{
+    private:
+        TraceFile(const TraceFile&);
+        TraceFile& operator=(const TraceFile&);
+    public:
+        TraceFile();
+        ~TraceFile();
+
+        // Makes this the sink TRACE_ZONE reports to.
+        void install();
+
+        virtual qint64 now();
+        virtual void complete(const char* name, qint64 begin, qint64 duration);
+    private:
+        enum
+        {
+            MaxThreads = 32,
+            QueueSize = 4096,
+        };
+        struct Event
+        {
+            const char* name;
+            qint64 begin;
+            qint64 duration;
+        };
+        // A thread claims a free slot on its first zone and retires it when
+        // it ends; the writer frees the slot once the queue is drained.
+        struct Slot
+        {
+            Slot() : used(0), retired(0), tid(0) {}
+            QAtomicInt used;
+            QAtomicInt retired;
+            // set by the owner before its first event
+            int tid;
+            LockFreeQueue<Event, QueueSize> events;
+        };
+        // owned by QThreadStorage, deleted as the thread ends
+        struct Holder
+        {
+            Holder(Slot* slot_) : slot(slot_) {}
+            ~Holder() { slot->retired.fetchAndStoreRelease(1); }
+            Slot* slot;
+        };
+        class Writer : public QThread
+        {
+            public:
+                Writer(TraceFile* traceFile) : _traceFile(traceFile) {}
+            protected:
+                virtual void run();
+            private:
+                TraceFile* _traceFile;
+        };
+        friend class Writer;
+
+        void _drain();
+
+        Slot _slots[MaxThreads];
+        QThreadStorage<Holder*> _holders;
+        QAtomicInt _nextTid;
+        QAtomicInt _dropped;
+        Writer _writer;
+        QMutex _stopMutex;
+        QWaitCondition _stopCondition;
+        bool _stop;
+        // only touched by the writer, and by the destructor once it stopped
+        QFile _file;
+        QByteArray _buffer;
+        bool _first;
+};
+
+#endif // TOUHOU_TRACE
+#endif // TRACEFILE_H
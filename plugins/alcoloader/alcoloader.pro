@@ -20,6 +20,11 @@ DESTDIR       = ..
 
 HEADERS      += ../../include/loaderinterface.h \
                 ../../include/helperfuncs.h \
+                ../../include/trace.h \
                 ../../include/musicdata.h \
                 alcoloader.h
 SOURCES      += alcoloader.cpp
+
+trace {
+    DEFINES += TOUHOU_TRACE
+}
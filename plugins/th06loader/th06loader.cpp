@@ -183,6 +183,7 @@ uint Th06Loader::size() const
 
 bool Th06Loader::open(const QString &path)
 {
+    TRACE_ZONE("Th06Loader::open");
     programDirectory = QDir(path);
     if (!checkAllFileExists(programDirectory))
         return false;
@@ -95,6 +95,7 @@ uint Th075Loader::size() const
 
 bool Th075Loader::open(const QString &path)
 {
+    TRACE_ZONE("Th075Loader::open");
     dir = QDir(path);
     if (!dir.exists(FileName))
         return false;
@@ -194,6 +194,7 @@ uint Th07Loader::size() const
 
 bool Th07Loader::open(const QString &path)
 {
+    TRACE_ZONE("Th07Loader::open");
     programDirectory = QDir(path);
 
     if (!checkAllFileExists(programDirectory))
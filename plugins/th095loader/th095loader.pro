@@ -20,6 +20,11 @@ DESTDIR       = ..
 
 HEADERS      += ../../include/loaderinterface.h \
                 ../../include/helperfuncs.h \
+                ../../include/trace.h \
                 ../../include/musicdata.h \
                 th095loader.h
 SOURCES      += th095loader.cpp
+
+trace {
+    DEFINES += TOUHOU_TRACE
+}
@@ -59,39 +59,6 @@ namespace {
         quint32 headerDictsize;
     };
 
-    QByteArray decode(const QByteArray& ciphertext, char mask_init, char mask_step, int remix_step, int len)
-    {
-        int size = ciphertext.size();
-        QByteArray plaintext(qMin(len, size), '\0');
-        plaintext.append(ciphertext.mid(len, size - len));
-        char mask = mask_init;
-        int read_cursor = 0;
-        int write_cursor = 0;
-        for (int j = size & ~1; j > 0 && len > 0; j -= remix_step, len -= remix_step)
-        {
-            if (j < remix_step)
-                remix_step = j;
-            int write_cursor_copy = write_cursor;
-            write_cursor = write_cursor_copy + remix_step - 1;
-            for (int i = (remix_step >> 1) ; i > 0; --i)
-            {
-                plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
-                ++read_cursor;
-                write_cursor -= 2;
-                mask += mask_step;
-            }
-            write_cursor = write_cursor_copy + remix_step - 2;
-            for (int i = (remix_step >> 1) ; i > 0; --i)
-            {
-                plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
-                ++read_cursor;
-                write_cursor -= 2;
-                mask += mask_step;
-            }
-            write_cursor = write_cursor_copy + remix_step;
-        }
-        return plaintext;
-    }
 }
 
 const QString& Th09Loader::title() const
@@ -106,6 +73,7 @@ uint Th09Loader::size() const
 
 bool Th09Loader::open(const QString &path)
 {
+    TRACE_ZONE("Th09Loader::open");
     dir = QDir(path);
     if (!dir.exists(FileName) || !dir.exists(BgmName))
         return false;
@@ -128,7 +96,7 @@ bool Th09Loader::open(const QString &path)
     }
 // Stage 1
     {
-        QByteArray preHeaderData = decode(file.read(12), 0x1b, 0x37, 0xc, 0x400);
+        QByteArray preHeaderData = remixDecode(file.read(12), 0x1b, 0x37, 0xc, 0x400);
         PGBXPreHeader* preHeader = reinterpret_cast<PGBXPreHeader*>(preHeaderData.data());
         max_file_count = qFromLittleEndian(preHeader->maxFileCount) - 123456;
         header_pos = qFromLittleEndian(preHeader->headerPos) - 345678;
@@ -142,7 +110,7 @@ bool Th09Loader::open(const QString &path)
     {
 // Stage 2
         file.seek(header_pos);
-        QByteArray header = lzDecompressDictSize(decode(file.read(header_csize), 0x3e, 0x9b, 0x80, 0x400), header_dictsize);
+        QByteArray header = lzDecompressDictSize(remixDecode(file.read(header_csize), 0x3e, 0x9b, 0x80, 0x400), header_dictsize);
         char* cursor = header.data();
         uint thbgm_offset;
         uint thbgm_dsize;
@@ -174,29 +142,30 @@ bool Th09Loader::open(const QString &path)
         switch (thbgm_magic.data()[3])
         {
             case 'M':
-                thbgm_data = decode(thbgm_cdata, 0x0, 0x0, 0x0, 0x0);
+                thbgm_data = remixDecode(thbgm_cdata, 0x0, 0x0, 0x0, 0x0);
                 break;
             case 'T':
-                thbgm_data = decode(thbgm_cdata, 0x51, 0xe9, 0x40, 0x3000);
+                thbgm_data = remixDecode(thbgm_cdata, 0x51, 0xe9, 0x40, 0x3000);
                 break;
             case 'A':
-                thbgm_data = decode(thbgm_cdata, 0xc1, 0x51, 0x1400, 0x2000);
+                thbgm_data = remixDecode(thbgm_cdata, 0xc1, 0x51, 0x1400, 0x2000);
                 break;
             case 'J':
-                thbgm_data = decode(thbgm_cdata, 0x03, 0x19, 0x1400, 0x7800);
+                thbgm_data = remixDecode(thbgm_cdata, 0x03, 0x19, 0x1400, 0x7800);
                 break;
             case 'E':
-                thbgm_data = decode(thbgm_cdata, 0x0, 0x0, 0x0, 0x0);
+                thbgm_data = remixDecode(thbgm_cdata, 0x0, 0x0, 0x0, 0x0);
                 break;
             case 'W':
-                thbgm_data = decode(thbgm_cdata, 0x12, 0x34, 0x400, 0x2800);
+                thbgm_data = remixDecode(thbgm_cdata, 0x12, 0x34, 0x400, 0x2800);
                 break;
             case '-':
-                thbgm_data = decode(thbgm_cdata, 0x35, 0x97, 0x80, 0x2800);
+                thbgm_data = remixDecode(thbgm_cdata, 0x35, 0x97, 0x80, 0x2800);
         }
     }
 // Stage3
     {
+        TRACE_ZONE("header walk");
         QList<FileInfo> info_list;
         ThbgmData* thbgmData = reinterpret_cast<ThbgmData*>(thbgm_data.data());
         for (uint i = 0; i < SongDataSize; ++i)
@@ -20,6 +20,11 @@ DESTDIR       = ..
 
 HEADERS      += ../../include/loaderinterface.h \
                 ../../include/helperfuncs.h \
+                ../../include/trace.h \
                 ../../include/musicdata.h \
                 th09loader.h
 SOURCES      += th09loader.cpp
+
+trace {
+    DEFINES += TOUHOU_TRACE
+}
@@ -70,39 +70,6 @@ namespace {
         {0x99, 0x37, 0x400, 0x2000},
     };
 
-    QByteArray decode(const QByteArray& ciphertext, char mask_init, int, char mask_step, int remix_step, int len)
-    {
-        int size = ciphertext.size();
-        QByteArray plaintext(qMin(len, size), '\0');
-        plaintext.append(ciphertext.mid(len, size - len));
-        char mask = mask_init;
-        int read_cursor = 0;
-        int write_cursor = 0;
-        for (int j = size & ~1; j > 0 && len > 0; j -= remix_step, len -= remix_step)
-        {
-            if (j < remix_step)
-                remix_step = j;
-            int write_cursor_copy = write_cursor + remix_step;
-            write_cursor = write_cursor_copy - 1;
-            for (int i = (remix_step >> 1) ; i > 0; --i)
-            {
-                plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
-                ++read_cursor;
-                write_cursor -= 2;
-                mask += mask_step;
-            }
-            write_cursor = write_cursor_copy - 2;
-            for (int i = (remix_step >> 1) ; i > 0; --i)
-            {
-                plaintext[write_cursor] = ciphertext[read_cursor] ^ mask;
-                ++read_cursor;
-                write_cursor -= 2;
-                mask += mask_step;
-            }
-            write_cursor = write_cursor_copy;
-        }
-        return plaintext;
-    }
 }
 
 const QString& Th11Loader::title() const
@@ -117,6 +84,7 @@ uint Th11Loader::size() const
 
 bool Th11Loader::open(const QString &path)
 {
+    TRACE_ZONE("Th11Loader::open");
     dir = QDir(path);
     if (!dir.exists(FileName) || !dir.exists(BgmName))
         return false;
@@ -132,7 +100,7 @@ bool Th11Loader::open(const QString &path)
     uint header_pos;
 // Stage 1
     {
-        QByteArray preHeaderData = decode(file.read(0x10), 0x1b, 0x10, 0x37, 0x10, 0x10);
+        QByteArray preHeaderData = remixDecode(file.read(0x10), 0x1b, 0x37, 0x10, 0x10);
         THA1PreHeader* preHeader = reinterpret_cast<THA1PreHeader*>(preHeaderData.data());
         if (qFromLittleEndian(preHeader->magicNumber) != 0x31414854) // THA1
             return false;
@@ -148,7 +116,7 @@ bool Th11Loader::open(const QString &path)
 // Stage 2
         header_pos = file.size() - header_csize;
         file.seek(header_pos);
-        QByteArray header = lzDecompress(decode(file.read(header_csize), 0x3e, header_csize, 0x9b, 0x80, header_csize));
+        QByteArray header = lzDecompress(remixDecode(file.read(header_csize), 0x3e, 0x9b, 0x80, header_csize));
         char* cursor = header.data();
         uint thbgm_key;
         uint thbgm_offset;
@@ -185,12 +153,13 @@ bool Th11Loader::open(const QString &path)
         }
         file.seek(thbgm_offset);
         thbgm_data = file.read(thbgm_csize);
-        thbgm_data = decode(thbgm_data, KeyData[thbgm_key][0], thbgm_csize, KeyData[thbgm_key][1], KeyData[thbgm_key][2], KeyData[thbgm_key][3]);
+        thbgm_data = remixDecode(thbgm_data, KeyData[thbgm_key][0], KeyData[thbgm_key][1], KeyData[thbgm_key][2], KeyData[thbgm_key][3]);
         if (thbgm_csize != thbgm_dsize)
             thbgm_data = lzDecompress(thbgm_data, thbgm_dsize);
     }
 // Stage3
     {
+        TRACE_ZONE("header walk");
         QList<FileInfo> info_list;
         ThbgmData* thbgmData = reinterpret_cast<ThbgmData*>(thbgm_data.data());
         for (uint i = 0; i < SongDataSize; ++i)
@@ -62,86 +62,6 @@ namespace {
         quint8 len;
     };
 
-    void maskInit(int mask[0x270], int s)
-    {
-        mask[0] = s + 6;
-
-        for (int i = 1; i < 0x270; ++i)
-        {
-            uint m = mask[i - 1];
-            m >>= 0x1E;
-            m ^= mask[i-1];
-            m *= 0x6C078965;
-            m += i;
-            mask[i] = m;
-        }
-    }
-
-    void maskUpdate(int mask[0x270])
-    {
-        for (int i = 0; i < 0xE3; ++i)
-        {
-            uint m = mask[i + 1];
-            m ^= mask[i];
-            m &= 0x7FFFFFFF;
-            m ^= mask[i];
-            int p = m;
-            m >>= 1;
-            p &= 1;
-            m ^= ((p) ? 0x9908B0DF : 0);
-            m ^= mask[0x18C+i+1];
-            mask[i] = m;
-        }
-
-        for (int i = 0xE3; i < 0x26F; i++)
-        {
-            uint m = mask[i];
-            m ^= mask[i+1];
-            m &= 0x7FFFFFFF;
-            m ^= mask[i];
-            int p = m;
-            p &= 1;
-            p = ((p) ? 0x9908B0DF : 0);
-            p ^= mask[i-0xE3];
-            m >>= 1;
-            p ^= m;
-            mask[i] = p;
-        }
-
-        int p = mask[0x26F];
-        uint m = mask[0];
-        m ^= p;
-        m &= 0x7FFFFFFF;
-        m ^= p;
-        p = m;
-        m >>= 1;
-        p &= 1;
-        m ^= ((p) ? 0x9908B0DF : 0);
-        m ^= mask[0x18C];
-        mask[0x26F] = m;
-    }
-
-    char maskGet(int mask[0x270], int n)
-    {
-        int m = mask[n % 0x270];
-        uint p = m;
-        p >>= 0xB;
-        m ^= p;
-        uint s = m;
-        s &= 0xFF3A58AD;
-        s <<= 7;
-        m ^= s;
-        p = m;
-        p &= 0xFFFFDF8C;
-        p <<= 0xF;
-        m ^= p;
-        s = m;
-        s >>= 0x12;
-        s ^= m;
-
-        return s;
-    }
-
     void decode(char* data, const FileInfo &info)
     {
         char mask = (info.offset >> 1) | 0x23;
@@ -150,10 +70,6 @@ namespace {
             data[i] ^= mask;
     }
 
-    char decoder(void*p, char c)
-    {
-        return c ^ static_cast<char>(reinterpret_cast<quintptr>(p));
-    }
 }
 
 const QString& Th123Loader::title() const
@@ -168,6 +84,7 @@ uint Th123Loader::size() const
 
 bool Th123Loader::open(const QString &path)
 {
+    TRACE_ZONE("Th123Loader::open");
     dir = QDir(path);
     if (!dir.exists(FileName))
         return false;
@@ -197,21 +114,7 @@ bool Th123Loader::open(const QString &path)
             return false;
 
         // read header
-        {
-            int mask[0x270];
-            maskInit(mask, header_size);
-
-            unsigned char c1 = 0xC5, c2 = 0x83;
-
-            for (int i = 0; i < header_size; i++)
-            {
-                if (i % 0x270 == 0) maskUpdate(mask);
-                header.data()[i] ^= maskGet(mask, i);
-                header.data()[i] ^= c1;
-                c1 += c2;
-                c2 += 0x53;
-            }
-        }
+        mtHeaderDecrypt(header.data(), header_size);
 
         // parse header
         char* cursor = header.data();
@@ -271,7 +174,7 @@ MusicData Th123Loader::at(uint index)
     Q_ASSERT(index < SongDataSize);
     FileInfo info = info_list[index];
     ArchiveMusicData archiveMusicData(dir.absoluteFilePath(FileName), info.offset, info.offset + info.size,
-        decoder, decoder, reinterpret_cast<void*>(static_cast<quintptr>(((info.offset >> 1) & 0xff) | 0x23)));
+        xorDecoder, xorDecoder, reinterpret_cast<void*>(static_cast<quintptr>(((info.offset >> 1) & 0xff) | 0x23)));
 
     return MusicData(
         SongData[index][0] + ".ogg",
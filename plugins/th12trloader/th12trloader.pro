@@ -20,6 +20,11 @@ DESTDIR       = ..
 
 HEADERS      += ../../include/loaderinterface.h \
                 ../../include/helperfuncs.h \
+                ../../include/trace.h \
                 ../../include/musicdata.h \
                 th12trloader.h
 SOURCES      += th12trloader.cpp
+
+trace {
+    DEFINES += TOUHOU_TRACE
+}
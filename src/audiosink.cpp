@@ -0,0 +1,38 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "audiosink.h"
+
+QHash<QString, AudioSinkFactory::CreateFunction> AudioSinkFactory::functionHash;
+
+int AudioSinkFactory::registerAudioSink(const QString& name, CreateFunction createFunction)
+{
+    functionHash.insert(name, createFunction);
+    return functionHash.size();
+}
+
+AudioSink* AudioSinkFactory::createAudioSink(const QString& name)
+{
+    if (!functionHash.contains(name))
+        return NULL;
+    return functionHash.value(name)();
+}
+
+QStringList AudioSinkFactory::nameList()
+{
+    QStringList nameList(functionHash.keys());
+    return nameList;
+}
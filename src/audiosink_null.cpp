@@ -0,0 +1,147 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QSettings>
+#include <QTime>
+#include <QtDebug>
+#include "audiosink_null.h"
+#include "threadpolicy.h"
+
+class _AudioSink_NullThread : public QThread
+{
+    public:
+        _AudioSink_NullThread(AudioSink_Null* sink_) : sink(sink_) {}
+    protected:
+        virtual void run()
+        {
+            // Stands in for the device callback thread, so it gets the
+            // same treatment a driver would give that.
+            ThreadPolicy policy("Sink");
+            policy.apply(this);
+            QTime wall;
+            wall.start();
+            const qint64 startFrames = sink->_frames;
+            while (!sink->_stopRequested && sink->_pull())
+            {
+                if (!sink->_realtime)
+                {
+                    // The render function waited for the decoder already.
+                    continue;
+                }
+                // Stay one buffer ahead of the simulated device.
+                qint64 due = (sink->_frames - startFrames - static_cast<qint64>(sink->_framesPerBuffer)) * 1000 / sink->_samplerate;
+                qint64 ahead = due - wall.elapsed();
+                if (ahead > 0)
+                    msleep(ahead);
+            }
+        }
+    private:
+        AudioSink_Null* sink;
+};
+
+AudioSink_Null::AudioSink_Null() :
+    _thread(new _AudioSink_NullThread(this)),
+    _buffer(NULL),
+    _framesPerBuffer(0),
+    _channels(0),
+    _samplerate(0),
+    _format(MusicFile::Int16Format),
+    _realtime(false),
+    _render(NULL),
+    _userData(NULL),
+    _frames(0),
+    _clock(0.0),
+    _stopRequested(false)
+{
+}
+
+AudioSink_Null::~AudioSink_Null()
+{
+    close();
+    delete _thread;
+}
+
+bool AudioSink_Null::open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+        RenderFunction render, void* userData)
+{
+    //qDebug() << Q_FUNC_INFO;
+    stop();
+    {
+        QSettings settings;
+        settings.beginGroup("Playback");
+        _realtime = settings.value("Sink Realtime", false).toBool();
+        settings.endGroup();
+    }
+    const unsigned long framesPerBuffer = (bufferFrames() == 0) ? 512 : bufferFrames();
+    if (_buffer == NULL || _channels != channels || _format != format || _framesPerBuffer != framesPerBuffer)
+    {
+        delete [] _buffer;
+        _channels = channels;
+        _format = format;
+        _framesPerBuffer = framesPerBuffer;
+        _buffer = new char[_framesPerBuffer * blockwidth()];
+    }
+    if (_samplerate != samplerate)
+    {
+        // keep the clock continuous across a rate change
+        _frames = static_cast<qint64>(_clock.load() * samplerate + 0.5);
+        _samplerate = samplerate;
+    }
+    _render = render;
+    _userData = userData;
+    return true;
+}
+
+void AudioSink_Null::close()
+{
+    //qDebug() << Q_FUNC_INFO;
+    stop();
+    delete [] _buffer;
+    _buffer = NULL;
+}
+
+bool AudioSink_Null::start()
+{
+    //qDebug() << Q_FUNC_INFO;
+    Q_ASSERT(_buffer != NULL);
+    // A run that ended on its own has to be collected before restarting.
+    _thread->wait();
+    _stopRequested = false;
+    _thread->start();
+    return true;
+}
+
+bool AudioSink_Null::stop()
+{
+    //qDebug() << Q_FUNC_INFO;
+    _stopRequested = true;
+    _thread->wait();
+    return true;
+}
+
+bool AudioSink_Null::_pull()
+{
+    const PaTime outputTime = static_cast<PaTime>(_frames) / _samplerate;
+    // Only what was rendered is played, not the silence after the end.
+    const unsigned long frames = qMin(_render(_buffer, _framesPerBuffer, outputTime, _realtime, _userData), _framesPerBuffer);
+    if (frames == 0)
+        return false;
+    if (!consume(_buffer, frames))
+        return false;
+    _frames += frames;
+    _clock.store(static_cast<PaTime>(_frames) / _samplerate);
+    return true;
+}
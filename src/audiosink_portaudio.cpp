@@ -0,0 +1,262 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QtDebug>
+#include "audiosink_portaudio.h"
+
+namespace {
+    // PortAudio host calls are not thread safe, and the device list may be
+    // queried from DeviceEnumerator while the GUI thread opens a stream.
+    QMutex portaudioMutex;
+    int portaudioUsers = 0;
+}
+
+bool AudioSink_PortAudio::acquire(PaError* error)
+{
+    QMutexLocker locker(&portaudioMutex);
+    if (portaudioUsers == 0)
+    {
+        //qDebug() << Q_FUNC_INFO << "Pa_Initialize";
+        PaError err = Pa_Initialize();
+        if (err != paNoError)
+        {
+            if (error)
+                *error = err;
+            return false;
+        }
+    }
+    ++portaudioUsers;
+    return true;
+}
+
+void AudioSink_PortAudio::release()
+{
+    QMutexLocker locker(&portaudioMutex);
+    Q_ASSERT(portaudioUsers > 0);
+    if (--portaudioUsers == 0)
+    {
+        //qDebug() << Q_FUNC_INFO << "Pa_Terminate";
+        Pa_Terminate();
+    }
+}
+
+int AudioSink_PortAudio::defaultDevice()
+{
+    if (!acquire())
+        return paNoDevice;
+    int result;
+    {
+        QMutexLocker locker(&portaudioMutex);
+        result = Pa_GetDefaultOutputDevice();
+    }
+    release();
+    return result;
+}
+
+QStringList AudioSink_PortAudio::deviceNames()
+{
+    QStringList result;
+    if (!acquire())
+        return result;
+    {
+        QMutexLocker locker(&portaudioMutex);
+        int count = Pa_GetDeviceCount();
+        for (int id = 0; id < count; ++id)
+        {
+            const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(id);
+            const PaHostApiInfo* apiInfo = Pa_GetHostApiInfo(deviceInfo->hostApi);
+            result << QString("%1 (%2)").arg(QString::fromLocal8Bit(deviceInfo->name)).arg(QString::fromLocal8Bit(apiInfo->name));
+        }
+    }
+    release();
+    return result;
+}
+
+AudioSink_PortAudio::AudioSink_PortAudio() :
+    _stream(NULL),
+    _acquired(false),
+    _device(paNoDevice),
+    _channels(0),
+    _samplerate(0),
+    _format(0),
+    _framesPerBuffer(paFramesPerBufferUnspecified),
+    _latency(0.0),
+    _render(NULL),
+    _userData(NULL)
+{
+}
+
+bool AudioSink_PortAudio::_setPaError(PaError error)
+{
+    setError(error, QString::fromLocal8Bit(Pa_GetErrorText(error)));
+    return false;
+}
+
+int AudioSink_PortAudio::streamCallback(const void* /*input*/, void* output, unsigned long frames,
+        const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags /*statusFlags*/, void* userData)
+{
+    AudioSink_PortAudio* sink = static_cast<AudioSink_PortAudio*>(userData);
+    // Some host APIs do not report a DAC time; estimate it from the
+    // stream latency instead.
+    PaTime dacTime = timeInfo->outputBufferDacTime;
+    if (dacTime == 0.0)
+        dacTime = timeInfo->currentTime + sink->_latency;
+    return (sink->_render(output, frames, dacTime, true, sink->_userData) > 0) ? paContinue : paComplete;
+}
+
+bool AudioSink_PortAudio::open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+        RenderFunction render, void* userData)
+{
+    //qDebug() << Q_FUNC_INFO;
+    int device;
+    {
+        QSettings settings;
+        settings.beginGroup("Playback");
+        device = settings.value("Output Device", -1).toInt();
+        settings.endGroup();
+    }
+    const PaSampleFormat paFormat = (format == MusicFile::Float32Format) ? paFloat32 : paInt16;
+    const unsigned long framesPerBuffer = (bufferFrames() == 0) ? paFramesPerBufferUnspecified : bufferFrames();
+    if (!_acquired)
+    {
+        PaError err;
+        if (!acquire(&err))
+            return _setPaError(err);
+        _acquired = true;
+    }
+    QMutexLocker locker(&portaudioMutex);
+    if (device < 0 || device >= Pa_GetDeviceCount())
+        device = Pa_GetDefaultOutputDevice();
+    if (device == paNoDevice)
+        return _setPaError(paDeviceUnavailable);
+    if (_stream != NULL)
+    {
+        if (_device == device && _channels == channels && _samplerate == samplerate &&
+            _format == paFormat && _framesPerBuffer == framesPerBuffer)
+        {
+            // Same stream parameters, just make sure it is idle.
+            if (Pa_IsStreamStopped(_stream) == 0)
+                Pa_AbortStream(_stream);
+            _render = render;
+            _userData = userData;
+            return true;
+        }
+        Pa_CloseStream(_stream);
+        _stream = NULL;
+    }
+
+    PaStreamParameters outputparam;
+    outputparam.device = device;
+    outputparam.channelCount = channels;
+    outputparam.sampleFormat = paFormat;
+    outputparam.suggestedLatency = Pa_GetDeviceInfo(device)->defaultHighOutputLatency;
+    outputparam.hostApiSpecificStreamInfo = NULL;
+    PaError err = Pa_OpenStream(
+            &_stream,
+            NULL,
+            &outputparam,
+            samplerate,
+            framesPerBuffer,
+            paNoFlag,
+            streamCallback,
+            this);
+    if (err != paNoError)
+    {
+        _stream = NULL;
+        return _setPaError(err);
+    }
+    _device = device;
+    _channels = channels;
+    _samplerate = samplerate;
+    _format = paFormat;
+    _framesPerBuffer = framesPerBuffer;
+    _render = render;
+    _userData = userData;
+    return true;
+}
+
+void AudioSink_PortAudio::close()
+{
+    //qDebug() << Q_FUNC_INFO;
+    if (_stream != NULL)
+    {
+        QMutexLocker locker(&portaudioMutex);
+        Pa_CloseStream(_stream);
+        _stream = NULL;
+    }
+    if (_acquired)
+    {
+        release();
+        _acquired = false;
+    }
+}
+
+bool AudioSink_PortAudio::start()
+{
+    //qDebug() << Q_FUNC_INFO;
+    Q_ASSERT(_stream != NULL);
+    _latency = outputLatency();
+    QMutexLocker locker(&portaudioMutex);
+    // A stream whose callback returned paComplete is inactive but not
+    // stopped yet, and refuses to start again until it is.
+    if (Pa_IsStreamStopped(_stream) == 0)
+        Pa_AbortStream(_stream);
+    PaError err = Pa_StartStream(_stream);
+    if (err != paNoError)
+        return _setPaError(err);
+    return true;
+}
+
+bool AudioSink_PortAudio::stop()
+{
+    //qDebug() << Q_FUNC_INFO;
+    if (_stream == NULL)
+        return true;
+    QMutexLocker locker(&portaudioMutex);
+    if (Pa_IsStreamStopped(_stream) == 1)
+        return true;
+    // Discard pending buffers like Pa_CloseStream() used to, but keep the
+    // stream itself so start() is cheap.
+    PaError err = Pa_AbortStream(_stream);
+    if (err != paNoError)
+        return _setPaError(err);
+    return true;
+}
+
+PaTime AudioSink_PortAudio::outputLatency() const
+{
+    if (_stream == NULL)
+        return 0.0;
+    const PaStreamInfo* info = Pa_GetStreamInfo(_stream);
+    return (info == NULL) ? 0.0 : info->outputLatency;
+}
+
+void DeviceEnumerator::run()
+{
+    // Hold PortAudio across both queries so it is only initialized once.
+    if (!AudioSink_PortAudio::acquire())
+    {
+        emit devicesEnumerated(QStringList(), paNoDevice);
+        return;
+    }
+    QStringList devices = AudioSink_PortAudio::deviceNames();
+    int defaultDevice = AudioSink_PortAudio::defaultDevice();
+    AudioSink_PortAudio::release();
+    emit devicesEnumerated(devices, defaultDevice);
+}
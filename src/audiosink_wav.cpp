@@ -0,0 +1,109 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QSettings>
+#include <QtEndian>
+#include <QtDebug>
+#include "audiosink_wav.h"
+
+void AudioSink_Wav::_writeHeader(quint32 dataSize)
+{
+    const bool isFloat = (sampleFormat() == MusicFile::Float32Format);
+    quint32 int32;
+    quint16 int16;
+    _file.write("RIFF");
+    int32 = qToLittleEndian<quint32>(dataSize + 36u);
+    _file.write(reinterpret_cast<const char*>(&int32), 4);
+    _file.write("WAVEfmt ");
+    int32 = qToLittleEndian<quint32>(16u);
+    _file.write(reinterpret_cast<const char*>(&int32), 4);
+
+    // format
+    int16 = qToLittleEndian<quint16>(isFloat ? 3u : 1u); // WAVE_FORMAT_IEEE_FLOAT, WAVE_FORMAT_PCM
+    _file.write(reinterpret_cast<const char*>(&int16), 2);
+    // channels
+    int16 = qToLittleEndian<quint16>(channels());
+    _file.write(reinterpret_cast<const char*>(&int16), 2);
+    // samplerate
+    int32 = qToLittleEndian<quint32>(samplerate());
+    _file.write(reinterpret_cast<const char*>(&int32), 4);
+    // bytespersec
+    int32 = qToLittleEndian<quint32>(samplerate() * blockwidth());
+    _file.write(reinterpret_cast<const char*>(&int32), 4);
+    // blockalign
+    int16 = qToLittleEndian<quint16>(blockwidth());
+    _file.write(reinterpret_cast<const char*>(&int16), 2);
+    // bitwidth
+    int16 = qToLittleEndian<quint16>(isFloat ? 32u : 16u);
+    _file.write(reinterpret_cast<const char*>(&int16), 2);
+
+    _file.write("data");
+    int32 = qToLittleEndian<quint32>(dataSize);
+    _file.write(reinterpret_cast<const char*>(&int32), 4);
+}
+
+bool AudioSink_Wav::open(uint channels, uint samplerate, MusicFile::SampleFormat format,
+        RenderFunction render, void* userData)
+{
+    //qDebug() << Q_FUNC_INFO;
+    if (_file.isOpen() && (channels != this->channels() || samplerate != this->samplerate() || format != sampleFormat()))
+        close();
+    if (!AudioSink_Null::open(channels, samplerate, format, render, userData))
+        return false;
+    if (_file.isOpen())
+        return true;
+
+    QString fileName;
+    {
+        QSettings settings;
+        settings.beginGroup("Playback");
+        fileName = settings.value("Sink File", "output.wav").toString();
+        settings.endGroup();
+    }
+    _file.setFileName(fileName);
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        setError(paDeviceUnavailable, _file.errorString());
+        AudioSink_Null::close();
+        return false;
+    }
+    // sizes are filled in by close()
+    _writeHeader(0);
+    return true;
+}
+
+void AudioSink_Wav::close()
+{
+    //qDebug() << Q_FUNC_INFO;
+    AudioSink_Null::close();
+    if (!_file.isOpen())
+        return;
+    qint64 dataSize = qMin(_file.size() - 44, Q_INT64_C(4294967295) - Q_INT64_C(36));
+    _file.seek(0);
+    _writeHeader(static_cast<quint32>(dataSize));
+    _file.close();
+}
+
+bool AudioSink_Wav::consume(const char* data, unsigned long frames)
+{
+    const qint64 size = static_cast<qint64>(frames) * blockwidth();
+    if (_file.write(data, size) != size)
+    {
+        setError(paInternalError, _file.errorString());
+        return false;
+    }
+    return true;
+}
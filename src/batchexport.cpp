@@ -0,0 +1,483 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSettings>
+#include <QCryptographicHash>
+#include <QTemporaryFile>
+#include <QThread>
+#include <cstdio>
+#include <cstring>
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include "batchexport.h"
+#include "pluginloader.h"
+#include "musicsaver.h"
+#include "musicsaver_tee.h"
+#include "jobscheduler.h"
+
+namespace {
+    const qint64 CopySize = 1 << 20;
+    const char ManifestName[] = ".touhou-musicplayer-export.ini";
+    // Changing what goes into a fingerprint changes this, so every file is
+    // made again once.
+    const int ManifestVersion = 1;
+}
+
+BatchExport::BatchExport(QObject* parent) :
+    QObject(parent),
+    _format("wav"),
+    _output("."),
+    _loop(2),
+    _jobs(0),
+    _loopTags(false),
+    _force(false),
+    _next(0),
+    _finished(0),
+    _written(0),
+    _failed(false)
+{
+}
+
+BatchExport::~BatchExport()
+{
+    for (int i = 0; i < _tasks.size(); ++i)
+        delete _tasks.at(i).temporary;
+}
+
+bool BatchExport::isRequested(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--export") == 0)
+            return true;
+    }
+    return false;
+}
+
+int BatchExport::exec(const QStringList& arguments)
+{
+    //qDebug() << Q_FUNC_INFO;
+
+    if (!_parse(arguments.mid(1)))
+    {
+        std::fprintf(stderr, "%s\n", qPrintable(tr(
+            "usage: touhou-musicplayer --export [--title TITLE] [--format wav|w64|flac|ogg[,...]]\n"
+            "           [--loop N] [--loop-tags] [--tracks 1,3-5] [--jobs N] [--force]\n"
+            "           [--output DIRECTORY|-] <game directory>")));
+        return 2;
+    }
+
+    PluginLoader loader;
+    if (_title.isEmpty())
+    {
+        for (int id = 0; id < loader.size() && _title.isEmpty(); ++id)
+        {
+            loader.clear();
+            if (loader.load(loader.title(id), _path))
+                _title = loader.title(id);
+        }
+    }
+    else if (!loader.contains(_title) || !loader.load(_title, _path))
+    {
+        QStringList titles;
+        for (int id = 0; id < loader.size(); ++id)
+            titles << loader.title(id);
+        std::fprintf(stderr, "%s\n", qPrintable(tr("%1: not loaded as %2; the loaders are: %3")
+            .arg(_path).arg(_title).arg(titles.join(", "))));
+        return 1;
+    }
+    if (_title.isEmpty())
+    {
+        std::fprintf(stderr, "%s\n", qPrintable(tr("%1: no loader accepts it.").arg(_path)));
+        return 1;
+    }
+    if (!_select(loader.musicSize()))
+    {
+        std::fprintf(stderr, "%s\n", qPrintable(tr("Tracks %1 are not in 1 to %2.").arg(_tracks).arg(loader.musicSize())));
+        return 1;
+    }
+
+    // Several formats are saved from one decode by a MusicSaver_Tee.
+    foreach (const QString& format, _format.split(',', QString::SkipEmptyParts))
+    {
+        QString found;
+        foreach (const QString& filter, MusicSaverFactory::filterStringList())
+        {
+            if (filter == MusicSaver_Tee::filterString() || !found.isEmpty())
+                continue;
+            MusicSaver* musicSaver = MusicSaverFactory::createMusicSaver(filter);
+            if (musicSaver->suffix().mid(1) == format)
+            {
+                found = filter;
+                _suffixes << musicSaver->suffix();
+                _rendersLoops << musicSaver->rendersLoops();
+            }
+            delete musicSaver;
+        }
+        if (found.isEmpty())
+        {
+            std::fprintf(stderr, "%s\n", qPrintable(tr("No saver writes .%1 files.").arg(format)));
+            return 1;
+        }
+        _filters << found;
+    }
+    const QString suffix = _suffixes.first();
+    if (_filters.size() > 1 && _output == "-")
+    {
+        std::fprintf(stderr, "%s\n", qPrintable(tr("Give one format to write to stdout.")));
+        return 1;
+    }
+
+    const bool toStdout = (_output == "-");
+    QDir directory(_output);
+    if (toStdout)
+    {
+#ifdef Q_OS_WIN
+        _setmode(1, _O_BINARY);
+#endif
+        if (!_stdout.open(1, QIODevice::WriteOnly | QIODevice::Unbuffered))
+        {
+            std::fprintf(stderr, "%s\n", qPrintable(_stdout.errorString()));
+            return 1;
+        }
+    }
+    else if (!directory.mkpath("."))
+    {
+        std::fprintf(stderr, "%s\n", qPrintable(tr("Cannot create %1.").arg(_output)));
+        return 1;
+    }
+
+    foreach (int index, _selection)
+    {
+        Task task;
+        task.musicData = loader.musicData(index);
+        task.name = MusicSaver::trackFileName(task.musicData, suffix);
+        task.temporary = NULL;
+        task.done = false;
+        task.success = false;
+        if (toStdout)
+        {
+            // Tracks finish out of order; each waits in a file of its own
+            // until those before it are written.
+            task.temporary = new QTemporaryFile(QDir::temp().filePath("touhou-musicplayer-XXXXXX" + suffix));
+            if (!task.temporary->open())
+            {
+                std::fprintf(stderr, "%s\n", qPrintable(task.temporary->errorString()));
+                delete task.temporary;
+                return 1;
+            }
+            task.fileName = task.temporary->fileName();
+            task.temporary->close();
+        }
+        else
+        {
+            task.fileName = directory.filePath(task.name);
+            for (int i = 0; i < _suffixes.size(); ++i)
+            {
+                task.outputs << MusicSaver::trackFileName(task.musicData, _suffixes.at(i));
+                task.fingerprints << _fingerprint(task.musicData, i);
+            }
+        }
+        _tasks << task;
+    }
+    if (!toStdout)
+        _sync(directory);
+
+    // Nothing plays here, so the workers may take every core.
+    JobScheduler::setWorkerCount((_jobs > 0) ? _jobs : QThread::idealThreadCount());
+    for (int i = JobScheduler::workerCount(); i > 0; --i)
+        _submitNext();
+    if (!_running.isEmpty())
+        _eventLoop.exec();
+    if (!toStdout)
+        _writeManifest(directory);
+    return _failed ? 1 : 0;
+}
+
+void BatchExport::jobFinished(bool success)
+{
+    Job* job = qobject_cast<Job*>(sender());
+    Task& task = _tasks[_running.take(job)];
+    task.done = true;
+    task.success = success;
+    ++_finished;
+    if (success)
+        std::fprintf(stderr, "[%d/%d] %s\n", _finished, _tasks.size(), qPrintable(task.name));
+    else
+    {
+        std::fprintf(stderr, "%s: %s\n", qPrintable(task.name), qPrintable(job->errorString()));
+        _failed = true;
+    }
+
+    if (_stdout.isOpen() && !_writeFinished())
+    {
+        // Nobody reads the rest.
+        std::fprintf(stderr, "%s\n", qPrintable(_stdout.errorString()));
+        _failed = true;
+        _next = _tasks.size();
+        foreach (Job* running, _running.keys())
+            running->cancel();
+    }
+
+    _submitNext();
+    if (_running.isEmpty())
+        _eventLoop.quit();
+}
+
+bool BatchExport::_parse(QStringList arguments)
+{
+    while (!arguments.isEmpty() && arguments.first().startsWith("--"))
+    {
+        const QString option = arguments.takeFirst();
+        if (option == "--export")
+            continue;
+        if (option == "--loop-tags")
+        {
+            _loopTags = true;
+            continue;
+        }
+        if (option == "--force")
+        {
+            _force = true;
+            continue;
+        }
+        if (arguments.isEmpty())
+            return false;
+        const QString value = arguments.takeFirst();
+        bool ok = true;
+        if (option == "--title")
+            _title = value;
+        else if (option == "--format")
+        {
+            _format = value.toLower().remove('.');
+            ok = !_format.split(',', QString::SkipEmptyParts).isEmpty();
+        }
+        else if (option == "--loop")
+            _loop = value.toUInt(&ok);
+        else if (option == "--tracks")
+            _tracks = value;
+        else if (option == "--jobs")
+            _jobs = value.toInt(&ok);
+        else if (option == "--output")
+            _output = value;
+        else
+            return false;
+        if (!ok || _loop == 0 || _jobs < 0)
+            return false;
+    }
+    if (arguments.size() != 1)
+        return false;
+    _path = arguments.first();
+    return true;
+}
+
+// Tracks are counted from 1 in the order the loader lists them.
+bool BatchExport::_select(int size)
+{
+    _selection.clear();
+    if (_tracks.isEmpty())
+    {
+        for (int i = 0; i < size; ++i)
+            _selection << i;
+        return size > 0;
+    }
+    foreach (const QString& range, _tracks.split(',', QString::SkipEmptyParts))
+    {
+        const QStringList bounds = range.split('-');
+        if (bounds.size() > 2)
+            return false;
+        bool ok;
+        const int first = bounds.first().toInt(&ok) - 1;
+        int last = first;
+        if (ok && bounds.size() == 2)
+            last = bounds.last().toInt(&ok) - 1;
+        if (!ok || first < 0 || last < first || last >= size)
+            return false;
+        for (int i = first; i <= last; ++i)
+            _selection << i;
+    }
+    return !_selection.isEmpty();
+}
+
+void BatchExport::_submitNext()
+{
+    while (_next < _tasks.size() && _tasks.at(_next).done)
+        ++_next;
+    if (_next >= _tasks.size())
+        return;
+    MusicSaver* musicSaver;
+    if (_filters.size() == 1)
+        musicSaver = MusicSaverFactory::createMusicSaver(_filters.first());
+    else
+    {
+        QList<MusicSaver*> savers;
+        foreach (const QString& filter, _filters)
+            savers << MusicSaverFactory::createMusicSaver(filter);
+        musicSaver = new MusicSaver_Tee(savers);
+    }
+    if (_loopTags)
+        musicSaver->setLoopTags(true);
+    const Task& task = _tasks.at(_next);
+    MusicSaverJob* job = new MusicSaverJob(musicSaver, task.fileName, task.musicData, _loop);
+    connect(job, SIGNAL(finished(bool)), this, SLOT(jobFinished(bool)));
+    _running.insert(job, _next);
+    ++_next;
+    JobScheduler::submit(job);
+}
+
+// Everything a file is made from: the slice of the archive and the file it is
+// in, the tags and loop points, and the settings of the export.
+QByteArray BatchExport::_fingerprint(const MusicData& musicData, int format) const
+{
+    const QString suffix = _suffixes.at(format);
+    QStringList fields;
+    fields << QString::number(ManifestVersion) << suffix;
+
+    const ArchiveMusicData* archive = musicData.archiveMusicData().data();
+    const QString source = (archive != NULL) ? archive->archiveFileName : musicData.fileName();
+    const QFileInfo info(source);
+    fields << source << QString::number(info.size()) << info.lastModified().toString(Qt::ISODate);
+    if (archive != NULL)
+        fields << QString::number(archive->dataBegin) << QString::number(archive->dataEnd);
+
+    fields << musicData.fileName() << musicData.suffix()
+        << musicData.title() << musicData.artist() << musicData.album()
+        << QString::number(musicData.trackNumber()) << QString::number(musicData.totalTrackNumber())
+        << QString::number(musicData.loop()) << QString::number(musicData.loopBegin()) << QString::number(musicData.loopEnd());
+
+    QSettings settings;
+    settings.beginGroup("Playback");
+    const uint fadeoutTime = settings.value("Fadeout Time", 10000U).toUInt();
+    settings.endGroup();
+    settings.beginGroup("Export");
+    const bool loopTags = _loopTags || settings.value("Loop Tags", false).toBool();
+    const int flacLevel = settings.value("FLAC Compression Level", 1).toInt();
+    settings.endGroup();
+    // A stream copy comes out the same whatever is asked for the loop.
+    if (_rendersLoops.at(format))
+    {
+        fields << QString::number(loopTags);
+        if (!loopTags)
+            fields << QString::number(_loop) << QString::number(fadeoutTime);
+    }
+    if (suffix == ".flac")
+        fields << QString::number(flacLevel);
+
+    return QCryptographicHash::hash(fields.join("\n").toUtf8(), QCryptographicHash::Sha1).toHex();
+}
+
+// Marks the tracks whose files are up to date as done.
+void BatchExport::_sync(const QDir& directory)
+{
+    QSettings manifest(directory.filePath(ManifestName), QSettings::IniFormat);
+    manifest.beginGroup("Outputs");
+    foreach (const QString& output, manifest.childKeys())
+        _manifest.insert(output, manifest.value(output).toByteArray());
+    manifest.endGroup();
+    if (_force)
+        return;
+
+    for (int i = 0; i < _tasks.size(); ++i)
+    {
+        Task& task = _tasks[i];
+        bool upToDate = true;
+        for (int j = 0; j < task.outputs.size() && upToDate; ++j)
+        {
+            upToDate = _manifest.value(task.outputs.at(j)) == task.fingerprints.at(j)
+                && directory.exists(task.outputs.at(j));
+        }
+        if (upToDate)
+        {
+            task.done = true;
+            task.success = true;
+            ++_finished;
+        }
+    }
+    if (_finished > 0)
+        std::fprintf(stderr, "%s\n", qPrintable(tr("%1 of %2 tracks are up to date.").arg(_finished).arg(_tasks.size())));
+}
+
+// Records the files that were made, and with every track exported removes
+// those the manifest lists and no track makes any more.
+void BatchExport::_writeManifest(const QDir& directory)
+{
+    QHash<QString, QByteArray> outputs = _manifest;
+    foreach (const Task& task, _tasks)
+    {
+        for (int j = 0; j < task.outputs.size(); ++j)
+        {
+            outputs.remove(task.outputs.at(j));
+            if (task.success)
+                outputs.insert(task.outputs.at(j), task.fingerprints.at(j));
+        }
+    }
+    if (_tracks.isEmpty() && !_failed)
+    {
+        foreach (const QString& output, _manifest.keys())
+        {
+            bool made = false;
+            foreach (const Task& task, _tasks)
+                made = made || task.outputs.contains(output);
+            if (made)
+                continue;
+            outputs.remove(output);
+            if (QFile::remove(directory.filePath(output)))
+                std::fprintf(stderr, "%s\n", qPrintable(tr("Removed %1.").arg(output)));
+        }
+    }
+
+    QSettings manifest(directory.filePath(ManifestName), QSettings::IniFormat);
+    manifest.remove("Outputs");
+    manifest.beginGroup("Outputs");
+    for (QHash<QString, QByteArray>::const_iterator i = outputs.constBegin(); i != outputs.constEnd(); ++i)
+        manifest.setValue(i.key(), i.value());
+    manifest.endGroup();
+    manifest.sync();
+    if (manifest.status() != QSettings::NoError)
+    {
+        std::fprintf(stderr, "%s\n", qPrintable(tr("Cannot write %1.").arg(directory.filePath(ManifestName))));
+        _failed = true;
+    }
+}
+
+// Writes the tracks that are done and have nothing unwritten before them.
+bool BatchExport::_writeFinished()
+{
+    bool success = true;
+    while (success && _written < _tasks.size() && _tasks.at(_written).done)
+    {
+        Task& task = _tasks[_written];
+        if (task.success)
+        {
+            QFile file(task.fileName);
+            success = file.open(QIODevice::ReadOnly);
+            while (success && !file.atEnd())
+            {
+                const QByteArray data = file.read(CopySize);
+                success = !data.isEmpty() && _stdout.write(data) == data.size();
+            }
+        }
+        delete task.temporary;
+        task.temporary = NULL;
+        ++_written;
+    }
+    return success;
+}
@@ -26,7 +26,7 @@
 #include <QPushButton>
 #include <QSettings>
 #include "pluginloader.h"
-#include "musicplayer.h"
+#include "audiosink_portaudio.h"
 #include "configdialog.h"
 
 GeneralConfigTab::GeneralConfigTab(int pluginCount_, QWidget *parent) :
@@ -99,36 +99,133 @@ bool GeneralConfigTab::checkValues()
 
 
 PlaybackConfigTab::PlaybackConfigTab(QWidget *parent) :
-    QWidget(parent)
+    QWidget(parent),
+    deviceId(-1)
 {
     deviceComboBox = new QComboBox();
     deviceComboBox->setEditable(false);
+    deviceComboBox->addItem(tr("Detecting devices..."));
+    deviceComboBox->setEnabled(false);
 
     QHBoxLayout *bufferLayout = new QHBoxLayout();
     bufferLayout->addWidget(new QLabel(tr("Output Device")));
     bufferLayout->addWidget(deviceComboBox, 1);
 
+    sampleRateComboBox = new QComboBox();
+    sampleRateComboBox->setEditable(false);
+    sampleRateComboBox->addItem(tr("Same as source"), 0U);
+    sampleRateComboBox->addItem(tr("44100 Hz"), 44100U);
+    sampleRateComboBox->addItem(tr("48000 Hz"), 48000U);
+    sampleRateComboBox->addItem(tr("88200 Hz"), 88200U);
+    sampleRateComboBox->addItem(tr("96000 Hz"), 96000U);
+    connect(sampleRateComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(sampleRateChanged(int)));
+
+    qualityComboBox = new QComboBox();
+    qualityComboBox->setEditable(false);
+    qualityComboBox->addItem(tr("Fast"));
+    qualityComboBox->addItem(tr("Medium"));
+    qualityComboBox->addItem(tr("Best"));
+    qualityComboBox->setCurrentIndex(1);
+    qualityComboBox->setEnabled(false);
+
+    QHBoxLayout *rateLayout = new QHBoxLayout();
+    rateLayout->addWidget(new QLabel(tr("Output Sample Rate")));
+    rateLayout->addWidget(sampleRateComboBox, 1);
+    rateLayout->addWidget(new QLabel(tr("Quality")));
+    rateLayout->addWidget(qualityComboBox);
+
     QVBoxLayout *mainLayout = new QVBoxLayout();
     mainLayout->addLayout(bufferLayout);
+    mainLayout->addLayout(rateLayout);
     mainLayout->addStretch(1);
 
     this->setLayout(mainLayout);
 }
 
+void PlaybackConfigTab::setSampleRate(uint rate)
+{
+    int index = sampleRateComboBox->findData(rate);
+    sampleRateComboBox->setCurrentIndex((index < 0) ? 0 : index);
+}
+
+void PlaybackConfigTab::sampleRateChanged(int index)
+{
+    qualityComboBox->setEnabled(sampleRateComboBox->itemData(index).toUInt() != 0);
+}
+
 bool PlaybackConfigTab::checkValues()
 {
     return true;
 }
 
+void PlaybackConfigTab::setDevices(const QStringList& devices, int defaultDevice)
+{
+    deviceComboBox->clear();
+    deviceComboBox->addItems(devices);
+    deviceComboBox->setEnabled(devices.size() > 0);
+    if (deviceId < 0 || deviceId >= devices.size())
+        deviceId = defaultDevice;
+    deviceComboBox->setCurrentIndex(deviceId);
+}
+
+
+
+ExportConfigTab::ExportConfigTab(QWidget *parent) :
+    QWidget(parent)
+{
+    loopTagsCheckBox = new QCheckBox(tr("Write the loop once and tag the loop points instead of repeating it."));
+
+    QGroupBox *flacGroupBox = new QGroupBox(tr("FLAC"));
+
+    flacLevelComboBox = new QComboBox();
+    flacLevelComboBox->setEditable(false);
+    for (int i = 0; i <= 8; ++i)
+        flacLevelComboBox->addItem(QString::number(i));
+    flacLevelComboBox->setItemText(0, tr("0 (fastest)"));
+    flacLevelComboBox->setItemText(8, tr("8 (smallest)"));
+    flacLevelComboBox->setCurrentIndex(1);
+
+    QHBoxLayout *levelLayout = new QHBoxLayout();
+    levelLayout->addWidget(new QLabel(tr("Compression Level")));
+    levelLayout->addWidget(flacLevelComboBox, 1);
+
+    flacVerifyCheckBox = new QCheckBox(tr("Verify the encoded data while exporting."));
+    flacVerifyCheckBox->setChecked(true);
+
+    QVBoxLayout *flacLayout = new QVBoxLayout();
+    flacLayout->addLayout(levelLayout);
+    flacLayout->addWidget(flacVerifyCheckBox);
+    flacGroupBox->setLayout(flacLayout);
+
+    QGroupBox *wavGroupBox = new QGroupBox(tr("WAV"));
+
+    directIoCheckBox = new QCheckBox(tr("Write past the system cache."));
+#ifndef Q_OS_LINUX
+    directIoCheckBox->setEnabled(false);
+#endif
+
+    QVBoxLayout *wavLayout = new QVBoxLayout();
+    wavLayout->addWidget(directIoCheckBox);
+    wavGroupBox->setLayout(wavLayout);
+
+    QVBoxLayout *mainLayout = new QVBoxLayout();
+    mainLayout->addWidget(loopTagsCheckBox);
+    mainLayout->addWidget(flacGroupBox);
+    mainLayout->addWidget(wavGroupBox);
+    mainLayout->addStretch(1);
+
+    this->setLayout(mainLayout);
+}
+
 
 
-ConfigDialog::ConfigDialog(const PluginLoader *const _pluginLoader, const MusicPlayer *const _musicPlayer, QWidget *parent) :
+ConfigDialog::ConfigDialog(const PluginLoader *const _pluginLoader, QWidget *parent) :
     QDialog(parent),
-    pluginLoader(_pluginLoader),
-    musicPlayer(_musicPlayer)
+    pluginLoader(_pluginLoader)
 {
     setupUi();
     loadSettings();
+    deviceEnumerator->start();
 }
 
 void ConfigDialog::accept()
@@ -169,7 +266,16 @@ void ConfigDialog::loadSettings()
     settings.endGroup();
 
     settings.beginGroup("Playback");
-    playbackConfigTab->setDevice(settings.value("Output Device", static_cast<int>(musicPlayer->defaultDevice())).toInt());
+    playbackConfigTab->setDevice(settings.value("Output Device", -1).toInt());
+    playbackConfigTab->setSampleRate(settings.value("Output Sample Rate", 0U).toUInt());
+    playbackConfigTab->setResamplerQuality(settings.value("Resampler Quality", 1).toInt());
+    settings.endGroup();
+
+    settings.beginGroup("Export");
+    exportConfigTab->setLoopTags(settings.value("Loop Tags", false).toBool());
+    exportConfigTab->setFlacCompressionLevel(qBound(0, settings.value("FLAC Compression Level", 1).toInt(), 8));
+    exportConfigTab->setFlacVerify(settings.value("FLAC Verify", true).toBool());
+    exportConfigTab->setDirectIo(settings.value("Direct IO", false).toBool());
     settings.endGroup();
 }
 
@@ -190,6 +296,15 @@ void ConfigDialog::saveSettings()
 
     settings.beginGroup("Playback");
     settings.setValue("Output Device", playbackConfigTab->device());
+    settings.setValue("Output Sample Rate", playbackConfigTab->sampleRate());
+    settings.setValue("Resampler Quality", playbackConfigTab->resamplerQuality());
+    settings.endGroup();
+
+    settings.beginGroup("Export");
+    settings.setValue("Loop Tags", exportConfigTab->loopTags());
+    settings.setValue("FLAC Compression Level", exportConfigTab->flacCompressionLevel());
+    settings.setValue("FLAC Verify", exportConfigTab->flacVerify());
+    settings.setValue("Direct IO", exportConfigTab->directIo());
     settings.endGroup();
 }
 
@@ -200,12 +315,16 @@ void ConfigDialog::setupUi()
         generalConfigTab->setPluginTitle(i, pluginLoader->title(i));
 
     playbackConfigTab = new PlaybackConfigTab();
-    for (int i = 0; i < musicPlayer->deviceCount(); ++i)
-        playbackConfigTab->addDevice(musicPlayer->device(i));
+    deviceEnumerator = new DeviceEnumerator(this);
+    connect(deviceEnumerator, SIGNAL(devicesEnumerated(const QStringList&, int)),
+            playbackConfigTab, SLOT(setDevices(const QStringList&, int)));
+
+    exportConfigTab = new ExportConfigTab();
 
     tabWidget = new QTabWidget();
     tabWidget->addTab(generalConfigTab, tr("General"));
     tabWidget->addTab(playbackConfigTab, tr("Playback"));
+    tabWidget->addTab(exportConfigTab, tr("Export"));
 
     buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, Qt::Horizontal);
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
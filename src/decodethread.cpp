@@ -0,0 +1,135 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QMutexLocker>
+#include <QtDebug>
+#include "decodethread.h"
+#include "threadmusicfile.h"
+#include "threadpolicy.h"
+
+QMutex DecodeThread::_instanceMutex;
+DecodeThread* DecodeThread::_instance = NULL;
+
+DecodeThread::DecodeThread() :
+    _current(NULL),
+    _stopped(false)
+{
+}
+
+DecodeThread::~DecodeThread()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopped = true;
+        _work.wakeAll();
+    }
+    wait();
+}
+
+void DecodeThread::add(ThreadMusicFile* file)
+{
+    //qDebug() << Q_FUNC_INFO << file;
+    QMutexLocker instanceLocker(&_instanceMutex);
+    if (_instance == NULL)
+    {
+        _instance = new DecodeThread();
+        _instance->start();
+    }
+    QMutexLocker locker(&_instance->_mutex);
+    _instance->_files << file;
+    _instance->_work.wakeAll();
+}
+
+void DecodeThread::remove(ThreadMusicFile* file)
+{
+    //qDebug() << Q_FUNC_INFO << file;
+    QMutexLocker instanceLocker(&_instanceMutex);
+    if (_instance == NULL)
+        return;
+    bool empty;
+    {
+        QMutexLocker locker(&_instance->_mutex);
+        _instance->_files.removeAll(file);
+        while (_instance->_current == file)
+            _instance->_idle.wait(&_instance->_mutex);
+        empty = _instance->_files.isEmpty();
+    }
+    if (empty)
+    {
+        delete _instance;
+        _instance = NULL;
+    }
+}
+
+void DecodeThread::wake()
+{
+    // Called from the stream callback, so never block on _instanceMutex;
+    // a missed wake only costs one poll interval.
+    DecodeThread* instance = _instance;
+    if (instance == NULL || !instance->_mutex.tryLock())
+        return;
+    instance->_work.wakeAll();
+    instance->_mutex.unlock();
+}
+
+QString DecodeThread::policy()
+{
+    QMutexLocker instanceLocker(&_instanceMutex);
+    if (_instance == NULL)
+        return QString();
+    QMutexLocker locker(&_instance->_mutex);
+    return _instance->_policy;
+}
+
+ThreadMusicFile* DecodeThread::_next() const
+{
+    ThreadMusicFile* result = NULL;
+    qreal lowest = 2.0;
+    foreach (ThreadMusicFile* file, _files)
+    {
+        qreal fill = file->_decodeUrgency();
+        if (fill < lowest)
+        {
+            lowest = fill;
+            result = file;
+        }
+    }
+    return result;
+}
+
+void DecodeThread::run()
+{
+    //qDebug() << Q_FUNC_INFO;
+    ThreadPolicy threadPolicy("Decode");
+    threadPolicy.apply(this);
+    QMutexLocker locker(&_mutex);
+    _policy = threadPolicy.obtained();
+    while (!_stopped)
+    {
+        ThreadMusicFile* file = _next();
+        if (file == NULL)
+        {
+            _work.wait(&_mutex, 100);
+            continue;
+        }
+        _current = file;
+        locker.unlock();
+        file->_decodeStep();
+        locker.relock();
+        _current = NULL;
+        _idle.wakeAll();
+    }
+}
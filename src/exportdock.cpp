@@ -0,0 +1,143 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QTreeWidget>
+#include <QHeaderView>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QFileInfo>
+#include "exportdock.h"
+#include "musicsaver.h"
+
+ExportDock::ExportDock(QWidget* parent) :
+    QDockWidget(tr("Exports"), parent),
+    _tree(new QTreeWidget(this)),
+    _cancelButton(new QPushButton(tr("&Cancel"), this)),
+    _clearButton(new QPushButton(tr("C&lear Finished"), this))
+{
+    setObjectName("ExportDock");
+    _tree->setColumnCount(3);
+    _tree->setHeaderLabels(QStringList() << tr("File") << tr("Progress") << tr("Status"));
+    _tree->setRootIsDecorated(false);
+    _tree->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    connect(_tree, SIGNAL(itemSelectionChanged()), this, SLOT(updateButtons()));
+    connect(_cancelButton, SIGNAL(clicked()), this, SLOT(cancelSelected()));
+    connect(_clearButton, SIGNAL(clicked()), this, SLOT(clearFinished()));
+
+    QHBoxLayout* buttonLayout = new QHBoxLayout();
+    buttonLayout->addStretch();
+    buttonLayout->addWidget(_cancelButton);
+    buttonLayout->addWidget(_clearButton);
+
+    QVBoxLayout* layout = new QVBoxLayout();
+    layout->addWidget(_tree);
+    layout->addLayout(buttonLayout);
+
+    QWidget* widget = new QWidget(this);
+    widget->setLayout(layout);
+    setWidget(widget);
+    updateButtons();
+}
+
+void ExportDock::submit(MusicSaverJob* job)
+{
+    QTreeWidgetItem* item = new QTreeWidgetItem(_tree, QStringList() << QFileInfo(job->fileName()).fileName());
+    item->setToolTip(0, job->fileName());
+    item->setText(2, tr("Queued"));
+    QProgressBar* progressBar = new QProgressBar(_tree);
+    progressBar->setRange(0, 100);
+    progressBar->setValue(0);
+    _tree->setItemWidget(item, 1, progressBar);
+    _items.insert(job, item);
+
+    connect(job, SIGNAL(progressChanged(int)), this, SLOT(jobProgress(int)));
+    connect(job, SIGNAL(finished(bool)), this, SLOT(jobFinished(bool)));
+    JobScheduler::submit(job);
+    updateButtons();
+}
+
+void ExportDock::cancelSelected()
+{
+    for (QHash<Job*, QTreeWidgetItem*>::const_iterator i = _items.constBegin(); i != _items.constEnd(); ++i)
+    {
+        if (i.value()->isSelected())
+        {
+            i.key()->cancel();
+            i.value()->setText(2, tr("Canceling"));
+        }
+    }
+}
+
+void ExportDock::cancelAll()
+{
+    for (QHash<Job*, QTreeWidgetItem*>::const_iterator i = _items.constBegin(); i != _items.constEnd(); ++i)
+    {
+        i.key()->cancel();
+        i.value()->setText(2, tr("Canceling"));
+    }
+}
+
+void ExportDock::clearFinished()
+{
+    for (int i = _tree->topLevelItemCount() - 1; i >= 0; --i)
+    {
+        QTreeWidgetItem* item = _tree->topLevelItem(i);
+        if (_items.key(item) == NULL)
+            delete item;
+    }
+    updateButtons();
+}
+
+void ExportDock::jobProgress(int percent)
+{
+    QTreeWidgetItem* item = _items.value(qobject_cast<Job*>(sender()));
+    if (item == NULL)
+        return;
+    static_cast<QProgressBar*>(_tree->itemWidget(item, 1))->setValue(percent);
+    item->setText(2, tr("Saving"));
+}
+
+void ExportDock::jobFinished(bool success)
+{
+    Job* job = qobject_cast<Job*>(sender());
+    QTreeWidgetItem* item = _items.take(job);
+    if (item == NULL)
+        return;
+    if (success)
+    {
+        static_cast<QProgressBar*>(_tree->itemWidget(item, 1))->setValue(100);
+        item->setText(2, tr("Done"));
+    }
+    else if (job->isCanceled())
+        item->setText(2, tr("Canceled"));
+    else
+    {
+        item->setText(2, tr("Failed: %1").arg(job->errorString()));
+        item->setToolTip(2, job->errorString());
+    }
+    updateButtons();
+}
+
+void ExportDock::updateButtons()
+{
+    bool running = false;
+    for (QHash<Job*, QTreeWidgetItem*>::const_iterator i = _items.constBegin(); i != _items.constEnd() && !running; ++i)
+        running = i.value()->isSelected();
+    _cancelButton->setEnabled(running);
+    _clearButton->setEnabled(_tree->topLevelItemCount() > _items.size());
+}
@@ -0,0 +1,208 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QThread>
+#include <QMutexLocker>
+#include <QCoreApplication>
+#include <QtDebug>
+#include "jobscheduler.h"
+
+Job::Job(Priority priority, QObject* parent) :
+    QObject(parent),
+    _priority(priority),
+    _canceled(0),
+    _progress(0)
+{
+}
+
+bool Job::setProgress(qint64 done, qint64 total)
+{
+    int percent = (total > 0) ? static_cast<int>(qBound<qint64>(0, done * 100 / total, 100)) : 0;
+    if (_progress.fetchAndStoreRelaxed(percent) != percent)
+        emit progressChanged(percent);
+    return !isCanceled();
+}
+
+void Job::_execute()
+{
+    bool success = !isCanceled() && run();
+    if (isCanceled())
+    {
+        success = false;
+        if (_errorString.isEmpty())
+            _errorString = tr("Canceled.");
+    }
+    emit finished(success);
+    deleteLater();
+}
+
+class _JobWorker : public QThread
+{
+    public:
+        _JobWorker(JobScheduler* scheduler_, int index_) : current(NULL), scheduler(scheduler_), index(index_) {}
+
+        QMutex mutex;
+        // guarded by mutex; the owner takes from the front, thieves from the back
+        QList<Job*> queue[Job::PriorityCount];
+        Job* current;
+    protected:
+        virtual void run() { scheduler->_work(index); }
+    private:
+        JobScheduler* scheduler;
+        int index;
+};
+
+QMutex JobScheduler::_instanceMutex;
+JobScheduler* JobScheduler::_instance = NULL;
+int JobScheduler::_workerCount = 0;
+
+JobScheduler::JobScheduler() :
+    _pending(0),
+    _nextWorker(0),
+    _stopped(false)
+{
+    const int count = (_workerCount > 0) ? _workerCount : qMax(1, QThread::idealThreadCount() - 1);
+    for (int i = 0; i < count; ++i)
+        _workers << new _JobWorker(this, i);
+    foreach (_JobWorker* worker, _workers)
+        worker->start(QThread::LowPriority);
+}
+
+JobScheduler::~JobScheduler()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopped = true;
+        _wake.wakeAll();
+    }
+    foreach (_JobWorker* worker, _workers)
+    {
+        QMutexLocker locker(&worker->mutex);
+        for (int p = 0; p < Job::PriorityCount; ++p)
+            foreach (Job* job, worker->queue[p])
+                job->cancel();
+        if (worker->current != NULL)
+            worker->current->cancel();
+    }
+    foreach (_JobWorker* worker, _workers)
+    {
+        worker->wait();
+        for (int p = 0; p < Job::PriorityCount; ++p)
+            qDeleteAll(worker->queue[p]);
+        delete worker;
+    }
+}
+
+void JobScheduler::submit(Job* job)
+{
+    Q_ASSERT(job != NULL);
+    QMutexLocker instanceLocker(&_instanceMutex);
+    if (_instance == NULL)
+        _instance = new JobScheduler();
+    JobScheduler* self = _instance;
+
+    // Jobs spawned by a job stay on that worker, where their data is warm.
+    // Workers run no event loop, so such jobs belong to the application
+    // thread, where finished() is delivered and deleteLater() runs.
+    _JobWorker* target = NULL;
+    foreach (_JobWorker* worker, self->_workers)
+    {
+        if (worker == QThread::currentThread())
+            target = worker;
+        if (worker == job->thread() && QCoreApplication::instance() != NULL)
+            job->moveToThread(QCoreApplication::instance()->thread());
+    }
+    {
+        QMutexLocker locker(&self->_mutex);
+        if (target == NULL)
+        {
+            target = self->_workers.at(self->_nextWorker);
+            self->_nextWorker = (self->_nextWorker + 1) % self->_workers.size();
+        }
+    }
+    {
+        QMutexLocker locker(&target->mutex);
+        target->queue[job->priority()] << job;
+    }
+    QMutexLocker locker(&self->_mutex);
+    ++self->_pending;
+    self->_wake.wakeOne();
+}
+
+void JobScheduler::shutdown()
+{
+    QMutexLocker instanceLocker(&_instanceMutex);
+    delete _instance;
+    _instance = NULL;
+}
+
+int JobScheduler::workerCount()
+{
+    QMutexLocker instanceLocker(&_instanceMutex);
+    if (_instance == NULL)
+        return (_workerCount > 0) ? _workerCount : qMax(1, QThread::idealThreadCount() - 1);
+    return _instance->_workers.size();
+}
+
+void JobScheduler::setWorkerCount(int count)
+{
+    QMutexLocker instanceLocker(&_instanceMutex);
+    _workerCount = qMax(0, count);
+}
+
+Job* JobScheduler::_take(int worker)
+{
+    const int count = _workers.size();
+    for (int p = 0; p < Job::PriorityCount; ++p)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            _JobWorker* victim = _workers.at((worker + i) % count);
+            QMutexLocker locker(&victim->mutex);
+            if (victim->queue[p].isEmpty())
+                continue;
+            return (i == 0) ? victim->queue[p].takeFirst() : victim->queue[p].takeLast();
+        }
+    }
+    return NULL;
+}
+
+void JobScheduler::_work(int worker)
+{
+    forever
+    {
+        {
+            QMutexLocker locker(&_mutex);
+            while (!_stopped && _pending == 0)
+                _wake.wait(&_mutex);
+            if (_stopped)
+                return;
+            // Claiming before taking means a queued job is always there.
+            --_pending;
+        }
+        _JobWorker* self = _workers.at(worker);
+        Job* job = _take(worker);
+        Q_ASSERT(job != NULL);
+        {
+            QMutexLocker locker(&self->mutex);
+            self->current = job;
+        }
+        //qDebug() << Q_FUNC_INFO << worker << job;
+        job->_execute();
+        QMutexLocker locker(&self->mutex);
+        self->current = NULL;
+    }
+}
@@ -14,13 +14,216 @@
  * You should have received a copy of the GNU General Public License
  * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
  */
-#include <cmath>
 #include <QSettings>
+#include <QTemporaryFile>
+#include <QWaitCondition>
 #include <QtDebug>
+#include <cstring>
 #include "loopmusicfile.h"
+#include "jobscheduler.h"
+#include "sampleops.h"
+#include "telemetry.h"
+#include "trace.h"
+
+namespace {
+    // Loop bodies above this go to a temporary file; about 25 minutes of
+    // 44100 Hz stereo.
+    const qint64 SpillSize = Q_INT64_C(256) << 20;
+    const qint64 FillSamples = 65536;
+    // About 24 seconds at 44100 Hz; each segment costs an open and a seek.
+    const qint64 SegmentSamples = 1 << 20;
+
+    // A fill cut into segments.  Seeking is sample exact for every format,
+    // Vorbis decodes the packet before the position for the overlap, so a
+    // segment decoded on its own is the same as the stretch of a sequential
+    // decode, and goes straight to its place in data.
+    struct _Fill : public QSharedData
+    {
+        _Fill(const MusicData& musicData_, MusicFile::SampleFormat sampleFormat_, uint blockwidth_, char* data_, qint64 begin_, qint64 samples_) :
+            musicData(musicData_),
+            sampleFormat(sampleFormat_),
+            blockwidth(blockwidth_),
+            data(data_),
+            begin(begin_),
+            samples(samples_),
+            segments(qMax(Q_INT64_C(1), (samples_ + SegmentSamples - 1) / SegmentSamples)),
+            next(0),
+            finished(0),
+            failed(false)
+        {
+        }
+
+        MusicData musicData;
+        MusicFile::SampleFormat sampleFormat;
+        uint blockwidth;
+        char* data;
+        qint64 begin;
+        qint64 samples;
+        qint64 segments;
+
+        QMutex mutex;
+        // signaled whenever a segment is done
+        QWaitCondition changed;
+        qint64 next;
+        qint64 finished;
+        bool failed;
+        QString errorString;
+    };
+
+    bool _fillSegment(_Fill* fill, MusicFile* musicFile, qint64 index, QString& errorString)
+    {
+        TRACE_ZONE("LoopCache segment");
+        const qint64 first = index * SegmentSamples;
+        const qint64 last = qMin(first + SegmentSamples, fill->samples);
+        if (!musicFile->sampleSeek(fill->begin + first))
+        {
+            errorString = QObject::tr("Cannot seek to the loop.");
+            return false;
+        }
+        for (qint64 done = first; done < last; )
+        {
+            const qint64 read = musicFile->sampleRead(fill->data + done * fill->blockwidth, qMin(FillSamples, last - done));
+            if (read <= 0)
+            {
+                errorString = QObject::tr("Unexpected end of data.");
+                return false;
+            }
+            done += read;
+        }
+        return true;
+    }
+
+    // Claims the next segment and decodes it with musicFile, which is opened
+    // from the track when NULL; false once none is left.
+    bool _fillNext(_Fill* fill, MusicFile*& musicFile)
+    {
+        qint64 index;
+        {
+            QMutexLocker locker(&fill->mutex);
+            if (fill->failed || fill->next >= fill->segments)
+                return false;
+            index = fill->next++;
+        }
+        QString errorString;
+        bool success = true;
+        if (musicFile == NULL)
+        {
+            musicFile = MusicFileFactory::createMusicFile(fill->musicData);
+            success = musicFile != NULL;
+            if (success)
+            {
+                musicFile->setSampleFormat(fill->sampleFormat);
+                success = musicFile->open(QIODevice::ReadOnly) && musicFile->blockwidth() == fill->blockwidth;
+                if (!success)
+                    errorString = musicFile->errorString();
+            }
+        }
+        success = success && _fillSegment(fill, musicFile, index, errorString);
+        QMutexLocker locker(&fill->mutex);
+        ++fill->finished;
+        if (!success && !fill->failed)
+        {
+            fill->failed = true;
+            fill->errorString = errorString.isEmpty() ? QObject::tr("Cannot decode the loop.") : errorString;
+        }
+        fill->changed.wakeAll();
+        return true;
+    }
+
+    class _FillJob : public Job
+    {
+        public:
+            _FillJob(_Fill* fill) : Job(ExportPriority), _fill(fill), _musicFile(NULL) {}
+            ~_FillJob() { delete _musicFile; }
+        protected:
+            virtual bool run()
+            {
+                while (!isCanceled() && _fillNext(_fill.data(), _musicFile))
+                    ;
+                // closed in the thread that opened it
+                delete _musicFile;
+                _musicFile = NULL;
+                return true;
+            }
+        private:
+            QExplicitlySharedDataPointer<_Fill> _fill;
+            MusicFile* _musicFile;
+    };
+}
+
+LoopCache::LoopCache(bool wholeTrack) :
+    _wholeTrack(wholeTrack),
+    _spill(NULL),
+    _data(NULL),
+    _blockwidth(0)
+{
+}
+
+LoopCache::~LoopCache()
+{
+    delete _spill;
+}
+
+bool LoopCache::_fill(const MusicData& musicData, MusicFile* musicFile, qint64 begin, qint64 samples)
+{
+    TRACE_ZONE("LoopCache fill");
+    QMutexLocker locker(&_mutex);
+    if (_data != NULL)
+    {
+        Q_ASSERT(_blockwidth == musicFile->blockwidth());
+        return true;
+    }
+    if (!_errorString.isEmpty())
+        return false;
+
+    const uint blockwidth = musicFile->blockwidth();
+    const qint64 size = samples * blockwidth;
+    char* data = NULL;
+    if (size <= SpillSize)
+    {
+        _memory.resize(size);
+        data = _memory.data();
+    }
+    else
+    {
+        _spill = new QTemporaryFile();
+        if (!_spill->open() || !_spill->resize(size) || (data = reinterpret_cast<char*>(_spill->map(0, size))) == NULL)
+        {
+            _errorString = _spill->errorString();
+            return false;
+        }
+    }
+
+    QExplicitlySharedDataPointer<_Fill> fill(new _Fill(musicData, musicFile->sampleFormat(), blockwidth, data, begin, samples));
+    const int helpers = qMin<qint64>(JobScheduler::workerCount(), fill->segments - 1);
+    for (int i = 0; i < helpers; ++i)
+    {
+        Job* job = new _FillJob(fill.data());
+        JobScheduler::submit(job);
+    }
+
+    // Every claimed segment is waited for, so data outlives the helpers'
+    // writes; helpers starting later find nothing left.
+    while (_fillNext(fill.data(), musicFile))
+        ;
+    {
+        QMutexLocker fillLocker(&fill->mutex);
+        while (fill->finished < fill->next)
+            fill->changed.wait(&fill->mutex);
+        if (fill->failed)
+        {
+            _errorString = fill->errorString;
+            return false;
+        }
+    }
+    _blockwidth = blockwidth;
+    _data = data;
+    return true;
+}
 
 LoopMusicFile::LoopMusicFile(const MusicData& musicData, uint totalLoop) :
-    _totalLoop(totalLoop)
+    _totalLoop(totalLoop),
+    _musicData(musicData)
 {
     //qDebug() << Q_FUNC_INFO;
     _musicFile = MusicFileFactory::createMusicFile(musicData);
@@ -51,6 +254,15 @@ bool LoopMusicFile::open(MusicFile::OpenMode mode)
         //return false;
     }
     _totalSamples = loopBegin + loopSize * _totalLoop + _fadeoutSamples;
+    if (_loopCache.data() != NULL)
+    {
+        const qint64 cacheBegin = _loopCache->_wholeTrack ? 0 : loopBegin;
+        if (!_loopCache->_fill(_musicData, _musicFile, cacheBegin, loopEnd - cacheBegin) || !_musicFile->sampleSeek(0))
+        {
+            setErrorString(_loopCache->_errorString);
+            return false;
+        }
+    }
     return true;
 }
 
@@ -58,6 +270,9 @@ bool LoopMusicFile::sampleSeek(qint64 pos)
 {
     //qDebug() << Q_FUNC_INFO;
     _setSamplesAndLoop(pos);
+    // Everything from the loop on comes from the cache, or all of it.
+    if (_loopCache.data() != NULL && (pos >= _musicFile->loopBegin() || _loopCache->_wholeTrack))
+        return true;
     _samplesToLoop(pos);
     return _musicFile->sampleSeek(pos);
 }
@@ -67,11 +282,17 @@ qint64 LoopMusicFile::sampleRead(char* buffer, qint64 needSample)
     //qDebug() << Q_FUNC_INFO;
     if (_samples >= _totalSamples)
         return 0;
-    Q_ASSERT(_musicFile->samplePos() < _musicFile->loopEnd());
     needSample = qMin(needSample, _totalSamples - _samples);
     //qDebug() << Q_FUNC_INFO << "needSample" << needSample;
     qint64 getSamples = 0;
-    if (_musicFile->samplePos() >= _musicFile->loopEnd() - needSample)
+    if (_loopCache.data() != NULL)
+    {
+        getSamples = _cachedRead(buffer, needSample);
+        if (getSamples == -1)
+            return -1;
+        needSample = 0;
+    }
+    else if (_musicFile->samplePos() >= _musicFile->loopEnd() - needSample)
     {
         //qDebug() << Q_FUNC_INFO << _musicFile->samplePos() << _musicFile->loopEnd() << needSample;
         //qDebug() << Q_FUNC_INFO << "loop" << _musicFile->loopEnd() - _musicFile->samplePos();
@@ -79,11 +300,16 @@ qint64 LoopMusicFile::sampleRead(char* buffer, qint64 needSample)
         //qDebug() << Q_FUNC_INFO << needSample << getSamples;
         if (getSamples == -1)
             return -1;
+        TRACE_ZONE("loop seek");
+        const qint64 seekBegin = Telemetry::now();
         _musicFile->sampleSeek(_musicFile->loopBegin());
+        Telemetry::recordLoopSeek(Telemetry::now() - seekBegin);
         needSample -= getSamples;
         //qDebug() << Q_FUNC_INFO << "getSamples" << getSamples;
     }
+    if (needSample > 0)
     {
+        Q_ASSERT(_musicFile->samplePos() < _musicFile->loopEnd());
         qint64 getSamples2 = _musicFile->sampleRead(buffer + getSamples * blockwidth(), needSample);
         if (getSamples2 == -1)
             return -1;
@@ -94,26 +320,52 @@ qint64 LoopMusicFile::sampleRead(char* buffer, qint64 needSample)
     if (_samples + getSamples >= normalSamples)
     {
         //qDebug() << Q_FUNC_INFO << "fadeout";
-        qint16* bufferSample = reinterpret_cast<qint16*>(buffer);
-        qint16* bufferSampleEnd = bufferSample + getSamples * _musicFile->channels();
+        const uint channels = _musicFile->channels();
         qint64 i = qMax(Q_INT64_C(0), normalSamples - _samples);
-        bufferSample += i * _musicFile->channels();
-        while (bufferSample < bufferSampleEnd)
+        qint64 remain = _totalSamples - _samples - i;
+        Q_ASSERT(remain >= 0);
+        //factor = cos(factor * 1.5707963267948966192313216916397514);
+        if (sampleFormat() == MusicFile::Float32Format)
+            SampleOps::applyFade(reinterpret_cast<float*>(buffer) + i * channels, getSamples - i, channels, remain, _fadeoutSamples, false, true);
+        else
+            SampleOps::applyFade(reinterpret_cast<qint16*>(buffer) + i * channels, getSamples - i, channels, remain, _fadeoutSamples, false, true);
+    }
+    _setSamplesAndLoop(_samples + getSamples);
+    return getSamples;
+}
+
+qint64 LoopMusicFile::_cachedRead(char* buffer, qint64 needSample)
+{
+    const qint64 loopBegin = _musicFile->loopBegin();
+    const qint64 loopSize = _musicFile->loopEnd() - loopBegin;
+    const uint width = blockwidth();
+    const char* loopData = _loopCache->_data;
+    qint64 getSamples = 0;
+    if (_loopCache->_wholeTrack)
+    {
+        loopData += loopBegin * width;
+        if (_samples < loopBegin)
         {
-            qreal factor = static_cast<qreal>(_totalSamples - _samples - i) / static_cast<qreal>(_fadeoutSamples);
-            Q_ASSERT(factor >= 0.0);
-            //factor = cos(factor * 1.5707963267948966192313216916397514);
-            factor = std::sqrt(factor);
-            //qDebug() << Q_FUNC_INFO << factor << i;
-            for (uint j = 0; j < _musicFile->channels(); ++j)
-            {
-                *bufferSample *= factor;
-                ++bufferSample;
-            }
-            ++i;
+            getSamples = qMin(needSample, loopBegin - _samples);
+            memcpy(buffer, _loopCache->_data + _samples * width, getSamples * width);
         }
     }
-    _setSamplesAndLoop(_samples + getSamples);
+    else if (_samples < loopBegin)
+    {
+        getSamples = _musicFile->sampleRead(buffer, qMin(needSample, loopBegin - _samples));
+        if (getSamples <= 0)
+            return getSamples;
+    }
+    if (_samples + getSamples < loopBegin)
+        return getSamples;
+    qint64 offset = (_samples + getSamples - loopBegin) % loopSize;
+    while (getSamples < needSample)
+    {
+        const qint64 count = qMin(needSample - getSamples, loopSize - offset);
+        memcpy(buffer + getSamples * width, loopData + offset * width, count * width);
+        getSamples += count;
+        offset = 0;
+    }
     return getSamples;
 }
 
@@ -22,10 +22,18 @@
 #include <QLibraryInfo>
 
 #include "mainwindow.h"
+#include "batchexport.h"
 #include "musicfile_ogg.h"
 #include "musicfile_wav.h"
 #include "musicsaver_wav.h"
 #include "musicsaver_flac.h"
+#include "musicsaver_ogg.h"
+#include "musicsaver_tee.h"
+#include "audiosink_portaudio.h"
+#include "audiosink_null.h"
+#include "audiosink_wav.h"
+#include "jobscheduler.h"
+#include "tracefile.h"
 
 const uint VERSION = 0x00070000;
 
@@ -85,12 +93,20 @@ void initialFactories()
     MusicFileFactory::registerMusicFile(".ogg", MusicFile_Ogg::createFunction);
     MusicFileFactory::registerMusicFile(".wav", MusicFile_Wav::createFunction);
     MusicSaverFactory::registerMusicSaver(MusicSaver_Wav::filterString(), MusicSaver_Wav::createFunction);
+    MusicSaverFactory::registerMusicSaver(MusicSaver_W64::filterString(), MusicSaver_W64::createFunction);
     MusicSaverFactory::registerMusicSaver(MusicSaver_Flac::filterString(), MusicSaver_Flac::createFunction);
+    MusicSaverFactory::registerMusicSaver(MusicSaver_Ogg::filterString(), MusicSaver_Ogg::createFunction);
+    MusicSaverFactory::registerMusicSaver(MusicSaver_Tee::filterString(), MusicSaver_Tee::createFunction);
+    AudioSinkFactory::registerAudioSink("PortAudio", AudioSink_PortAudio::createFunction);
+    AudioSinkFactory::registerAudioSink("Null", AudioSink_Null::createFunction);
+    AudioSinkFactory::registerAudioSink("Wav", AudioSink_Wav::createFunction);
 }
 
 int main(int argv, char **args)
 {
-    QApplication app(argv, args);
+    // --export runs without a window, so it works without a display.
+    const bool batch = BatchExport::isRequested(argv, args);
+    QApplication app(argv, args, !batch);
     app.setOrganizationName("Touhou Music Player");
     app.setApplicationName("Touhou Music Player");
     app.setApplicationVersion(QString("%1.%2.%3")
@@ -115,8 +131,23 @@ int main(int argv, char **args)
     updateSettings();
     initialFactories();
 
-    MainWindow window;
-    window.show();
+#ifdef TOUHOU_TRACE
+    TraceFile traceFile;
+    traceFile.install();
+#endif
 
-    return app.exec();
+    int result;
+    if (batch)
+    {
+        BatchExport batchExport;
+        result = batchExport.exec(app.arguments());
+    }
+    else
+    {
+        MainWindow window;
+        window.show();
+        result = app.exec();
+    }
+    JobScheduler::shutdown();
+    return result;
 }
@@ -24,15 +24,23 @@
 #include <QLabel>
 #include <QMessageBox>
 #include <QCloseEvent>
+#include <QShowEvent>
+#include <QHideEvent>
 #include <QMenuBar>
 #include <QMenu>
 #include <QToolBar>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QDir>
+#include <QInputDialog>
 
 #include "pluginloader.h"
 #include "musicsaver.h"
 #include "playlistmodel.h"
 #include "spinboxdelegate.h"
+#include "statsdock.h"
+#include "exportdock.h"
+#include "telemetry.h"
 #include "mainwindow.h"
 
 namespace {
@@ -42,6 +50,14 @@ namespace {
             return QString::fromWCharArray(L"\u2605 x %1").arg(life);
         return QString(life, L'\u2605');
     }
+
+    // Orders logical rows as the playlist shows them.
+    struct VisualOrder
+    {
+        QHeaderView* header;
+        VisualOrder(QHeaderView* header_) : header(header_) {}
+        bool operator()(int left, int right) const { return header->visualIndex(left) < header->visualIndex(right); }
+    };
 }
 
 MainWindow::MainWindow()
@@ -56,6 +72,10 @@ MainWindow::MainWindow()
     connect(musicPlayer, SIGNAL(loopChanged(uint)), this, SLOT(loopChanged(uint)));
     playlistModel = new PlaylistModel();
     spinBoxDelegate = new SpinBoxDelegate(this);
+    telemetryWriter = new TelemetryWriter(this);
+
+    statsDock = new StatsDock(this);
+    exportDock = new ExportDock(this);
 
     setupActions();
     setupMenus();
@@ -78,6 +98,14 @@ MainWindow::~MainWindow()
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+    if (exportDock->runningCount() > 0 && QMessageBox::question(this, tr("Exports Running"),
+            tr("Some music files are still being saved. Cancel them and quit?"),
+            QMessageBox::Yes | QMessageBox::No, QMessageBox::No) != QMessageBox::Yes)
+    {
+        event->ignore();
+        return;
+    }
+    exportDock->cancelAll();
     musicPlayer->stop();
     musicPlayer->clearQueue();
     {
@@ -96,9 +124,35 @@ void MainWindow::closeEvent(QCloseEvent *event)
     event->accept();
 }
 
+void MainWindow::changeEvent(QEvent *event)
+{
+    if (event->type() == QEvent::WindowStateChange)
+        _updateTickInterval();
+    QMainWindow::changeEvent(event);
+}
+
+void MainWindow::showEvent(QShowEvent *event)
+{
+    _updateTickInterval();
+    QMainWindow::showEvent(event);
+}
+
+void MainWindow::hideEvent(QHideEvent *event)
+{
+    _updateTickInterval();
+    QMainWindow::hideEvent(event);
+}
+
+void MainWindow::_updateTickInterval()
+{
+    // Nobody looks at the position while the window is minimized or hidden.
+    musicPlayer->setTickInterval((isMinimized() || !isVisible()) ? 0 : 1000/30);
+}
+
 void MainWindow::config()
 {
-    ConfigDialog(pluginLoader, musicPlayer, this).exec();
+    ConfigDialog(pluginLoader, this).exec();
+    telemetryWriter->reloadSettings();
 }
 
 void MainWindow::loadFile()
@@ -150,29 +204,61 @@ void MainWindow::loadFile()
 
 void MainWindow::saveFile()
 {
-    int id = playlistTableView->selectionModel()->currentIndex().row();
+    QList<int> rows;
+    foreach (const QModelIndex& index, playlistTableView->selectionModel()->selectedRows())
+        rows << index.row();
+    if (rows.isEmpty())
+    {
+        if (!playlistTableView->selectionModel()->currentIndex().isValid())
+            return;
+        rows << playlistTableView->selectionModel()->currentIndex().row();
+    }
+    qSort(rows.begin(), rows.end(), VisualOrder(playlistTableView->verticalHeader()));
+
     static QString filter;
     static QString suffix = ".wav";
-    QString fileName = QFileDialog::getSaveFileName(
-        this,
-        tr("Save music file to..."),
-        QString("%1.%2%3")
-            .arg(playlistModel->musicData(id).trackNumber(), 2, 10, QLatin1Char('0'))
-            .arg(playlistModel->musicData(id).title())
-            .arg(suffix),
-        MusicSaverFactory::filterStringList().join(";;"),
-        &filter);
-    if (!fileName.size())
-        return;
+    static QString directory;
+    QString chosenName;
+    if (rows.size() == 1)
+    {
+        chosenName = QFileDialog::getSaveFileName(
+            this,
+            tr("Save music file to..."),
+            QDir(directory).filePath(MusicSaver::trackFileName(playlistModel->musicData(rows.first()), suffix)),
+            MusicSaverFactory::filterStringList().join(";;"),
+            &filter);
+        if (!chosenName.size())
+            return;
+        directory = QFileInfo(chosenName).path();
+    }
+    else
+    {
+        // Several tracks go to one directory, named as the single one is.
+        const QStringList filters = MusicSaverFactory::filterStringList();
+        bool ok;
+        filter = QInputDialog::getItem(this, tr("Save music files"), tr("Format:"),
+            filters, qMax(0, filters.indexOf(filter)), false, &ok);
+        if (!ok)
+            return;
+        const QString chosenDirectory = QFileDialog::getExistingDirectory(this, tr("Save %n music files to...", "", rows.size()), directory);
+        if (!chosenDirectory.size())
+            return;
+        directory = chosenDirectory;
+    }
 
-    //qDebug() << Q_FUNC_INFO << QFileInfo(fileName).suffix();
-    MusicSaver* musicSaver = MusicSaverFactory::createMusicSaver(filter);
-    suffix = musicSaver->suffix();
-    if (QFileInfo(fileName).suffix() != musicSaver->suffix().mid(1))
-        fileName.append(musicSaver->suffix());
-    if (!musicSaver->save(fileName, playlistModel->musicData(id), playlistModel->loop(id)))
-        QMessageBox::warning(this, tr("Fatal Error"), musicSaver->errorString());
-    delete musicSaver;
+    for (int i = 0; i < rows.size(); ++i)
+    {
+        const int id = rows.at(i);
+        MusicSaver* musicSaver = MusicSaverFactory::createMusicSaver(filter);
+        suffix = musicSaver->suffix();
+        QString fileName = chosenName.isEmpty()
+            ? QDir(directory).filePath(MusicSaver::trackFileName(playlistModel->musicData(id), suffix))
+            : chosenName;
+        if (QFileInfo(fileName).suffix() != musicSaver->suffix().mid(1))
+            fileName.append(musicSaver->suffix());
+        exportDock->submit(new MusicSaverJob(musicSaver, fileName, playlistModel->musicData(id), playlistModel->loop(id)));
+    }
+    exportDock->show();
 }
 
 void MainWindow::about()
@@ -240,7 +326,7 @@ void MainWindow::loopChanged(uint newLoop)
 
 void MainWindow::tick(qint64 samples)
 {
-    int time = samples * (1.0 / 44.1) + 0.5;
+    int time = samples * 1000.0 / musicPlayer->samplerate() + 0.5;
     int msec = time % 1000;
     time /= 1000;
     int sec = time % 60;
@@ -374,6 +460,10 @@ void MainWindow::setupMenus()
     playbackMenu->addAction(nextAction);
     playbackMenu->addAction(previousAction);
 
+    QMenu *viewMenu = menuBar()->addMenu(tr("&View"));
+    viewMenu->addAction(statsDock->toggleViewAction());
+    viewMenu->addAction(exportDock->toggleViewAction());
+
     QMenu *aboutMenu = menuBar()->addMenu(tr("&Help"));
     aboutMenu->addAction(aboutAction);
     aboutMenu->addAction(aboutQtAction);
@@ -417,7 +507,7 @@ void MainWindow::setupUi()
     playlistTableView->setColumnWidth(1, 251);
     playlistTableView->setColumnWidth(2, 295);
     playlistTableView->setTabKeyNavigation(false);
-    playlistTableView->setSelectionMode(QAbstractItemView::SingleSelection);
+    playlistTableView->setSelectionMode(QAbstractItemView::ExtendedSelection);
     playlistTableView->setSelectionBehavior(QAbstractItemView::SelectRows);
     playlistTableView->verticalHeader()->setMovable(true);
     playlistTableView->horizontalHeader()->setMovable(true);
@@ -441,6 +531,11 @@ void MainWindow::setupUi()
     widget->setLayout(mainLayout);
 
     setCentralWidget(widget);
+
+    addDockWidget(Qt::RightDockWidgetArea, statsDock);
+    statsDock->hide();
+    addDockWidget(Qt::BottomDockWidgetArea, exportDock);
+    exportDock->hide();
     setWindowTitle(tr("Touhou Music Player"));
 }
 
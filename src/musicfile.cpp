@@ -17,13 +17,16 @@
 #include <QFSFileEngine>
 #include <QtDebug>
 #include "musicfile.h"
+#include "trace.h"
 
 MusicFile::MusicFile(const MusicData& fileDescription) :
+    _sampleFormat(Int16Format),
     _loop(fileDescription.loop()),
     _loopBegin(fileDescription.loopBegin()),
     _loopEnd(fileDescription.loopEnd()),
     _title(fileDescription.title()),
     _album(fileDescription.album()),
+    _bytesRead(0),
     _fileName(fileDescription.fileName()),
     _fileEngine(QAbstractFileEngine::create(_fileName))
 {
@@ -123,16 +126,21 @@ qint64 MusicFile::readData(char* data, qint64 maxSize)
 
 qint64 MusicFile::_readData(char* data, qint64 maxSize)
 {
+    TRACE_ZONE("MusicFile read");
+    qint64 result;
     if (_archiveMusicData.data() == NULL)
-        return _fileEngine->read(data, maxSize);
-    qint64 realMaxSize = qMin(maxSize, _archiveMusicData->dataEnd - _fileEngine->pos());
-    if (realMaxSize <= 0)
-        return 0;
-    if (_archiveMusicData->decoder == NULL)
-        return _fileEngine->read(data, realMaxSize);
-    qint64 result = _fileEngine->read(data, realMaxSize);
-    for (qint64 i = 0; i < result; ++i)
-        data[i] = _archiveMusicData->decoder(_archiveMusicData->userData, data[i]);
+        result = _fileEngine->read(data, maxSize);
+    else
+    {
+        qint64 realMaxSize = qMin(maxSize, _archiveMusicData->dataEnd - _fileEngine->pos());
+        if (realMaxSize <= 0)
+            return 0;
+        result = _fileEngine->read(data, realMaxSize);
+        if (result > 0)
+            _archiveMusicData->decode(data, result);
+    }
+    if (result > 0)
+        _bytesRead += result;
     return result;
 }
 
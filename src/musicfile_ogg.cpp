@@ -21,6 +21,7 @@
 #include <QtDebug>
 
 #include "musicfile_ogg.h"
+#include "trace.h"
 
 struct _MusicFile_OggCore
 {
@@ -40,6 +41,7 @@ struct _MusicFile_OggCore
     qint64 size();
     bool seek(qint64 pos);
     qint64 readData(char* data, qint64 maxSize);
+    qint64 readFloatData(float* data, qint64 maxSamples);
     size_t _read(void* ptr, size_t size, size_t nmemb);
     int _seek(qint64 offset, int whence);
     int _close();
@@ -126,8 +128,8 @@ bool _MusicFile_OggCore::open()
     Q_ASSERT(info != NULL);
     shell->_channels = info->channels;
     shell->_samplerate = info->rate;
-    shell->_bytewidth = 2;
-    shell->_blockwidth = shell->_channels * 2;
+    shell->_bytewidth = (shell->_sampleFormat == MusicFile::Float32Format) ? 4 : 2;
+    shell->_blockwidth = shell->_channels * shell->_bytewidth;
     return true;
 }
 
@@ -151,6 +153,7 @@ qint64 _MusicFile_OggCore::size()
 bool _MusicFile_OggCore::seek(qint64 pos)
 {
     //qDebug() << Q_FUNC_INFO << "pos" << pos << "size" << size();
+    TRACE_ZONE("vorbis seek");
     mutex.lock();
     int result = ov_pcm_seek(&file, pos / shell->_blockwidth);
     mutex.unlock();
@@ -181,6 +184,12 @@ bool _MusicFile_OggCore::seek(qint64 pos)
 qint64 _MusicFile_OggCore::readData(char* data, qint64 maxSize)
 {
     //qDebug() << Q_FUNC_INFO << maxSize;
+    TRACE_ZONE("vorbis decode");
+    if (shell->_sampleFormat == MusicFile::Float32Format)
+    {
+        qint64 result = readFloatData(reinterpret_cast<float*>(data), maxSize / shell->_blockwidth);
+        return (result < 0) ? result : result * shell->_blockwidth;
+    }
     qint64 size = 0;
     while (size < maxSize)
     {
@@ -210,6 +219,48 @@ qint64 _MusicFile_OggCore::readData(char* data, qint64 maxSize)
     return size;
 }
 
+qint64 _MusicFile_OggCore::readFloatData(float* data, qint64 maxSamples)
+{
+    // ov_read_float() hands out the decoder's own planar buffers, which is
+    // the native output of libvorbis, so no quantization happens here.
+    const uint channels = shell->_channels;
+    qint64 samples = 0;
+    while (samples < maxSamples)
+    {
+        int current_section;
+        float** pcm;
+        mutex.lock();
+        long result = ov_read_float(&file, &pcm, qMin<qint64>(maxSamples - samples, 4096), &current_section);
+        switch (result)
+        {
+            case OV_HOLE:
+                //qDebug() << Q_FUNC_INFO << "OV_HOLE";
+                mutex.unlock();
+                return -1;
+            case OV_EBADLINK:
+                //qDebug() << Q_FUNC_INFO << "OV_EBADLINK";
+                mutex.unlock();
+                return -1;
+            case OV_EINVAL:
+                //qDebug() << Q_FUNC_INFO << "OV_EINVAL";
+                mutex.unlock();
+                return -1;
+            case 0:
+                mutex.unlock();
+                return samples;
+            default:
+                break;
+        }
+        float* out = data + samples * channels;
+        for (long i = 0; i < result; ++i)
+            for (uint j = 0; j < channels; ++j)
+                *out++ = pcm[j][i];
+        mutex.unlock();
+        samples += result;
+    }
+    return samples;
+}
+
 size_t _MusicFile_OggCore::_read(void* ptr, size_t size, size_t nmemb)
 {
     Q_ASSERT(shell != NULL);
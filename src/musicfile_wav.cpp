@@ -15,7 +15,162 @@
  * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <QtEndian>
+#include <algorithm>
+#include <cstring>
 #include "musicfile_wav.h"
+#include "sampleops.h"
+
+namespace
+{
+    enum
+    {
+        WAVE_FORMAT_PCM = 0x0001,
+        WAVE_FORMAT_IEEE_FLOAT = 0x0003,
+        WAVE_FORMAT_EXTENSIBLE = 0xFFFE,
+    };
+
+    enum _SourceFormat
+    {
+        _Pcm8Source,
+        _Pcm16Source,
+        _Pcm24Source,
+        _Pcm32Source,
+        _Float32Source,
+        _Float64Source,
+    };
+
+    // One little endian sample of each source format, widened to the two
+    // formats MusicFile hands out.
+    template <int Source> struct _Sample;
+    template <> struct _Sample<_Pcm8Source>
+    {
+        enum { Width = 1 };
+        static qint16 toInt16(const uchar* p) { return (p[0] - 0x80) * 256; }
+        static float toFloat(const uchar* p) { return (p[0] - 0x80) * (1.0f / 128.0f); }
+    };
+    template <> struct _Sample<_Pcm16Source>
+    {
+        enum { Width = 2 };
+        static qint16 toInt16(const uchar* p) { return qFromLittleEndian<qint16>(p); }
+        static float toFloat(const uchar* p) { return toInt16(p) * (1.0f / 32768.0f); }
+    };
+    template <> struct _Sample<_Pcm24Source>
+    {
+        enum { Width = 3 };
+        static qint32 value(const uchar* p) { return static_cast<qint32>((quint32(p[0]) << 8) | (quint32(p[1]) << 16) | (quint32(p[2]) << 24)) >> 8; }
+        static qint16 toInt16(const uchar* p) { return value(p) >> 8; }
+        static float toFloat(const uchar* p) { return value(p) * (1.0f / 8388608.0f); }
+    };
+    template <> struct _Sample<_Pcm32Source>
+    {
+        enum { Width = 4 };
+        static qint16 toInt16(const uchar* p) { return qFromLittleEndian<qint32>(p) >> 16; }
+        static float toFloat(const uchar* p) { return qFromLittleEndian<qint32>(p) * (1.0f / 2147483648.0f); }
+    };
+    template <> struct _Sample<_Float32Source>
+    {
+        enum { Width = 4 };
+        static float toFloat(const uchar* p) { quint32 v = qFromLittleEndian<quint32>(p); float f; memcpy(&f, &v, sizeof(f)); return f; }
+        static qint16 toInt16(const uchar* p) { qint16 v; float f = toFloat(p); SampleOps::floatToInt16(&f, &v, 1); return v; }
+    };
+    template <> struct _Sample<_Float64Source>
+    {
+        enum { Width = 8 };
+        static float toFloat(const uchar* p) { quint64 v = qFromLittleEndian<quint64>(p); double d; memcpy(&d, &v, sizeof(d)); return static_cast<float>(d); }
+        static qint16 toInt16(const uchar* p) { qint16 v; float f = toFloat(p); SampleOps::floatToInt16(&f, &v, 1); return v; }
+    };
+
+    template <typename Target> struct _To;
+    template <> struct _To<qint16>
+    {
+        template <int Source> static qint16 convert(const uchar* p) { return _Sample<Source>::toInt16(p); }
+    };
+    template <> struct _To<float>
+    {
+        template <int Source> static float convert(const uchar* p) { return _Sample<Source>::toFloat(p); }
+    };
+
+    // Instantiated per source format and channel count, so the inner loop
+    // is fully unrolled over the channels and has no format switch.
+    // Channels == 0 is the fallback for unusual layouts.
+    template <int Source, typename Target, uint Channels>
+    struct _Converter
+    {
+        static void convert(const char* in, char* out, qint64 samples, uint channels)
+        {
+            const uint n = (Channels != 0) ? Channels : channels;
+            const uchar* source = reinterpret_cast<const uchar*>(in);
+            Target* target = reinterpret_cast<Target*>(out);
+            for (qint64 i = 0; i < samples; ++i)
+            {
+                for (uint j = 0; j < n; ++j)
+                {
+                    *target++ = _To<Target>::template convert<Source>(source);
+                    source += _Sample<Source>::Width;
+                }
+            }
+        }
+    };
+
+    // 16-bit to float is the common case, use the vector kernel.
+    template <uint Channels>
+    struct _Converter<_Pcm16Source, float, Channels>
+    {
+        static void convert(const char* in, char* out, qint64 samples, uint channels)
+        {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            SampleOps::int16ToFloat(reinterpret_cast<const qint16*>(in), reinterpret_cast<float*>(out), samples * channels);
+#else
+            const uchar* source = reinterpret_cast<const uchar*>(in);
+            float* target = reinterpret_cast<float*>(out);
+            for (qint64 i = 0; i < samples * channels; ++i, source += 2)
+                target[i] = _Sample<_Pcm16Source>::toFloat(source);
+#endif
+        }
+    };
+
+    template <int Source, typename Target>
+    MusicFile_Wav::ConvertFunction _converterFor(uint channels)
+    {
+        switch (channels)
+        {
+            case 1:
+                return _Converter<Source, Target, 1>::convert;
+            case 2:
+                return _Converter<Source, Target, 2>::convert;
+            default:
+                return _Converter<Source, Target, 0>::convert;
+        }
+    }
+
+    template <typename Target>
+    MusicFile_Wav::ConvertFunction _selectConverter(_SourceFormat source, uint channels)
+    {
+        switch (source)
+        {
+            case _Pcm8Source:
+                return _converterFor<_Pcm8Source, Target>(channels);
+            case _Pcm16Source:
+                return _converterFor<_Pcm16Source, Target>(channels);
+            case _Pcm24Source:
+                return _converterFor<_Pcm24Source, Target>(channels);
+            case _Pcm32Source:
+                return _converterFor<_Pcm32Source, Target>(channels);
+            case _Float32Source:
+                return _converterFor<_Float32Source, Target>(channels);
+            case _Float64Source:
+                return _converterFor<_Float64Source, Target>(channels);
+        }
+        return NULL;
+    }
+
+    // RIFX files store their samples big endian as well.
+    void _swapSamples(char* data, qint64 count, uint width)
+    {
+        for (qint64 i = 0; i < count; ++i, data += width)
+            std::reverse(data, data + width);
+    }
+}
 
 template <typename T>
 inline T FromEndian(MusicFile_Wav::_Endian endian, const T &value)
@@ -74,17 +229,10 @@ bool MusicFile_Wav::_parseHeader()
 
 #undef MAKE_MARKER
 
-    enum
-    {
-        WAVE_FORMAT_PCM = 0x0001,
-        WAVE_FORMAT_IEEE_FLOAT = 0x0003,
-    };
-
     bool done = false;
     int parsestage = 0;
     quint32 file_size;
     quint32 chunk_size;
-    quint16 _bitwidth;
     while (!done)
     {
         quint32 marker;
@@ -131,10 +279,9 @@ bool MusicFile_Wav::_parseHeader()
                         return false;
                     if (chunk_size < 16)
                         return false;
+                    const qint64 chunkEnd = MusicFile::_pos() + chunk_size + (chunk_size & 1);
                     if (!_getFieldFromFile<quint16>(_format))
                         return false;
-                    if (_format != WAVE_FORMAT_PCM)
-                        return false;
                     if (!_getFieldFromFile<quint16>(_channels))
                         return false;
                     if (!_getFieldFromFile<quint32>(_samplerate))
@@ -145,8 +292,32 @@ bool MusicFile_Wav::_parseHeader()
                         return false;
                     if (!_getFieldFromFile<quint16>(_bitwidth))
                         return false;
-                    _bytewidth = (_bitwidth + 7) >> 3;
-                    _blockwidth = _bytewidth * _channels;
+                    if (_format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40)
+                    {
+                        // cbSize, valid bits and channel mask, then the
+                        // subformat GUID which starts with the format tag.
+                        quint16 extraSize;
+                        quint16 validBits;
+                        quint32 channelMask;
+                        if (!_getFieldFromFile<quint16>(extraSize) ||
+                            !_getFieldFromFile<quint16>(validBits) ||
+                            !_getFieldFromFile<quint32>(channelMask) ||
+                            !_getFieldFromFile<quint16>(_format))
+                            return false;
+                    }
+                    if (_format != WAVE_FORMAT_PCM && _format != WAVE_FORMAT_IEEE_FLOAT)
+                        return false;
+                    if (_channels == 0 || _blockalign == 0 || _blockalign % _channels != 0)
+                        return false;
+                    // Samples are stored in containers of blockalign /
+                    // channels bytes, which may be wider than the bits used.
+                    _bytewidth = _blockalign / _channels;
+                    _blockwidth = _blockalign;
+                    if (_format == WAVE_FORMAT_PCM && _bytewidth > 4)
+                        return false;
+                    if (_format == WAVE_FORMAT_IEEE_FLOAT && _bytewidth != 4 && _bytewidth != 8)
+                        return false;
+                    MusicFile::seek(chunkEnd);
                 }
                 break;
             case data_MARKER:
@@ -210,26 +381,18 @@ void MusicFile_Wav::_removeLeadingZeros()
 {
     //qDebug() << Q_FUNC_INFO;
     Q_ASSERT(pos() == 0);
-    qint16* samples = new qint16[channels()];
-    while (MusicFile::_readData(reinterpret_cast<char*>(samples), _blockwidth) == _blockwidth)
+    // unsigned 8-bit PCM is silent at its midpoint
+    const char silence = (_format == WAVE_FORMAT_PCM && _sourceBytewidth == 1) ? '\x80' : '\0';
+    QByteArray samples(_sourceBlockwidth, silence);
+    while (MusicFile::_readData(samples.data(), _sourceBlockwidth) == _sourceBlockwidth)
     {
-        bool isZeros = true;
-        for (uint i = 0; i < _channels; ++i)
-        {
-            if (samples[i] != 0)
-            {
-                isZeros = false;
-                break;
-            }
-        }
-        if (!isZeros)
+        if (samples.count(silence) != samples.size())
             break;
-        _dataBegin += _blockwidth;
-        _dataSize -= _blockwidth;
+        _dataBegin += _sourceBlockwidth;
+        _dataSize -= _sourceBlockwidth;
         --_loopBegin;
         --_loopEnd;
     }
-    delete samples;
     seek(0);
 }
 
@@ -238,11 +401,13 @@ void MusicFile_Wav::_initializeAsRawData()
     //qDebug() << Q_FUNC_INFO;
     _dataBegin = 0;
     _dataSize = _dataEnd = MusicFile::size();
-    _format = 0;
+    _endian = _LittleEndian;
+    _format = WAVE_FORMAT_PCM;
     _channels = 2;
     _samplerate = 44100;
     _bytespersec = 44100 * 2 * 2;
     _blockalign = 4;
+    _bitwidth = 16;
     _bytewidth = 2;
     _blockwidth = _bytewidth * _channels;
 }
@@ -250,6 +415,9 @@ void MusicFile_Wav::_initializeAsRawData()
 MusicFile_Wav::MusicFile_Wav(const MusicData& fileDescription) :
     MusicFile(fileDescription),
     _endian(_LittleEndian),
+    _sourceBytewidth(0),
+    _sourceBlockwidth(0),
+    _convert(NULL),
     _dataBegin(0),
     _dataSize(0),
     _dataEnd(0)
@@ -265,6 +433,11 @@ bool MusicFile_Wav::open(OpenMode mode)
     Q_ASSERT(!(mode & QIODevice::Append));
     if (!_parseHeader())
         _initializeAsRawData();
+    _sourceBytewidth = _bytewidth;
+    _sourceBlockwidth = _blockwidth;
+    _bytewidth = (_sampleFormat == Float32Format) ? 4 : 2;
+    _blockwidth = _bytewidth * _channels;
+    _convert = _converter();
     seek(0);
 
     _removeLeadingZeros();
@@ -273,12 +446,14 @@ bool MusicFile_Wav::open(OpenMode mode)
 
 qint64 MusicFile_Wav::size() const
 {
-    return _dataSize;
+    if (_sourceBlockwidth == 0)
+        return _dataSize;
+    return _dataSize / _sourceBlockwidth * _blockwidth;
 }
 
 bool MusicFile_Wav::seek(qint64 pos)
 {
-    return QIODevice::seek(pos) && MusicFile::_seek(pos + _dataBegin);
+    return QIODevice::seek(pos) && MusicFile::_seek(pos / _blockwidth * _sourceBlockwidth + _dataBegin);
 }
 
 bool MusicFile_Wav::reset()
@@ -292,7 +467,50 @@ qint64 MusicFile_Wav::readData(char* data, qint64 maxSize)
         MusicFile::seek(_dataBegin);
     if (MusicFile::_pos() > _dataEnd)
         MusicFile::seek(_dataEnd);
-    qint64 realMaxSize = qMin(maxSize, _dataEnd - MusicFile::_pos());
-    return MusicFile::readData(data, realMaxSize);
+    if (_convert == NULL)
+    {
+        qint64 realMaxSize = qMin(maxSize, _dataEnd - MusicFile::_pos());
+        return MusicFile::readData(data, realMaxSize);
+    }
+    qint64 samples = qMin(maxSize / _blockwidth, (_dataEnd - MusicFile::_pos()) / _sourceBlockwidth);
+    if (samples <= 0)
+        return 0;
+    _sourceBuffer.resize(samples * _sourceBlockwidth);
+    qint64 result = MusicFile::readData(_sourceBuffer.data(), samples * _sourceBlockwidth);
+    if (result < 0)
+        return result;
+    samples = result / _sourceBlockwidth;
+    if (_endian == _BigEndian)
+        _swapSamples(_sourceBuffer.data(), samples * _channels, _sourceBytewidth);
+    _convert(_sourceBuffer.constData(), data, samples, _channels);
+    return samples * _blockwidth;
+}
+
+MusicFile_Wav::ConvertFunction MusicFile_Wav::_converter() const
+{
+    _SourceFormat source;
+    if (_format == WAVE_FORMAT_IEEE_FLOAT)
+        source = (_sourceBytewidth == 8) ? _Float64Source : _Float32Source;
+    else if (_sourceBytewidth == 1)
+        source = _Pcm8Source;
+    else if (_sourceBytewidth == 2)
+        source = _Pcm16Source;
+    else if (_sourceBytewidth == 3)
+        source = _Pcm24Source;
+    else
+        source = _Pcm32Source;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    // Already in the output format, read straight into the caller's buffer.
+    if (_endian == _LittleEndian)
+    {
+        if (source == _Pcm16Source && _sampleFormat == Int16Format)
+            return NULL;
+        if (source == _Float32Source && _sampleFormat == Float32Format)
+            return NULL;
+    }
+#endif
+    if (_sampleFormat == Float32Format)
+        return _selectConverter<float>(source, _channels);
+    return _selectConverter<qint16>(source, _channels);
 }
 
@@ -21,8 +21,11 @@
 #include "musicplayer.h"
 #include "musicfile_ogg.h"
 #include "musicfile_wav.h"
-#include "musicplayer.h"
-#include "helperfuncs.h"
+#include "audiosink_portaudio.h"
+#include "lockfree.h"
+#include "sampleops.h"
+#include "telemetry.h"
+#include "trace.h"
 
 enum _MusicPlayerError
 {
@@ -30,102 +33,259 @@ enum _MusicPlayerError
     _UnknowFileFormat,
 };
 
+// Control messages from the GUI thread to whoever renders audio.  They are
+// applied at buffer boundaries, in the stream callback while the stream runs
+// and right away on the GUI thread while it is stopped.
+struct _PlayerCommand
+{
+    enum Type
+    {
+        Seek,
+        Volume,
+        GainRamp,
+        SwapSource,
+        Stop,
+    };
+    _PlayerCommand(Type type_ = Stop, qreal value_ = 0.0, qint64 frames_ = 0, ThreadMusicFile* file_ = NULL) :
+        type(type_), value(value_), frames(frames_), file(file_) {}
+    Type type;
+    qreal value;
+    qint64 frames;
+    ThreadMusicFile* file;
+};
+
+// What the callback last handed to the device: the source position of the
+// first frame of the buffer and the time that frame reaches the DAC.  A zero
+// dacTime means the position is not moving.
+struct _PlaybackClock
+{
+    _PlaybackClock(qint64 frames_ = 0, qint64 count_ = 0, PaTime dacTime_ = 0.0) :
+        frames(frames_), count(count_), dacTime(dacTime_) {}
+    qint64 frames;
+    qint64 count;
+    PaTime dacTime;
+};
+
 class _MusicPlayerImpl
 {
     public:
-        bool portaudioInitialized;
+        AudioSink* output;
+        QString outputName;
         PaError portaudioError;
-        PaStream *stream;
+        MusicPlayer* hook;
+        bool running;
+        uint blockwidth;
+
+        // owned by the audio side
+        ThreadMusicFile* file;
         qreal volume;
         qreal targetVolume;
-        MusicPlayer* hook;
+        qreal volumeStep;
+
+        // GUI -> audio
+        LockFreeQueue<_PlayerCommand, 64> commands;
+        SeqLockValue<qint64> seekTarget;
+        QAtomicInt seekPending;
+        SeqLockValue<qreal> volumeTarget;
+        QAtomicInt volumePending;
+
+        // audio -> GUI, sources that were swapped out and must be deleted
+        // outside the callback
+        LockFreeQueue<ThreadMusicFile*, 16> retired;
+        SeqLockValue<_PlaybackClock> clock;
+
+        // only touched by the callback
+        qint64 lastCallback;
+
         _MusicPlayerImpl() :
-            portaudioInitialized(false),
+            output(NULL),
             portaudioError(paNoError),
-            stream(NULL),
+            hook(NULL),
+            running(false),
+            blockwidth(0),
+            file(NULL),
             volume(1.0),
             targetVolume(1.0),
-            hook(NULL)
+            volumeStep(DefaultVolumeStep),
+            seekTarget(0),
+            seekPending(0),
+            volumeTarget(1.0),
+            volumePending(0),
+            lastCallback(0)
         {
             //qDebug() << Q_FUNC_INFO;
-            PaError err = Pa_Initialize();
-            if (err != paNoError)
+        }
+
+        static const qreal DefaultVolumeStep;
+
+        // GUI side
+        bool post(const _PlayerCommand& command)
+        {
+            if (!commands.push(command))
             {
-                portaudioError = err;
-                return;
+                qWarning() << Q_FUNC_INFO << ": command queue is full.";
+                return false;
             }
-            portaudioInitialized = true;
+            if (!running)
+                processCommands();
+            return true;
         }
-        ~_MusicPlayerImpl()
+        void requestSeek(qint64 samples)
         {
-            //qDebug() << Q_FUNC_INFO;
-            if (portaudioInitialized)
+            // Scrubbing only ever leaves one Seek in the queue; the audio side
+            // picks up the latest target when it gets there.
+            seekTarget.store(samples);
+            if (!seekPending.testAndSetOrdered(0, 1))
+                return;
+            if (!post(_PlayerCommand(_PlayerCommand::Seek)))
+                seekPending.fetchAndStoreOrdered(0);
+        }
+        void requestVolume(qreal newVolume)
+        {
+            volumeTarget.store(newVolume);
+            if (!volumePending.testAndSetOrdered(0, 1))
+                return;
+            if (!post(_PlayerCommand(_PlayerCommand::Volume)))
+                volumePending.fetchAndStoreOrdered(0);
+        }
+
+        qint64 audiblePosition(uint samplerate) const
+        {
+            _PlaybackClock c = clock.load();
+            if (c.dacTime == 0.0 || output == NULL)
+                return c.frames;
+            PaTime now = output->time();
+            if (now == 0.0)
+                return c.frames;
+            qint64 position = c.frames + static_cast<qint64>((now - c.dacTime) * samplerate);
+            return qBound(Q_INT64_C(0), position, c.frames + c.count);
+        }
+
+        // audio side
+        void processCommands()
+        {
+            _PlayerCommand command;
+            while (commands.pop(command))
             {
-                PaError err = Pa_Terminate();
-                if (err == paNoError)
-                    portaudioInitialized = false;
-                else
-                    portaudioError = err;
+                switch (command.type)
+                {
+                    case _PlayerCommand::Seek:
+                        {
+                            seekPending.fetchAndStoreOrdered(0);
+                            qint64 target = seekTarget.load();
+                            if (file != NULL)
+                                file->sampleSeek(target);
+                            clock.store(_PlaybackClock(target));
+                        }
+                        break;
+                    case _PlayerCommand::Volume:
+                        volumePending.fetchAndStoreOrdered(0);
+                        targetVolume = volumeTarget.load();
+                        volumeStep = DefaultVolumeStep;
+                        break;
+                    case _PlayerCommand::GainRamp:
+                        targetVolume = command.value;
+                        volumeStep = (command.frames > 0) ? qAbs(targetVolume - volume) / command.frames : 1.0;
+                        if (volumeStep <= 0.0)
+                            volumeStep = DefaultVolumeStep;
+                        break;
+                    case _PlayerCommand::SwapSource:
+                        if (file != NULL && !retired.push(file))
+                            qWarning() << Q_FUNC_INFO << ": retired queue is full.";
+                        file = command.file;
+                        clock.store(_PlaybackClock());
+                        break;
+                    case _PlayerCommand::Stop:
+                        if (file != NULL)
+                            file->sampleSeek(0);
+                        volume = targetVolume;
+                        clock.store(_PlaybackClock());
+                        break;
+                }
             }
         }
-        int streamCallback(const void * /*inputBuffer*/, void *outputBuffer,
-            unsigned long framesPerBuffer,
-            const PaStreamCallbackTimeInfo* /*timeInfo*/,
-            PaStreamCallbackFlags /*statusFlags*/)
+
+        unsigned long render(void *outputBuffer, unsigned long framesPerBuffer, PaTime outputTime, bool realtime)
         {
             //qDebug() << Q_FUNC_INFO << "framesPerBuffer" << framesPerBuffer;
-            Q_ASSERT(hook->_file != NULL);
-            memset(outputBuffer, 0, framesPerBuffer * hook->_file->blockwidth());
-            size_t bufferSamples = hook->_file->sampleRead(static_cast<char*>(outputBuffer), framesPerBuffer);
+            processCommands();
+            if (file == NULL)
+            {
+                // No source yet, keep the device fed with silence.
+                memset(outputBuffer, 0, framesPerBuffer * blockwidth);
+                return framesPerBuffer;
+            }
+            memset(outputBuffer, 0, framesPerBuffer * file->blockwidth());
+            // A sink without a device to keep fed waits for the decoder, so
+            // its output does not depend on how fast that was.
+            if (!realtime)
+                file->waitForData(framesPerBuffer, 1000);
+            qint64 frames = file->samplePos();
+            size_t bufferSamples = file->sampleRead(static_cast<char*>(outputBuffer), framesPerBuffer);
             //qDebug() << Q_FUNC_INFO << "bufferSize" << bufferSize;
+            clock.store(_PlaybackClock(frames, bufferSamples, outputTime));
             if (bufferSamples == 0)
-                return paComplete;
-            qint16 *outBuffer = static_cast<qint16*>(outputBuffer);
+                return 0;
             if (volume == 1.0 && targetVolume == 1.0)
-                return paContinue;
-            for (unsigned long i = 0; i < bufferSamples; ++i)
+                return bufferSamples;
+            if (file->sampleFormat() == MusicFile::Float32Format)
+                volume = SampleOps::applyGainRamp(static_cast<float*>(outputBuffer), bufferSamples, file->channels(), volume, targetVolume, volumeStep);
+            else
+                volume = SampleOps::applyGainRamp(static_cast<qint16*>(outputBuffer), bufferSamples, file->channels(), volume, targetVolume, volumeStep);
+            return bufferSamples;
+        }
+        static unsigned long render(void *outputBuffer, unsigned long framesPerBuffer, PaTime outputTime, bool realtime, void * userData)
+        {
+            TRACE_ZONE("callback");
+            _MusicPlayerImpl* self = static_cast<_MusicPlayerImpl*>(userData);
+            const qint64 begin = Telemetry::now();
+            unsigned long result = self->render(outputBuffer, framesPerBuffer, outputTime, realtime);
+            const qint64 end = Telemetry::now();
+            const uint samplerate = (self->file == NULL) ? 0 : self->file->samplerate();
+            const qint64 expected = (samplerate == 0) ? 0 : static_cast<qint64>(framesPerBuffer) * 1000000 / samplerate;
+            Telemetry::recordCallback(end - begin, (self->lastCallback == 0 || expected == 0) ? 0 : begin - self->lastCallback, expected);
+            self->lastCallback = begin;
+            return result;
+        }
+
+        // Picks the sink named by Playback/Audio Sink, PortAudio unless
+        // configured otherwise.
+        void selectOutput()
+        {
+            QString name;
+            uint bufferFrames;
             {
-                for (size_t j = 0; j < hook->_file->channels(); ++j)
-                {
-                    *outBuffer *= volume;
-                    ++outBuffer;
-                }
-                if (volume == targetVolume)
-                    continue;
-                if (volume < targetVolume)
-                {
-                    if (volume <= targetVolume - 0.0078125)
-                        volume += 0.0078125;
-                    else
-                        volume = targetVolume;
-                }
-                else if (volume > targetVolume)
+                QSettings settings;
+                settings.beginGroup("Playback");
+                name = settings.value("Audio Sink", "PortAudio").toString();
+                bufferFrames = settings.value("Buffer Frames", 0U).toUInt();
+                settings.endGroup();
+            }
+            if (output == NULL || name != outputName)
+            {
+                AudioSink* sink = AudioSinkFactory::createAudioSink(name);
+                if (sink == NULL)
                 {
-                    if (volume >= targetVolume + 0.0078125)
-                        volume -= 0.0078125;
-                    else
-                        volume = targetVolume;
+                    qWarning() << Q_FUNC_INFO << ": unknown audio sink" << name;
+                    name = "PortAudio";
+                    sink = AudioSink_PortAudio::createFunction();
                 }
+                delete output;
+                output = sink;
+                outputName = name;
             }
-            return paContinue;
+            output->setBufferFrames(bufferFrames);
         }
-        static int streamCallback(const void * inputBuffer, void *outputBuffer,
-                unsigned long framesPerBuffer,
-                const PaStreamCallbackTimeInfo* timeInfo,
-                PaStreamCallbackFlags statusFlags,
-                void * userData)
-        {
-            return static_cast<_MusicPlayerImpl*>(userData)->streamCallback(
-                inputBuffer, outputBuffer, framesPerBuffer, timeInfo, statusFlags);
-        }
-} _playerImpl;
+};
+
+const qreal _MusicPlayerImpl::DefaultVolumeStep = 0.0078125;
 
 MusicPlayer::MusicPlayer() :
+    _impl(new _MusicPlayerImpl()),
     _file(NULL),
-    _tickInterval(100)
+    _tickInterval(1000/30)
 {
-    Q_ASSERT(_playerImpl.hook == NULL);
-    _playerImpl.hook = this;
+    _impl->hook = this;
     connect(this, SIGNAL(finish()), this, SLOT(_next()));
     connect(&_timer, SIGNAL(timeout()), this, SLOT(_tick()));
     _setState(StoppedState);
@@ -136,7 +296,9 @@ MusicPlayer::~MusicPlayer()
     //qDebug() << Q_FUNC_INFO;
     pause();
     _unload();
-    _playerImpl.hook = NULL;
+    _collectRetired();
+    delete _impl->output;
+    delete _impl;
 }
 
 void MusicPlayer::_load()
@@ -153,6 +315,7 @@ void MusicPlayer::_load()
             _file = NULL;
             return;
         }
+        _impl->post(_PlayerCommand(_PlayerCommand::SwapSource, 0.0, 0, _file));
         _loop = _file->loop();
         emit totalSamplesChanged(_file->sampleSize());
         emit loopChanged(_loop);
@@ -165,11 +328,21 @@ void MusicPlayer::_unload()
     //qDebug() << Q_FUNC_INFO;
     if (_file)
     {
-        delete _file;
+        // The audio side owns the source once it was handed over; it comes
+        // back through the retired queue.
+        _impl->post(_PlayerCommand(_PlayerCommand::SwapSource));
         _file = NULL;
+        _collectRetired();
     }
 }
 
+void MusicPlayer::_collectRetired()
+{
+    ThreadMusicFile* file;
+    while (_impl->retired.pop(file))
+        delete file;
+}
+
 void MusicPlayer::_next()
 {
     //qDebug() << Q_FUNC_INFO;
@@ -193,47 +366,35 @@ void MusicPlayer::play()
     //qDebug() << Q_FUNC_INFO;
     //qDebug() << Q_FUNC_INFO << "FileName" << _file->fileName();
     _setState(BufferingState);
-    PaDeviceIndex deviceIndex;
-    {
-        QSettings settings;
-        settings.beginGroup("Playback");
-        deviceIndex = settings.value("Output Device", Pa_GetDefaultOutputDevice()).toInt();
-        settings.endGroup();
-    }
-    //qDebug() << Q_FUNC_INFO << "Device name" << QString::fromLocal8Bit(Pa_GetDeviceInfo(deviceIndex)->name);
     if (!_file)
         return;
 //    Q_ASSERT(_file != NULL);
-    PaStreamParameters outputparam;
-    outputparam.device = deviceIndex;
-    outputparam.channelCount = _file->channels();
-    outputparam.sampleFormat = paInt16;
-    outputparam.suggestedLatency = Pa_GetDeviceInfo(deviceIndex)->defaultHighOutputLatency;
-    outputparam.hostApiSpecificStreamInfo = NULL;
-    PaError err = Pa_OpenStream(
-            &_playerImpl.stream,
-            NULL,
-            &outputparam,
+    _impl->selectOutput();
+    if (!_impl->output->open(
+            _file->channels(),
             _file->samplerate(),
-            0,
-            paNoFlag,
-            _MusicPlayerImpl::streamCallback,
-            &_playerImpl);
-    if (err != paNoError)
+            _file->sampleFormat(),
+            _MusicPlayerImpl::render,
+            _impl))
     {
-        _playerImpl.portaudioError = err;
+        _impl->portaudioError = _impl->output->error();
         _setState(ErrorState);
         return;
     }
-    err = Pa_StartStream(_playerImpl.stream);
-    if (err != paNoError)
+    // Give the decoder a head start so playback does not begin with an
+    // underrun; it never blocks once the stream runs.
+    _file->waitForData(_file->samplerate() / 10, 500);
+    _impl->blockwidth = _file->blockwidth();
+    _impl->running = true;
+    if (!_impl->output->start())
     {
-        _playerImpl.portaudioError = err;
+        _impl->running = false;
+        _impl->portaudioError = _impl->output->error();
         _setState(ErrorState);
         return;
     }
     _setState(PlayingState);
-    _timer.start(1000/30);
+    _scheduleTick();
 }
 
 void MusicPlayer::pause()
@@ -241,13 +402,22 @@ void MusicPlayer::pause()
     //qDebug() << Q_FUNC_INFO;
     if (state() != PlayingState)
         return;
-    PaError err = Pa_CloseStream(_playerImpl.stream);
-    if (err != paNoError)
+    // Whatever is still queued in the device is discarded, so resume from
+    // what was actually heard rather than from the decode position.
+    qint64 position = samples();
+    if (!_impl->output->stop())
     {
-        _playerImpl.portaudioError = err;
+        _impl->portaudioError = _impl->output->error();
         _setState(ErrorState);
         return;
     }
+    // The callback is not running any more, so whatever it left in the
+    // queue is ours to apply now.
+    _impl->running = false;
+    _impl->processCommands();
+    _collectRetired();
+    if (_file != NULL && position < _file->sampleSize())
+        _impl->requestSeek(position);
     _setState(PausedState);
     _timer.stop();
 }
@@ -260,15 +430,16 @@ void MusicPlayer::stop()
         return;
     if (s == PlayingState)
     {
-        PaError err = Pa_CloseStream(_playerImpl.stream);
-        if (err != paNoError)
+        if (!_impl->output->stop())
         {
-            _playerImpl.portaudioError = err;
+            _impl->portaudioError = _impl->output->error();
             _setState(ErrorState);
             return;
         }
+        _impl->running = false;
     }
-    _file->sampleSeek(0);
+    _impl->post(_PlayerCommand(_PlayerCommand::Stop));
+    _collectRetired();
     _setState(StoppedState);
     _timer.stop();
 }
@@ -278,29 +449,31 @@ void MusicPlayer::seek(qint64 samples)
     //qDebug() << Q_FUNC_INFO;
     MusicPlayerState s = state();
     if (s == PlayingState || s == PausedState || s == StoppedState)
-        _file->sampleSeek(samples);
+        _impl->requestSeek(samples);
+    if (s == PlayingState)
+        _scheduleTick();
 }
 
 QString MusicPlayer::errorString() const
 {
     //qDebug() << Q_FUNC_INFO;
-    if (_playerImpl.portaudioError < 0)
-        return Pa_GetErrorText(_playerImpl.portaudioError);
-    switch (_playerImpl.portaudioError)
+    if (_impl->portaudioError < 0)
+        return (_impl->output == NULL) ? QString(Pa_GetErrorText(_impl->portaudioError)) : _impl->output->errorString();
+    switch (_impl->portaudioError)
     {
         case _FileNotFounded:
             return "File not founded.";
         case _UnknowFileFormat:
             return "Unable to identify file format.";
         default:
-            return QString("Unknow error %1").arg(_playerImpl.portaudioError);
+            return QString("Unknow error %1").arg(_impl->portaudioError);
     }
 }
 
 MusicPlayerErrorType MusicPlayer::errorType() const
 {
     //qDebug() << Q_FUNC_INFO;
-    switch (_playerImpl.portaudioError)
+    switch (_impl->portaudioError)
     {
         case paNoError:
             return NoError;
@@ -373,11 +546,38 @@ void MusicPlayer::_setState(MusicPlayerState newState)
     emit stateChanged(newState, oldState);
 }
 
+qint64 MusicPlayer::samples() const
+{
+    if (_file == NULL)
+        return 0;
+    return _impl->audiblePosition(_file->samplerate());
+}
+
+void MusicPlayer::setTickInterval(uint msec)
+{
+    _tickInterval = msec;
+    if (state() == PlayingState)
+        _tick();
+}
+
+void MusicPlayer::_scheduleTick()
+{
+    if (_file == NULL)
+        return;
+    // Wake up for the display at the requested rate, but always in time for
+    // the end of the track.  A zero interval means nobody is watching, so
+    // only check once a second.
+    qint64 remainMsec = (_file->sampleSize() - samples()) * 1000 / _file->samplerate();
+    qint64 interval = (_tickInterval == 0) ? remainMsec : qMin<qint64>(_tickInterval, remainMsec);
+    _timer.start(qBound<qint64>(10, interval, 1000));
+}
+
 void MusicPlayer::_tick()
 {
+    _collectRetired();
     if (_file == NULL)
         return;
-    qint64 samplePos = _file->samplePos();
+    qint64 samplePos = samples();
     //qDebug() << Q_FUNC_INFO << _file->bufferSize();
     qint64 remainSample = _file->sampleSize() - samplePos;
     if (remainSample <= 1024 && !_emitAboutToFinish)
@@ -396,33 +596,26 @@ void MusicPlayer::_tick()
     if (remainSample == 0)
     {
         emit finish();
+        return;
     }
+    if (state() == PlayingState)
+        _scheduleTick();
 }
 
 qreal MusicPlayer::volume() const
 {
     //qDebug() << Q_FUNC_INFO;
-    return _playerImpl.targetVolume;
+    return _impl->volumeTarget.load();
 }
 
 void MusicPlayer::setVolume(qreal newVolume)
 {
-    _playerImpl.targetVolume = newVolume;
-}
-
-int MusicPlayer::deviceCount() const
-{
-    return Pa_GetDeviceCount();
-}
-
-int MusicPlayer::defaultDevice() const
-{
-    return Pa_GetDefaultOutputDevice();
+    _impl->requestVolume(newVolume);
 }
 
-QString MusicPlayer::device(int id) const
+void MusicPlayer::fadeTo(qreal newVolume, int msec)
 {
-    const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(id);
-    const PaHostApiInfo* apiInfo = Pa_GetHostApiInfo(deviceInfo->hostApi);
-    return QString("%1 (%2)").arg(QString::fromLocal8Bit(deviceInfo->name)).arg(QString::fromLocal8Bit(apiInfo->name));
+    qint64 frames = static_cast<qint64>(msec) * ((_file == NULL) ? 44100 : _file->samplerate()) / 1000;
+    _impl->volumeTarget.store(newVolume);
+    _impl->post(_PlayerCommand(_PlayerCommand::GainRamp, newVolume, frames));
 }
@@ -14,10 +14,87 @@
  * You should have received a copy of the GNU General Public License
  * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <QSettings>
 #include "musicsaver.h"
+#include "loopmusicfile.h"
 
-MusicSaver::MusicSaver()
+MusicSaver::MusicSaver() :
+    _progress(NULL),
+    _progressData(NULL)
 {
+    QSettings settings;
+    settings.beginGroup("Export");
+    _loopTags = settings.value("Loop Tags", false).toBool();
+    settings.endGroup();
+}
+
+QString MusicSaver::trackFileName(const MusicData& musicData, const QString& suffix)
+{
+    // Built by concatenation; titles may contain '%' and must not meet arg().
+    QString name = QString("%1.").arg(musicData.trackNumber(), 2, 10, QLatin1Char('0'))
+        + musicData.title() + suffix;
+    const QString invalid("/\\:*?\"<>|");
+    for (int i = 0; i < name.size(); ++i)
+    {
+        if (invalid.contains(name.at(i)) || name.at(i) < QLatin1Char(' '))
+            name[i] = QLatin1Char('_');
+    }
+    return name;
+}
+
+MusicSaver::~MusicSaver()
+{
+}
+
+void MusicSaver::setLoopCache(LoopCache* cache)
+{
+    _loopCache = cache;
+}
+
+void MusicSaver::prepare(LoopMusicFile& musicFile) const
+{
+    if (_loopTags)
+        musicFile.setFadeoutTime(0);
+    if (_loopCache.data() != NULL)
+        musicFile.setLoopCache(_loopCache.data());
+    else if (!_loopTags && musicFile.totalLoop() > 1)
+        musicFile.setLoopCache(new LoopCache());
+}
+
+bool MusicSaver::reportProgress(qint64 done, qint64 total)
+{
+    if (_progress == NULL || _progress(done, total, _progressData))
+        return true;
+    setErrorString(QObject::tr("Canceled."));
+    return false;
+}
+
+MusicSaverJob::MusicSaverJob(MusicSaver* saver, const QString& filename, const MusicData& musicData, uint loop, QObject* parent) :
+    Job(ExportPriority, parent),
+    _saver(saver),
+    _fileName(filename),
+    _musicData(musicData),
+    _loop(loop)
+{
+    _saver->setProgressFunction(_progress, this);
+}
+
+MusicSaverJob::~MusicSaverJob()
+{
+    delete _saver;
+}
+
+bool MusicSaverJob::run()
+{
+    if (_saver->save(_fileName, _musicData, _loop))
+        return true;
+    setErrorString(_saver->errorString());
+    return false;
+}
+
+bool MusicSaverJob::_progress(qint64 done, qint64 total, void* userData)
+{
+    return static_cast<MusicSaverJob*>(userData)->setProgress(done, total);
 }
 
 QHash<QString, MusicSaverFactory::CreateFunction> MusicSaverFactory::functionHash;
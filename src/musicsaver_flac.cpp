@@ -15,67 +15,196 @@
  * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <QFile>
+#include <QSettings>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedData>
+#include <QCryptographicHash>
+#include <QtEndian>
 #include <FLAC/metadata.h>
 #include <FLAC/stream_encoder.h>
 #include "musicsaver_flac.h"
 #include "loopmusicfile.h"
+#include "sampleops.h"
+
+// A track is cut into segments of whole blocks which are encoded in parallel,
+// each by its own libFLAC encoder, on the JobScheduler and on the saving
+// thread.  libFLAC numbers the frames of every segment from 0, so the frame
+// headers are renumbered as they come out; the rest of a frame does not
+// depend on its position.  The saving thread writes the segments in order,
+// hashes their samples for the MD5, and fixes STREAMINFO at the end.  No
+// segment is claimed more than a window ahead of the one being written, so a
+// slow segment holds back a bounded number of finished ones.
 
 namespace {
-    FLAC__StreamEncoderWriteStatus _write(const FLAC__StreamEncoder* /*encoder*/,
-                                          const FLAC__byte buffer[],
-                                          size_t bytes, unsigned /*samples*/,
-                                          unsigned /*current_frame*/, void *client_data)
+    // About 6 seconds at 44100 Hz, rounded down to whole blocks.
+    const qint64 SegmentSamples = 262144;
+    const qint64 BufferSamples = 65536;
+
+    struct Crc
     {
-        QFile* file = reinterpret_cast<QFile*>(client_data);
-        if (file->write(reinterpret_cast<const char*>(buffer), bytes))
-            return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
-        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
-    }
+        quint8 crc8[256];
+        quint16 crc16[256];
+        Crc()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                quint8 c8 = i;
+                quint16 c16 = i << 8;
+                for (int j = 0; j < 8; ++j)
+                {
+                    c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : (c8 << 1);
+                    c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : (c16 << 1);
+                }
+                crc8[i] = c8;
+                crc16[i] = c16;
+            }
+        }
+    };
+    const Crc crc;
 
-    FLAC__StreamEncoderSeekStatus _seek(const FLAC__StreamEncoder* /*encoder*/,
-                                        FLAC__uint64 absolute_byte_offset,
-                                        void *client_data)
+    // Length of the UTF-8 style coded frame number that starts with first.
+    int _codedLength(uchar first)
     {
-        QFile* file = reinterpret_cast<QFile*>(client_data);
-        if (file->seek(absolute_byte_offset))
-            return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
-        return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+        if (first < 0x80)
+            return 1;
+        for (int length = 2; length <= 6; ++length)
+        {
+            const uchar mask = 0xff << (7 - length);
+            if ((first & mask) == static_cast<uchar>(mask << 1))
+                return length;
+        }
+        return 0;
     }
 
-    FLAC__StreamEncoderTellStatus _tell(const FLAC__StreamEncoder* /*encoder*/,
-                                        FLAC__uint64 *absolute_byte_offset,
-                                        void *client_data)
+    void _appendCoded(QByteArray& out, quint32 value)
     {
-        QFile* file = reinterpret_cast<QFile*>(client_data);
-        *absolute_byte_offset = file->pos();
-        return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+        if (value < 0x80)
+        {
+            out.append(static_cast<char>(value));
+            return;
+        }
+        const int length = (value < 0x800) ? 2 : (value < 0x10000) ? 3 : (value < 0x200000) ? 4 : (value < 0x4000000) ? 5 : 6;
+        out.append(static_cast<char>((0xff00 >> length) | (value >> (6 * (length - 1)))));
+        for (int i = length - 2; i >= 0; --i)
+            out.append(static_cast<char>(0x80 | ((value >> (6 * i)) & 0x3f)));
     }
-}
 
-bool MusicSaver_Flac::save(const QString& filename, MusicData musicData, uint loop)
-{
-    //qDebug() << Q_FUNC_INFO;
+    // Appends a fixed blocksize frame to out as frame number.
+    bool _appendFrame(QByteArray& out, const uchar* frame, size_t bytes, quint32 number)
+    {
+        if (bytes < 8 || frame[0] != 0xff || frame[1] != 0xf8)
+            return false;
+        const int numberLength = _codedLength(frame[4]);
+        if (numberLength == 0)
+            return false;
+        const int blockCode = frame[2] >> 4;
+        const int rateCode = frame[2] & 0xf;
+        const int extra = ((blockCode == 6) ? 1 : (blockCode == 7) ? 2 : 0)
+            + ((rateCode == 12) ? 1 : (rateCode == 13 || rateCode == 14) ? 2 : 0);
+        const size_t header = 4 + numberLength + extra;
+        if (bytes < header + 3)
+            return false;
 
-    LoopMusicFile musicFile(musicData, loop);
+        const int begin = out.size();
+        out.append(reinterpret_cast<const char*>(frame), 4);
+        _appendCoded(out, number);
+        out.append(reinterpret_cast<const char*>(frame) + 4 + numberLength, extra);
+        quint8 c8 = 0;
+        for (int i = begin; i < out.size(); ++i)
+            c8 = crc.crc8[c8 ^ static_cast<uchar>(out.at(i))];
+        out.append(static_cast<char>(c8));
+        out.append(reinterpret_cast<const char*>(frame) + header + 1, bytes - header - 3);
+        quint16 c16 = 0;
+        const uchar* data = reinterpret_cast<const uchar*>(out.constData());
+        for (int i = begin; i < out.size(); ++i)
+            c16 = (c16 << 8) ^ crc.crc16[(c16 >> 8) ^ data[i]];
+        out.append(static_cast<char>(c16 >> 8));
+        out.append(static_cast<char>(c16));
+        return true;
+    }
 
-    if (!musicFile.open(QIODevice::ReadOnly))
+    struct Segment
     {
-        setErrorString(musicFile.errorString());
-        return false;
-    }
+        Segment() : done(false), firstFrame(0), minFrameSize(0), maxFrameSize(0) {}
+        bool done;
+        quint32 firstFrame;
+        // "fLaC" and the metadata blocks; only the first segment keeps them.
+        QByteArray header;
+        QByteArray frames;
+        quint32 minFrameSize;
+        quint32 maxFrameSize;
+        // the samples as STREAMINFO's MD5 sees them, signed little endian
+        QByteArray pcm;
+    };
 
-    QFile file(filename);
-    if (!file.open(QIODevice::WriteOnly))
+    struct Export : public QSharedData
     {
-        setErrorString(file.errorString());
-        return false;
-    }
+        Export(const MusicData& musicData_, uint loop_) :
+            musicData(musicData_),
+            loop(loop_),
+            loopTags(false),
+            next(0),
+            written(0),
+            window(2),
+            failed(false),
+            stop(0),
+            encoded(0)
+        {
+        }
 
-    quint64 totalSize = musicFile.sampleSize() * musicFile.blockwidth();
-    if (totalSize > (Q_UINT64_C(4294967295) - Q_UINT64_C(36)))
+        MusicData musicData;
+        uint loop;
+        // filled by the saving thread's open(), before any segment starts
+        QExplicitlySharedDataPointer<LoopCache> loopCache;
+        // the loop is rendered once, without fade, and tagged
+        bool loopTags;
+        qint64 loopBegin;
+        qint64 loopLength;
+        int level;
+        bool verify;
+        uint blocksize;
+        qint64 totalSamples;
+        qint64 segmentSamples;
+
+        QMutex mutex;
+        // signaled whenever a segment is done or written, or the export failed
+        QWaitCondition changed;
+        int next;
+        // segments before written are in the file; next stays below
+        // written + window
+        int written;
+        int window;
+        QVector<Segment> segments;
+        bool failed;
+        QString errorString;
+
+        // read without the mutex by the encoding loops
+        QAtomicInt stop;
+        QAtomicInt encoded;
+    };
+
+    FLAC__StreamEncoderWriteStatus _write(const FLAC__StreamEncoder* /*encoder*/,
+                                          const FLAC__byte buffer[],
+                                          size_t bytes, unsigned samples,
+                                          unsigned current_frame, void *client_data)
     {
-        setErrorString(QObject::tr("Repeat value is too large."));
-        return false;
+        Segment* segment = reinterpret_cast<Segment*>(client_data);
+        if (samples == 0)
+        {
+            segment->header.append(reinterpret_cast<const char*>(buffer), bytes);
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+        }
+        const int before = segment->frames.size();
+        if (!_appendFrame(segment->frames, buffer, bytes, segment->firstFrame + current_frame))
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+        const quint32 frameSize = segment->frames.size() - before;
+        if (segment->minFrameSize == 0 || frameSize < segment->minFrameSize)
+            segment->minFrameSize = frameSize;
+        if (frameSize > segment->maxFrameSize)
+            segment->maxFrameSize = frameSize;
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
     }
 
     struct StreamEncoder
@@ -83,95 +212,333 @@ bool MusicSaver_Flac::save(const QString& filename, MusicData musicData, uint lo
         FLAC__StreamEncoder *v;
         StreamEncoder(): v(FLAC__stream_encoder_new()) {}
         ~StreamEncoder() { FLAC__stream_encoder_delete(v); }
-    } encoder;
+    };
 
-    if (!encoder.v)
-        return false;
+    struct MetaData
+    {
+        FLAC__StreamMetadata *v;
+        MetaData(): v(FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT)) {}
+        ~MetaData() { FLAC__metadata_object_delete(v); }
+    };
 
-    if (!FLAC__stream_encoder_set_verify(encoder.v, true) ||
-        !FLAC__stream_encoder_set_compression_level(encoder.v, 1) ||
-        !FLAC__stream_encoder_set_channels(encoder.v, musicFile.channels()) ||
-        !FLAC__stream_encoder_set_bits_per_sample(encoder.v, musicFile.bytewidth() << 3) ||
-        !FLAC__stream_encoder_set_sample_rate(encoder.v, musicFile.samplerate()) ||
-        !FLAC__stream_encoder_set_total_samples_estimate(encoder.v, musicFile.sampleSize()))
+    bool _addComment(MetaData& metadata, const char* name, qint64 value)
     {
-        return false;
+        FLAC__StreamMetadata_VorbisComment_Entry entry;
+        return FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, name, QByteArray::number(value).constData()) &&
+            FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false);
     }
 
-    FLAC__StreamMetadata_VorbisComment_Entry entry;
+    bool _addComments(MetaData& metadata, const Export* shared)
+    {
+        const MusicData& musicData = shared->musicData;
+        FLAC__StreamMetadata_VorbisComment_Entry entry;
+        if (metadata.v != NULL && shared->loopTags &&
+            (!_addComment(metadata, "LOOPSTART", shared->loopBegin) || !_addComment(metadata, "LOOPLENGTH", shared->loopLength)))
+        {
+            return false;
+        }
+        return metadata.v != NULL &&
+            FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "TITLE", musicData.title().toUtf8().data()) &&
+            FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) &&
+            FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "ALBUM", musicData.album().toUtf8().data()) &&
+            FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) &&
+            FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "ARTIST", musicData.artist().toUtf8().data()) &&
+            FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) &&
+            FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "TRACKNUMBER", QString::number(musicData.trackNumber()).toUtf8().data()) &&
+            FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) &&
+            FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "TRACKTOTAL", QString::number(musicData.totalTrackNumber()).toUtf8().data()) &&
+            FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false);
+    }
 
-    struct MetaData
+    QString _encoderError(const StreamEncoder& encoder)
     {
-        FLAC__StreamMetadata *v;
-        MetaData(): v(FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT)) {}
-        ~MetaData() { FLAC__metadata_object_delete(v); }
-    } metadata;
+        return QObject::tr("FLAC encoder error: %1.").arg(FLAC__stream_encoder_get_resolved_state_string(encoder.v));
+    }
 
-    if (metadata.v == NULL)
+    bool _encodeSegment(Export* shared, int index, Segment& segment, QString& errorString)
     {
-        return false;
+        LoopMusicFile musicFile(shared->musicData, shared->loop);
+        if (shared->loopTags)
+            musicFile.setFadeoutTime(0);
+        if (shared->loopCache.data() != NULL)
+            musicFile.setLoopCache(shared->loopCache.data());
+        if (!musicFile.open(QIODevice::ReadOnly))
+        {
+            errorString = musicFile.errorString();
+            return false;
+        }
+
+        const qint64 begin = index * shared->segmentSamples;
+        const qint64 end = qMin(begin + shared->segmentSamples, shared->totalSamples);
+        segment.firstFrame = begin / shared->blocksize;
+
+        StreamEncoder encoder;
+        if (!encoder.v)
+            return false;
+
+        if (!FLAC__stream_encoder_set_verify(encoder.v, shared->verify) ||
+            !FLAC__stream_encoder_set_compression_level(encoder.v, shared->level) ||
+            !FLAC__stream_encoder_set_blocksize(encoder.v, shared->blocksize) ||
+            !FLAC__stream_encoder_set_do_md5(encoder.v, false) ||
+            !FLAC__stream_encoder_set_channels(encoder.v, musicFile.channels()) ||
+            !FLAC__stream_encoder_set_bits_per_sample(encoder.v, musicFile.bytewidth() << 3) ||
+            !FLAC__stream_encoder_set_sample_rate(encoder.v, musicFile.samplerate()) ||
+            !FLAC__stream_encoder_set_total_samples_estimate(encoder.v, (index == 0) ? shared->totalSamples : end - begin))
+        {
+            return false;
+        }
+
+        MetaData metadata;
+        if (index == 0 && (!_addComments(metadata, shared) || !FLAC__stream_encoder_set_metadata(encoder.v, &metadata.v, 1)))
+            return false;
+
+        FLAC__StreamEncoderInitStatus init_status = FLAC__stream_encoder_init_stream(encoder.v, _write, NULL, NULL, NULL, &segment);
+        if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+        {
+            //qDebug() << Q_FUNC_INFO << FLAC__StreamEncoderInitStatusString[init_status];
+            return false;
+        }
+        if (index != 0)
+            segment.header.clear();
+
+        QVector<FLAC__int32> pcm(BufferSamples * musicFile.channels());
+        QByteArray buffer(BufferSamples * musicFile.blockwidth(), '\0');
+        segment.pcm.reserve((end - begin) * musicFile.blockwidth());
+
+        if (!musicFile.sampleSeek(begin))
+        {
+            errorString = QObject::tr("Cannot seek to sample %1.").arg(begin);
+            return false;
+        }
+        for (qint64 pos = begin; pos < end; )
+        {
+            if (static_cast<int>(shared->stop) != 0)
+                return false;
+            const qint64 need = musicFile.sampleRead(buffer.data(), qMin(BufferSamples, end - pos));
+            if (need <= 0)
+            {
+                errorString = QObject::tr("Unexpected end of data.");
+                return false;
+            }
+            SampleOps::int16ToInt32(reinterpret_cast<const qint16*>(buffer.constData()), pcm.data(), need * musicFile.channels());
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+            qint16* samples = reinterpret_cast<qint16*>(buffer.data());
+            for (qint64 i = 0; i < need * musicFile.channels(); ++i)
+                samples[i] = qToLittleEndian(samples[i]);
+#endif
+            segment.pcm.append(buffer.constData(), need * musicFile.blockwidth());
+            if (!FLAC__stream_encoder_process_interleaved(encoder.v, pcm.constData(), need))
+            {
+                errorString = _encoderError(encoder);
+                return false;
+            }
+            pos += need;
+            shared->encoded.fetchAndAddRelaxed(need);
+        }
+        if (!FLAC__stream_encoder_finish(encoder.v))
+        {
+            errorString = _encoderError(encoder);
+            return false;
+        }
+        return true;
     }
 
-    if (!FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "TITLE", musicData.title().toUtf8().data()) ||
-        !FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) ||
-        !FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "ALBUM", musicData.album().toUtf8().data()) ||
-        !FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) ||
-        !FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "ARTIST", musicData.artist().toUtf8().data()) ||
-        !FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) ||
-        !FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "TRACKNUMBER", QString::number(musicData.trackNumber()).toUtf8().data()) ||
-        !FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) ||
-        !FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, "TRACKTOTAL", QString::number(musicData.totalTrackNumber()).toUtf8().data()) ||
-        !FLAC__metadata_object_vorbiscomment_append_comment(metadata.v, entry, false) ||
-        !FLAC__stream_encoder_set_metadata(encoder.v, &metadata.v, 1))
+    // Claims the next segment and encodes it; false once none is left.  When
+    // the window is full it returns false at once, or with wait, true after
+    // waiting a while for the writer.
+    bool _encodeNext(Export* shared, bool wait)
     {
-        return false;
+        int index;
+        {
+            QMutexLocker locker(&shared->mutex);
+            if (shared->failed || shared->next >= shared->segments.size())
+                return false;
+            if (shared->next >= shared->written + shared->window)
+            {
+                if (!wait)
+                    return false;
+                shared->changed.wait(&shared->mutex, 100);
+                return true;
+            }
+            index = shared->next++;
+        }
+        Segment segment;
+        QString errorString;
+        const bool success = _encodeSegment(shared, index, segment, errorString);
+        QMutexLocker locker(&shared->mutex);
+        if (success)
+        {
+            segment.done = true;
+            shared->segments[index] = segment;
+        }
+        else if (!shared->failed)
+        {
+            shared->failed = true;
+            shared->stop.fetchAndStoreRelease(1);
+            shared->errorString = errorString.isEmpty() ? QObject::tr("Cannot encode FLAC.") : errorString;
+        }
+        shared->changed.wakeAll();
+        return true;
     }
 
-    FLAC__StreamEncoderInitStatus init_status = FLAC__stream_encoder_init_stream(encoder.v, _write, _seek, _tell, NULL, &file);
-    if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+    class SegmentJob : public Job
     {
-        //qDebug() << Q_FUNC_INFO << FLAC__StreamEncoderInitStatusString[init_status];
-        return false;
+        public:
+            SegmentJob(Export* shared) : Job(ExportPriority), _shared(shared) {}
+        protected:
+            virtual bool run()
+            {
+                while (!isCanceled() && _encodeNext(_shared.data(), true))
+                    ;
+                return true;
+            }
+        private:
+            QExplicitlySharedDataPointer<Export> _shared;
+    };
+
+    uint _blocksize(int level)
+    {
+        StreamEncoder encoder;
+        if (!encoder.v || !FLAC__stream_encoder_set_compression_level(encoder.v, level))
+            return 4096;
+        return FLAC__stream_encoder_get_blocksize(encoder.v);
     }
 
-    const qint64 bufferSample = 65536;
+    void _put24(QByteArray& data, int pos, quint32 value)
+    {
+        data[pos] = static_cast<char>(value >> 16);
+        data[pos + 1] = static_cast<char>(value >> 8);
+        data[pos + 2] = static_cast<char>(value);
+    }
+}
 
-    struct PCM
+bool MusicSaver_Flac::save(const QString& filename, MusicData musicData, uint loop)
+{
+    //qDebug() << Q_FUNC_INFO;
+
+    LoopMusicFile musicFile(musicData, renderLoops(loop));
+    prepare(musicFile);
+
+    if (!musicFile.open(QIODevice::ReadOnly))
     {
-        FLAC__int32 *v;
-        PCM(size_t size): v(new FLAC__int32[size]) {}
-        ~PCM() { delete [] v; }
-    } pcm(bufferSample * musicFile.channels());
+        setErrorString(musicFile.errorString());
+        return false;
+    }
 
-    if (pcm.v == NULL)
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        setErrorString(file.errorString());
         return false;
+    }
 
-    struct Buffer
+    quint64 totalSize = musicFile.sampleSize() * musicFile.blockwidth();
+    if (totalSize > (Q_UINT64_C(4294967295) - Q_UINT64_C(36)))
     {
-        char *v;
-        Buffer(size_t size): v(new char[size]) {}
-        ~Buffer() { delete [] v; }
-    } buffer(bufferSample * musicFile.blockwidth());
+        setErrorString(QObject::tr("Repeat value is too large."));
+        return false;
+    }
 
-    //qDebug() << Q_FUNC_INFO << "bufferSample * musicFile.blockwidth() = " << bufferSample * musicFile.blockwidth();
+    QExplicitlySharedDataPointer<Export> shared(new Export(musicData, renderLoops(loop)));
+    shared->loopTags = loopTags();
+    shared->loopCache = musicFile.loopCache();
+    shared->loopBegin = musicFile.loopBegin();
+    shared->loopLength = musicFile.loopEnd() - musicFile.loopBegin();
+    {
+        QSettings settings;
+        settings.beginGroup("Export");
+        shared->level = qBound(0, settings.value("FLAC Compression Level", 1).toInt(), 8);
+        shared->verify = settings.value("FLAC Verify", true).toBool();
+        settings.endGroup();
+    }
+    shared->blocksize = _blocksize(shared->level);
+    shared->totalSamples = musicFile.sampleSize();
+    shared->segmentSamples = qMax<qint64>(1, SegmentSamples / shared->blocksize) * shared->blocksize;
+    shared->segments.resize(qMax<qint64>(1, (shared->totalSamples + shared->segmentSamples - 1) / shared->segmentSamples));
+    shared->window = qMax(2, 2 * JobScheduler::workerCount());
 
-    if (buffer.v == NULL)
-        return false;
+    const int helpers = qMin(JobScheduler::workerCount(), shared->segments.size() - 1);
+    for (int i = 0; i < helpers; ++i)
+    {
+        Job* job = new SegmentJob(shared.data());
+        JobScheduler::submit(job);
+    }
 
-    musicFile.sampleSeek(0);
-    size_t need;
-    qint16 *outBuffer = reinterpret_cast<qint16*>(buffer.v);
-    while (need = musicFile.sampleRead(buffer.v, bufferSample), need > 0)
+    quint32 minFrameSize = 0;
+    quint32 maxFrameSize = 0;
+    Segment first;
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    int written = 0;
+    bool success = true;
+    while (success && written < shared->segments.size())
     {
-        for (size_t i = 0; i < need * musicFile.channels(); ++i)
+        const bool claimed = _encodeNext(shared.data(), false);
+        Segment segment;
         {
-            pcm.v[i] = outBuffer[i];
+            QMutexLocker locker(&shared->mutex);
+            if (!claimed && !shared->failed && !shared->segments.at(written).done)
+                shared->changed.wait(&shared->mutex, 100);
+            if (shared->failed)
+            {
+                setErrorString(shared->errorString);
+                success = false;
+                break;
+            }
+            if (shared->segments.at(written).done)
+                qSwap(segment, shared->segments[written]);
         }
-        if (!FLAC__stream_encoder_process_interleaved(encoder.v, pcm.v, need))
+        if (segment.done)
         {
-            return false;
+            if (written == 0)
+            {
+                first = segment;
+                success = first.header.size() >= 42 && file.write(first.header) == first.header.size();
+                first.frames.clear();
+                first.pcm.clear();
+            }
+            success = success && file.write(segment.frames) == segment.frames.size();
+            md5.addData(segment.pcm);
+            if (!success)
+                setErrorString(file.errorString());
+            if (minFrameSize == 0 || segment.minFrameSize < minFrameSize)
+                minFrameSize = segment.minFrameSize;
+            maxFrameSize = qMax(maxFrameSize, segment.maxFrameSize);
+            ++written;
+            QMutexLocker locker(&shared->mutex);
+            shared->written = written;
+            shared->changed.wakeAll();
         }
+        success = success && reportProgress(static_cast<int>(shared->encoded), shared->totalSamples);
+    }
+
+    if (!success)
+    {
+        QMutexLocker locker(&shared->mutex);
+        shared->failed = true;
+        shared->stop.fetchAndStoreRelease(1);
+        shared->changed.wakeAll();
+    }
+    else
+    {
+        // STREAMINFO follows "fLaC" and its block header.
+        const QByteArray digest = md5.result();
+        QByteArray streamInfo = first.header.mid(8, 34);
+        _put24(streamInfo, 4, minFrameSize);
+        _put24(streamInfo, 7, maxFrameSize);
+        streamInfo[13] = static_cast<char>((streamInfo.at(13) & 0xf0) | ((shared->totalSamples >> 32) & 0x0f));
+        for (int i = 0; i < 4; ++i)
+            streamInfo[14 + i] = static_cast<char>(shared->totalSamples >> (24 - 8 * i));
+        streamInfo.replace(18, 16, digest);
+        success = file.seek(8) && file.write(streamInfo) == streamInfo.size();
+        if (!success)
+            setErrorString(file.errorString());
+    }
+
+    if (!success)
+    {
+        file.close();
+        file.remove();
+        return false;
     }
-    FLAC__stream_encoder_finish(encoder.v);
     return true;
 }
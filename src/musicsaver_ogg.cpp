@@ -0,0 +1,262 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QFile>
+#include <QList>
+#include <QtEndian>
+#include <vorbis/codec.h>
+#include "musicsaver_ogg.h"
+#include "musicfile.h"
+
+namespace {
+    const long ReadSize = 65536;
+
+    // The track as stored, with the archive's decoder applied.
+    class RawMusicFile : public MusicFile
+    {
+        public:
+            RawMusicFile(const MusicData& musicData) : MusicFile(musicData) {}
+    };
+
+    struct SyncState
+    {
+        ogg_sync_state v;
+        SyncState() { ogg_sync_init(&v); }
+        ~SyncState() { ogg_sync_clear(&v); }
+    };
+
+    struct StreamState
+    {
+        ogg_stream_state v;
+        bool initialized;
+        StreamState() : initialized(false) {}
+        ~StreamState() { if (initialized) ogg_stream_clear(&v); }
+        void init(int serial) { ogg_stream_init(&v, serial); initialized = true; }
+    };
+
+    struct Vorbis
+    {
+        vorbis_info info;
+        vorbis_comment comment;
+        Vorbis() { vorbis_info_init(&info); vorbis_comment_init(&comment); }
+        ~Vorbis() { vorbis_comment_clear(&comment); vorbis_info_clear(&info); }
+    };
+
+    bool _writePage(QFile& file, const ogg_page& page)
+    {
+        return file.write(reinterpret_cast<const char*>(page.header), page.header_len) == page.header_len
+            && file.write(reinterpret_cast<const char*>(page.body), page.body_len) == page.body_len;
+    }
+
+    // Keeps the comments the track came with, except those replaced here.
+    void _buildComments(vorbis_comment* out, const vorbis_comment& in, const MusicData& musicData)
+    {
+        QList<QPair<QByteArray, QByteArray> > tags;
+        tags << qMakePair(QByteArray("TITLE"), musicData.title().toUtf8())
+            << qMakePair(QByteArray("ALBUM"), musicData.album().toUtf8())
+            << qMakePair(QByteArray("ARTIST"), musicData.artist().toUtf8())
+            << qMakePair(QByteArray("TRACKNUMBER"), QByteArray::number(musicData.trackNumber()))
+            << qMakePair(QByteArray("TRACKTOTAL"), QByteArray::number(musicData.totalTrackNumber()));
+        if (musicData.loop() && musicData.loopEnd() > musicData.loopBegin())
+        {
+            tags << qMakePair(QByteArray("LOOPSTART"), QByteArray::number(musicData.loopBegin()))
+                << qMakePair(QByteArray("LOOPLENGTH"), QByteArray::number(musicData.loopEnd() - musicData.loopBegin()));
+        }
+
+        for (int i = 0; i < in.comments; ++i)
+        {
+            const QByteArray comment(in.user_comments[i], in.comment_lengths[i]);
+            const QByteArray name = comment.left(comment.indexOf('=')).toUpper();
+            bool replaced = false;
+            for (int j = 0; j < tags.size() && !replaced; ++j)
+                replaced = (name == tags.at(j).first);
+            if (!replaced)
+                vorbis_comment_add(out, comment.constData());
+        }
+        for (int i = 0; i < tags.size(); ++i)
+            vorbis_comment_add_tag(out, tags.at(i).first.constData(), tags.at(i).second.constData());
+    }
+
+    void _append32(QByteArray& data, quint32 value)
+    {
+        value = qToLittleEndian(value);
+        data.append(reinterpret_cast<const char*>(&value), 4);
+    }
+
+    // vorbis_commentheader_out() always writes libvorbis' own vendor string;
+    // the copy keeps the one of the encoder that made the audio.
+    QByteArray _commentHeader(const vorbis_comment& comment, const char* vendor)
+    {
+        QByteArray header("\x03vorbis", 7);
+        const QByteArray vendorString(vendor != NULL ? vendor : "");
+        _append32(header, vendorString.size());
+        header.append(vendorString);
+        _append32(header, comment.comments);
+        for (int i = 0; i < comment.comments; ++i)
+        {
+            _append32(header, comment.comment_lengths[i]);
+            header.append(comment.user_comments[i], comment.comment_lengths[i]);
+        }
+        header.append('\x01'); // framing bit
+        return header;
+    }
+}
+
+bool MusicSaver_Ogg::save(const QString& filename, MusicData musicData, uint /*loop*/)
+{
+    //qDebug() << Q_FUNC_INFO;
+
+    if (musicData.suffix() != ".ogg")
+    {
+        setErrorString(QObject::tr("Only Ogg Vorbis tracks can be copied without re-encoding."));
+        return false;
+    }
+
+    RawMusicFile musicFile(musicData);
+    if (!musicFile.open(QIODevice::ReadOnly) || !musicFile.seek(0))
+    {
+        setErrorString(musicFile.errorString());
+        return false;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        setErrorString(file.errorString());
+        return false;
+    }
+
+    SyncState sync;
+    StreamState in;
+    StreamState out;
+    Vorbis vorbis;
+    // Packets point into the stream state, which moves its data as pages
+    // come in; the headers are kept in copies.
+    ogg_packet headers[3];
+    QByteArray headerData[3];
+    int headerCount = 0;
+    int serial = 0;
+    // how far the page numbers of the copied pages move
+    long pageShift = 0;
+    bool success = true;
+    bool end = false;
+    const qint64 total = musicFile.size();
+
+    while (success && !end)
+    {
+        char* buffer = ogg_sync_buffer(&sync.v, ReadSize);
+        const qint64 bytes = musicFile.read(buffer, ReadSize);
+        if (bytes < 0)
+        {
+            setErrorString(musicFile.errorString());
+            success = false;
+            break;
+        }
+        ogg_sync_wrote(&sync.v, bytes);
+        end = (bytes == 0);
+
+        ogg_page page;
+        while (success && ogg_sync_pageout(&sync.v, &page) == 1)
+        {
+            if (headerCount == 3 || (in.initialized && ogg_page_serialno(&page) != serial))
+            {
+                if (ogg_page_serialno(&page) == serial && pageShift != 0)
+                {
+                    const long pageNumber = ogg_page_pageno(&page) + pageShift;
+                    for (int i = 0; i < 4; ++i)
+                        page.header[18 + i] = static_cast<unsigned char>(pageNumber >> (8 * i));
+                    ogg_page_checksum_set(&page);
+                }
+                success = _writePage(file, page);
+                if (!success)
+                    setErrorString(file.errorString());
+                continue;
+            }
+
+            if (!in.initialized)
+            {
+                serial = ogg_page_serialno(&page);
+                in.init(serial);
+            }
+            ogg_stream_pagein(&in.v, &page);
+            while (headerCount < 3 && ogg_stream_packetout(&in.v, &headers[headerCount]) == 1)
+            {
+                headerData[headerCount] = QByteArray(reinterpret_cast<const char*>(headers[headerCount].packet), headers[headerCount].bytes);
+                headers[headerCount].packet = reinterpret_cast<unsigned char*>(headerData[headerCount].data());
+                if (vorbis_synthesis_headerin(&vorbis.info, &vorbis.comment, &headers[headerCount]) != 0)
+                {
+                    setErrorString(QObject::tr("This is not an Ogg Vorbis stream."));
+                    success = false;
+                    break;
+                }
+                ++headerCount;
+            }
+            if (!success || headerCount < 3)
+                continue;
+
+            // The pages copied from here on must start with a new packet.
+            if (ogg_stream_packetpeek(&in.v, NULL) != 0 || page.header[27 + page.header[26] - 1] == 255)
+            {
+                setErrorString(QObject::tr("Audio data shares a page with the Vorbis headers."));
+                success = false;
+                break;
+            }
+
+            vorbis_comment comment;
+            vorbis_comment_init(&comment);
+            _buildComments(&comment, vorbis.comment, musicData);
+            QByteArray commentData = _commentHeader(comment, vorbis.comment.vendor);
+            vorbis_comment_clear(&comment);
+            ogg_packet commentPacket = headers[1];
+            commentPacket.packet = reinterpret_cast<unsigned char*>(commentData.data());
+            commentPacket.bytes = commentData.size();
+
+            // The identification header has a page of its own, the other two
+            // share the next ones.
+            out.init(serial);
+            ogg_stream_packetin(&out.v, &headers[0]);
+            ogg_page outPage;
+            long pages = 0;
+            while (success && ogg_stream_flush(&out.v, &outPage) != 0)
+            {
+                success = _writePage(file, outPage);
+                ++pages;
+            }
+            ogg_stream_packetin(&out.v, &commentPacket);
+            ogg_stream_packetin(&out.v, &headers[2]);
+            while (success && ogg_stream_flush(&out.v, &outPage) != 0)
+            {
+                success = _writePage(file, outPage);
+                ++pages;
+            }
+            if (!success)
+                setErrorString(file.errorString());
+            pageShift = pages - (ogg_page_pageno(&page) + 1);
+        }
+        success = success && reportProgress(musicFile.pos(), total);
+    }
+
+    if (success && headerCount < 3)
+    {
+        setErrorString(QObject::tr("This is not an Ogg Vorbis stream."));
+        success = false;
+    }
+
+    file.close();
+    if (!success)
+        file.remove();
+    return success;
+}
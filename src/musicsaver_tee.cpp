@@ -0,0 +1,217 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QFile>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedData>
+#include <QThread>
+#include "musicsaver_tee.h"
+#include "musicsaver_wav.h"
+#include "musicsaver_flac.h"
+#include "loopmusicfile.h"
+
+namespace {
+    struct Tee;
+
+    // What a saver's progress function gets.
+    struct Part
+    {
+        Tee* tee;
+        int index;
+    };
+
+    struct Tee : public QSharedData
+    {
+        Tee(MusicSaver_Tee* owner_, const MusicData& musicData_, uint loop_) :
+            owner(owner_),
+            musicData(musicData_),
+            loop(loop_),
+            thread(QThread::currentThread()),
+            next(0),
+            finished(0),
+            stop(0)
+        {
+        }
+
+        MusicSaver_Tee* owner;
+        MusicData musicData;
+        uint loop;
+        QList<MusicSaver*> savers;
+        QStringList fileNames;
+        // not resized once the savers point into it
+        QVector<Part> parts;
+        // the saving thread, the only one that reports progress for owner
+        QThread* thread;
+
+        QMutex mutex;
+        // signaled whenever a saver is done
+        QWaitCondition changed;
+        int next;
+        int finished;
+        // permille done, per saver
+        QVector<int> progress;
+        QString errorString;
+
+        // read without the mutex by the progress functions
+        QAtomicInt stop;
+    };
+
+    // Claims the next saver and runs it; false once none is left.
+    bool _saveNext(Tee* tee)
+    {
+        int index;
+        {
+            QMutexLocker locker(&tee->mutex);
+            if (static_cast<int>(tee->stop) != 0 || tee->next >= tee->savers.size())
+                return false;
+            index = tee->next++;
+        }
+        MusicSaver* saver = tee->savers.at(index);
+        const bool success = saver->save(tee->fileNames.at(index), tee->musicData, tee->loop);
+        QMutexLocker locker(&tee->mutex);
+        ++tee->finished;
+        tee->progress[index] = 1000;
+        if (!success && tee->stop.fetchAndStoreRelease(1) == 0)
+            tee->errorString = saver->errorString();
+        tee->changed.wakeAll();
+        return true;
+    }
+
+    class PartJob : public Job
+    {
+        public:
+            PartJob(Tee* tee) : Job(ExportPriority), _tee(tee) {}
+        protected:
+            virtual bool run()
+            {
+                while (!isCanceled() && _saveNext(_tee.data()))
+                    ;
+                return true;
+            }
+        private:
+            QExplicitlySharedDataPointer<Tee> _tee;
+    };
+
+    int _sum(const QVector<int>& progress)
+    {
+        int sum = 0;
+        for (int i = 0; i < progress.size(); ++i)
+            sum += progress.at(i);
+        return sum;
+    }
+}
+
+MusicSaver_Tee::MusicSaver_Tee(const QList<MusicSaver*>& savers) :
+    _savers(savers)
+{
+    Q_ASSERT(!_savers.isEmpty());
+}
+
+MusicSaver_Tee::~MusicSaver_Tee()
+{
+    qDeleteAll(_savers);
+}
+
+MusicSaver* MusicSaver_Tee::createFunction()
+{
+    QList<MusicSaver*> savers;
+    savers << MusicSaver_Wav::createFunction() << MusicSaver_Flac::createFunction();
+    return new MusicSaver_Tee(savers);
+}
+
+bool MusicSaver_Tee::save(const QString& filename, MusicData musicData, uint loop)
+{
+    //qDebug() << Q_FUNC_INFO;
+
+    QString baseName = filename;
+    if (baseName.endsWith(suffix()))
+        baseName.chop(suffix().size());
+
+    QExplicitlySharedDataPointer<Tee> tee(new Tee(this, musicData, loop));
+    // The first saver to open() decodes the track into it; the others wait
+    // for that and copy.
+    QExplicitlySharedDataPointer<LoopCache> loopCache(new LoopCache(true));
+    tee->savers = _savers;
+    tee->progress.fill(0, _savers.size());
+    tee->parts.resize(_savers.size());
+    for (int i = 0; i < _savers.size(); ++i)
+    {
+        MusicSaver* saver = _savers.at(i);
+        tee->fileNames << baseName + saver->suffix();
+        tee->parts[i].tee = tee.data();
+        tee->parts[i].index = i;
+        saver->setLoopTags(loopTags());
+        saver->setLoopCache(loopCache.data());
+        saver->setProgressFunction(_partProgress, &tee->parts[i]);
+    }
+
+    const int helpers = qMin(JobScheduler::workerCount(), _savers.size() - 1);
+    for (int i = 0; i < helpers; ++i)
+    {
+        Job* job = new PartJob(tee.data());
+        JobScheduler::submit(job);
+    }
+
+    // Every saver that was claimed is waited for, so the savers and the
+    // cache outlive their parts; helpers starting later find nothing left.
+    while (_saveNext(tee.data()))
+        ;
+    {
+        QMutexLocker locker(&tee->mutex);
+        while (tee->finished < tee->next)
+        {
+            tee->changed.wait(&tee->mutex, 100);
+            const int sum = _sum(tee->progress);
+            locker.unlock();
+            if (!reportProgress(sum, 1000 * _savers.size()))
+                tee->stop.fetchAndStoreRelease(1);
+            locker.relock();
+        }
+    }
+
+    for (int i = 0; i < _savers.size(); ++i)
+    {
+        _savers.at(i)->setLoopCache(NULL);
+        _savers.at(i)->setProgressFunction(NULL, NULL);
+    }
+
+    if (static_cast<int>(tee->stop) != 0)
+    {
+        // All of them or nothing; the failed ones have cleaned up already.
+        for (int i = 0; i < tee->fileNames.size(); ++i)
+            QFile::remove(tee->fileNames.at(i));
+        setErrorString(tee->errorString.isEmpty() ? QObject::tr("Canceled.") : tee->errorString);
+        return false;
+    }
+    return true;
+}
+
+bool MusicSaver_Tee::_partProgress(qint64 done, qint64 total, void* userData)
+{
+    Part* part = static_cast<Part*>(userData);
+    Tee* tee = part->tee;
+    int sum;
+    {
+        QMutexLocker locker(&tee->mutex);
+        tee->progress[part->index] = (total > 0) ? static_cast<int>(qBound<qint64>(0, done * 1000 / total, 1000)) : 0;
+        sum = _sum(tee->progress);
+    }
+    if (QThread::currentThread() == tee->thread && !tee->owner->reportProgress(sum, 1000 * tee->savers.size()))
+        tee->stop.fetchAndStoreRelease(1);
+    return static_cast<int>(tee->stop) == 0;
+}
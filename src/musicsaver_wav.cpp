@@ -15,80 +15,301 @@
  * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <QFile>
+#include <QSettings>
 #include <QtEndian>
+#include <cstring>
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "musicsaver_wav.h"
 #include "loopmusicfile.h"
 
+namespace {
+    // Every write but the last is a whole multiple of BufferAlignment, which
+    // is what O_DIRECT asks of the buffer, the size and the file offset.
+    const qint64 BufferSize = 4 << 20;
+    const qint64 BufferAlignment = 4096;
+
+    const char W64Riff[16] = {'r', 'i', 'f', 'f', '\x2e', '\x91', '\xcf', '\x11', '\xa5', '\xd6', '\x28', '\xdb', '\x04', '\xc1', '\x00', '\x00'};
+    const char W64Wave[16] = {'w', 'a', 'v', 'e', '\xf3', '\xac', '\xd3', '\x11', '\x8c', '\xd1', '\x00', '\xc0', '\x4f', '\x8e', '\xdb', '\x8a'};
+    const char W64Fmt[16]  = {'f', 'm', 't', ' ', '\xf3', '\xac', '\xd3', '\x11', '\x8c', '\xd1', '\x00', '\xc0', '\x4f', '\x8e', '\xdb', '\x8a'};
+    const char W64Smpl[16] = {'s', 'm', 'p', 'l', '\xf3', '\xac', '\xd3', '\x11', '\x8c', '\xd1', '\x00', '\xc0', '\x4f', '\x8e', '\xdb', '\x8a'};
+    const char W64Data[16] = {'d', 'a', 't', 'a', '\xf3', '\xac', '\xd3', '\x11', '\x8c', '\xd1', '\x00', '\xc0', '\x4f', '\x8e', '\xdb', '\x8a'};
+
+    void _append16(QByteArray& data, quint16 value)
+    {
+        value = qToLittleEndian(value);
+        data.append(reinterpret_cast<const char*>(&value), 2);
+    }
+
+    void _append32(QByteArray& data, quint32 value)
+    {
+        value = qToLittleEndian(value);
+        data.append(reinterpret_cast<const char*>(&value), 4);
+    }
+
+    void _append64(QByteArray& data, quint64 value)
+    {
+        value = qToLittleEndian(value);
+        data.append(reinterpret_cast<const char*>(&value), 8);
+    }
+
+    void _appendFormat(QByteArray& data, const LoopMusicFile& musicFile)
+    {
+        _append16(data, 1u); // WAVE_FORMAT_PCM
+        _append16(data, musicFile.channels());
+        _append32(data, musicFile.samplerate());
+        _append32(data, musicFile.samplerate() * musicFile.blockwidth());
+        _append16(data, musicFile.blockwidth());
+        _append16(data, musicFile.bytewidth() << 3);
+    }
+
+    // A sampler chunk with one forward loop played forever; the end is the
+    // last frame of the loop.
+    QByteArray _sampler(const LoopMusicFile& musicFile)
+    {
+        QByteArray sampler;
+        _append32(sampler, 0u); // manufacturer
+        _append32(sampler, 0u); // product
+        _append32(sampler, 1000000000u / musicFile.samplerate()); // sample period in ns
+        _append32(sampler, 60u); // MIDI unity note
+        _append32(sampler, 0u); // MIDI pitch fraction
+        _append32(sampler, 0u); // SMPTE format
+        _append32(sampler, 0u); // SMPTE offset
+        _append32(sampler, 1u); // sample loops
+        _append32(sampler, 0u); // sampler data
+        _append32(sampler, 0u); // cue point id
+        _append32(sampler, 0u); // forward
+        _append32(sampler, musicFile.loopBegin());
+        _append32(sampler, musicFile.loopEnd() - 1);
+        _append32(sampler, 0u); // fraction
+        _append32(sampler, 0u); // play count, 0 is forever
+        return sampler;
+    }
+
+    enum Format
+    {
+        RiffFormat,
+        Rf64Format, // EBU Tech 3306, for data over 4 GB
+        Wave64Format,
+    };
+
+    void _appendSampler(QByteArray& data, const QByteArray& sampler)
+    {
+        if (sampler.isEmpty())
+            return;
+        data.append("smpl");
+        _append32(data, sampler.size());
+        data.append(sampler);
+    }
+
+    // Wave64 chunks are aligned to 8 bytes.
+    quint64 _padding(quint64 dataSize, Format format)
+    {
+        return (format == Wave64Format) ? (8 - dataSize % 8) % 8 : 0;
+    }
+
+    // sampler is empty or the body of a smpl chunk.
+    QByteArray _header(const LoopMusicFile& musicFile, quint64 dataSize, Format format, const QByteArray& sampler)
+    {
+        QByteArray header;
+        if (format == Wave64Format)
+        {
+            const quint64 samplerSize = sampler.isEmpty() ? 0 : 24 + sampler.size();
+            const quint64 samplerPadding = _padding(samplerSize, format);
+            header.append(W64Riff, 16);
+            _append64(header, 104 + samplerSize + samplerPadding + dataSize + _padding(dataSize, format));
+            header.append(W64Wave, 16);
+            header.append(W64Fmt, 16);
+            _append64(header, 40);
+            _appendFormat(header, musicFile);
+            if (!sampler.isEmpty())
+            {
+                header.append(W64Smpl, 16);
+                _append64(header, samplerSize);
+                header.append(sampler);
+                header.append(QByteArray(samplerPadding, '\0'));
+            }
+            header.append(W64Data, 16);
+            _append64(header, 24 + dataSize);
+        }
+        else if (format == Rf64Format)
+        {
+            header.append("RF64");
+            _append32(header, 0xffffffffu);
+            header.append("WAVEds64");
+            _append32(header, 28u);
+            _append64(header, 72 + (sampler.isEmpty() ? 0 : 8 + sampler.size()) + dataSize);
+            _append64(header, dataSize);
+            _append64(header, dataSize / musicFile.blockwidth());
+            _append32(header, 0u);
+            header.append("fmt ");
+            _append32(header, 16u);
+            _appendFormat(header, musicFile);
+            _appendSampler(header, sampler);
+            header.append("data");
+            _append32(header, 0xffffffffu);
+        }
+        else
+        {
+            header.append("RIFF");
+            _append32(header, dataSize + 36u + (sampler.isEmpty() ? 0 : 8 + sampler.size()));
+            header.append("WAVEfmt ");
+            _append32(header, 16u);
+            _appendFormat(header, musicFile);
+            _appendSampler(header, sampler);
+            header.append("data");
+            _append32(header, dataSize);
+        }
+        return header;
+    }
+
+    struct AlignedBuffer
+    {
+        char* v;
+        AlignedBuffer(size_t size): v(static_cast<char*>(qMallocAligned(size, BufferAlignment))) {}
+        ~AlignedBuffer() { qFreeAligned(v); }
+    };
+
+    // Export/Direct IO opens the file with O_DIRECT, so exports do not push
+    // the page cache out; QFile does not close a descriptor it was given.
+    struct Descriptor
+    {
+        int v;
+        Descriptor(): v(-1) {}
+#ifdef Q_OS_LINUX
+        ~Descriptor() { if (v >= 0) ::close(v); }
+#endif
+    };
+}
+
 bool MusicSaver_Wav::save(const QString& filename, MusicData musicData, uint loop)
 {
     //qDebug() << Q_FUNC_INFO;
 
-    LoopMusicFile* musicFile = new LoopMusicFile(musicData, loop);
+    LoopMusicFile musicFile(musicData, renderLoops(loop));
+    prepare(musicFile);
 
-    if (musicFile == NULL)
+    if (!musicFile.open(QIODevice::ReadOnly))
+    {
+        setErrorString(musicFile.errorString());
         return false;
+    }
 
-    if (!musicFile->open(QIODevice::ReadOnly))
+    bool directIo;
     {
-        setErrorString(musicFile->errorString());
-        delete musicFile;
-        return false;
+        QSettings settings;
+        settings.beginGroup("Export");
+        directIo = settings.value("Direct IO", false).toBool();
+        settings.endGroup();
     }
 
     QFile file(filename);
-    if (!file.open(QIODevice::WriteOnly))
+    Descriptor descriptor;
+    bool direct = false;
+#if defined(Q_OS_LINUX) && defined(O_DIRECT)
+    if (directIo)
+    {
+        // Not every file system takes O_DIRECT; those get a normal file.
+        descriptor.v = ::open(QFile::encodeName(filename).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+        direct = descriptor.v >= 0 && file.open(descriptor.v, QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+#else
+    Q_UNUSED(directIo);
+#endif
+    if (!direct && !file.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
     {
         setErrorString(file.errorString());
-        delete musicFile;
         return false;
     }
 
-    quint64 totalSize = musicFile->sampleSize() * musicFile->blockwidth();
-    if (totalSize > (Q_UINT64_C(4294967295) - Q_UINT64_C(36)))
+    const uint blockwidth = musicFile.blockwidth();
+    const quint64 totalSize = musicFile.sampleSize() * blockwidth;
+    const QByteArray sampler = loopTags() ? _sampler(musicFile) : QByteArray();
+    // The RIFF size counts everything after itself: the rest of the header,
+    // the smpl chunk and the data.
+    const quint64 riffSize = _header(musicFile, 0, RiffFormat, sampler).size() - 8 + totalSize + _padding(totalSize, RiffFormat);
+    const Format format = _wave64 ? Wave64Format
+        : (riffSize > Q_UINT64_C(4294967295)) ? Rf64Format : RiffFormat;
+    const QByteArray header = _header(musicFile, totalSize, format, sampler);
+    const quint64 padding = _padding(totalSize, format);
+
+    AlignedBuffer buffer(BufferSize);
+    if (buffer.v == NULL)
     {
-        setErrorString(QObject::tr("Repeat value is too large."));
-        delete musicFile;
+        setErrorString(QObject::tr("Out of memory."));
         return false;
     }
+    memcpy(buffer.v, header.constData(), header.size());
+    qint64 used = header.size();
+    qint64 fileSize = 0;
+
+    musicFile.sampleSeek(0);
+    bool success = true;
+    qint64 samples;
+    do
+    {
+        samples = 0;
+        while (used + blockwidth <= BufferSize)
+        {
+            samples = musicFile.sampleRead(buffer.v + used, (BufferSize - used) / blockwidth);
+            if (samples <= 0)
+                break;
+            used += samples * blockwidth;
+        }
+        if (samples < 0)
+        {
+            // A decoder error, not the end of the data.
+            setErrorString(musicFile.errorString().isEmpty() ? QObject::tr("Cannot decode the source.") : musicFile.errorString());
+            success = false;
+            break;
+        }
+
+        // Whole aligned blocks go out now; the rest starts the next buffer.
+        const qint64 size = used / BufferAlignment * BufferAlignment;
+        if (file.write(buffer.v, size) != size)
+        {
+            setErrorString(file.errorString());
+            success = false;
+            break;
+        }
+        fileSize += size;
+        used -= size;
+        memmove(buffer.v, buffer.v + size, used);
+        success = reportProgress(musicFile.samplePos(), musicFile.sampleSize());
+    } while (success && samples > 0);
 
-    quint32 int32;
-    quint16 int16;
-    file.write("RIFF");
-    int32 = qToLittleEndian<qint32>(totalSize + 36u);
-    file.write(reinterpret_cast<const char*>(&int32), 4);
-    file.write("WAVEfmt ");
-    int32 = qToLittleEndian<qint32>(16u);
-    file.write(reinterpret_cast<const char*>(&int32), 4);
-
-    // format
-    int16 = qToLittleEndian<qint16>(1u); // WAVE_FORMAT_PCM
-    file.write(reinterpret_cast<const char*>(&int16), 2);
-    // channels
-    int16 = qToLittleEndian<qint16>(musicFile->channels());
-    file.write(reinterpret_cast<const char*>(&int16), 2);
-    // samplerate
-    int32 = qToLittleEndian<qint32>(musicFile->samplerate());
-    file.write(reinterpret_cast<const char*>(&int32), 4);
-    // bytespersec
-    int32 = qToLittleEndian<qint32>(musicFile->samplerate() * musicFile->blockwidth());
-    file.write(reinterpret_cast<const char*>(&int32), 4);
-    // blockalign
-    int16 = qToLittleEndian<qint32>(4);
-    file.write(reinterpret_cast<const char*>(&int16), 2);
-    // bitwidth
-    int16 = qToLittleEndian<qint32>(musicFile->bytewidth() << 3);
-    file.write(reinterpret_cast<const char*>(&int16), 2);
-
-    file.write("data");
-    int32 = qToLittleEndian<qint32>(totalSize);
-    file.write(reinterpret_cast<const char*>(&int32), 4);
-
-    const qint64 bufferSample = 65536;
-    musicFile->sampleSeek(0);
-    while (file.write(musicFile->sampleRead(bufferSample)) > 0)
-        ;
+    if (success)
+    {
+        memset(buffer.v + used, 0, padding);
+        used += padding;
+        // O_DIRECT writes whole blocks; the file is cut back afterwards.
+        const qint64 size = direct ? (used + BufferAlignment - 1) / BufferAlignment * BufferAlignment : used;
+        memset(buffer.v + used, 0, size - used);
+        success = file.write(buffer.v, size) == size && file.resize(fileSize + used);
+        if (!success)
+            setErrorString(file.errorString());
+        fileSize += used;
+    }
     file.close();
-    delete musicFile;
-    musicFile = NULL;
-    return true;
+
+    if (success && static_cast<quint64>(fileSize) != header.size() + totalSize + padding)
+    {
+        // The source ended early, sampleRead() returned 0 before
+        // sampleSize(); describe what was written.  The header
+        // goes through a normal handle, O_DIRECT cannot write it alone.
+        const quint64 dataSize = fileSize - header.size() - padding;
+        const QByteArray written = _header(musicFile, dataSize, format, sampler);
+        QFile patch(filename);
+        success = patch.open(QIODevice::ReadWrite)
+            && patch.write(written) == written.size()
+            && patch.resize(written.size() + dataSize + _padding(dataSize, format));
+        if (!success)
+            setErrorString(QObject::tr("Unexpected end of data."));
+    }
+
+    if (!success)
+        file.remove();
+    return success;
 }
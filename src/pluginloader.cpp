@@ -20,6 +20,7 @@
 #include <QPluginLoader>
 
 #include "pluginloader.h"
+#include "trace.h"
 
 PluginLoader::PluginLoader()
 {
@@ -66,17 +67,7 @@ bool PluginLoader::load(QString title, QString path)
 
     LoaderInterface* dataLoader = loader_list.at(loader_list_map.value(title));
     {
-        /*
-        QTime time;
-        time.start();
-        for (int i = 0; i < 1000; ++i)
-        {
-            dataLoader->open(path);
-            dataLoader->close();
-        }
-        int t = time.elapsed();
-        qDebug() << dataLoader->title() << " used " << t * 0.001 << " ms";
-        */
+        TRACE_ZONE("PluginLoader::load");
         if (!dataLoader->open(path))
             return false;
     }
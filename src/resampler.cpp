@@ -0,0 +1,176 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <cstring>
+#include "resampler.h"
+#include "sampleops.h"
+
+namespace
+{
+    const double _pi = 3.14159265358979323846;
+    // Rates with an odd ratio (e.g. 44100 -> 47999) would need a huge table;
+    // those snap to the nearest of this many phases instead.
+    const uint _maxPhases = 256;
+
+    struct _Preset
+    {
+        int taps;
+        double beta;
+        double rolloff;
+    };
+    const _Preset _presets[] = {
+        { 16, 6.0, 0.85 },
+        { 32, 8.0, 0.91 },
+        { 64, 10.0, 0.95 },
+    };
+
+    uint _gcd(uint a, uint b)
+    {
+        while (b != 0)
+        {
+            uint t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    double _besselI0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12)
+                break;
+        }
+        return sum;
+    }
+}
+
+Resampler::Resampler(uint channels, uint inputRate, uint outputRate, Quality quality, qint64 maxInputFrames) :
+    _channels(channels),
+    _inputRate(inputRate),
+    _outputRate(outputRate),
+    _read(0),
+    _fill(0),
+    _phase(0)
+{
+    uint divisor = _gcd(inputRate, outputRate);
+    _up = outputRate / divisor;
+    _down = inputRate / divisor;
+    _phases = qMin(_up, _maxPhases);
+
+    // When going down in rate the filter has to get longer to keep the same
+    // transition band relative to the new Nyquist frequency.
+    const _Preset& preset = _presets[quality];
+    const double scale = qMin(1.0, static_cast<double>(_up) / _down);
+    _taps = static_cast<int>(std::ceil(preset.taps / scale));
+    _taps = (_taps + 3) & ~3;
+    const double cutoff = preset.rolloff * scale;
+    const double center = _taps / 2 - 1;
+    const double i0Beta = _besselI0(preset.beta);
+
+    // one extra phase for the snapped case, where the fraction may round up
+    // to a whole sample
+    _filters = new float[(_phases + 1) * _taps];
+    for (uint p = 0; p <= _phases; ++p)
+    {
+        float* filter = _filters + p * _taps;
+        const double fraction = static_cast<double>(p) / _phases;
+        double sum = 0.0;
+        for (int k = 0; k < _taps; ++k)
+        {
+            double x = k - center - fraction;
+            double sinc = (x == 0.0) ? 1.0 : std::sin(_pi * cutoff * x) / (_pi * cutoff * x);
+            double w = x / (_taps / 2);
+            double window = (w <= -1.0 || w >= 1.0) ? 0.0 : _besselI0(preset.beta * std::sqrt(1.0 - w * w)) / i0Beta;
+            filter[k] = sinc * window;
+            sum += filter[k];
+        }
+        for (int k = 0; k < _taps; ++k)
+            filter[k] /= sum;
+    }
+
+    _capacity = _taps + maxInputFrames;
+    _history = new float*[_channels];
+    for (uint c = 0; c < _channels; ++c)
+        _history[c] = new float[_capacity];
+    seek(0);
+}
+
+Resampler::~Resampler()
+{
+    for (uint c = 0; c < _channels; ++c)
+        delete [] _history[c];
+    delete [] _history;
+    delete [] _filters;
+}
+
+const float* Resampler::_filter(uint phase) const
+{
+    if (_phases == _up)
+        return _filters + phase * _taps;
+    return _filters + ((static_cast<quint64>(phase) * _phases + _up / 2) / _up) * _taps;
+}
+
+qint64 Resampler::seek(qint64 pos)
+{
+    // Prime the history so the first output is centered on the first
+    // input frame; the missing past is silence.
+    _read = 0;
+    _fill = _taps / 2 - 1;
+    for (uint c = 0; c < _channels; ++c)
+        memset(_history[c], 0, _fill * sizeof(float));
+    _phase = static_cast<uint>((pos * _down) % _up);
+    return toInputFrames(pos);
+}
+
+qint64 Resampler::process(const float* input, qint64 inputFrames, float* output)
+{
+    Q_ASSERT(_fill - _read + inputFrames <= _capacity);
+    if (_read > 0)
+    {
+        for (uint c = 0; c < _channels; ++c)
+            memmove(_history[c], _history[c] + _read, (_fill - _read) * sizeof(float));
+        _fill -= _read;
+        _read = 0;
+    }
+    for (uint c = 0; c < _channels; ++c)
+    {
+        float* history = _history[c] + _fill;
+        const float* in = input + c;
+        for (qint64 i = 0; i < inputFrames; ++i, in += _channels)
+            history[i] = *in;
+    }
+    _fill += inputFrames;
+
+    qint64 produced = 0;
+    while (_read + _taps <= _fill)
+    {
+        const float* filter = _filter(_phase);
+        for (uint c = 0; c < _channels; ++c)
+            *output++ = SampleOps::dotProduct(filter, _history[c] + _read, _taps);
+        ++produced;
+        _phase += _down;
+        _read += _phase / _up;
+        _phase %= _up;
+    }
+    return produced;
+}
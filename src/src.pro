@@ -19,36 +19,73 @@ CONFIG       += debug_and_release
 INCLUDEPATH  += ../include
 HEADERS      += ../include/mainwindow.h \
                 ../include/configdialog.h \
+                ../include/batchexport.h \
                 ../include/pluginloader.h \
                 ../include/musicplayer.h \
+                ../include/audiosink.h \
+                ../include/audiosink_portaudio.h \
+                ../include/audiosink_null.h \
+                ../include/audiosink_wav.h \
+                ../include/lockfree.h \
+                ../include/sampleops.h \
+                ../include/resampler.h \
                 ../include/playlistmodel.h \
                 ../include/spinboxdelegate.h \
                 ../include/musicsaver.h \
                 ../include/musicsaver_wav.h \
                 ../include/musicsaver_flac.h \
+                ../include/musicsaver_ogg.h \
+                ../include/musicsaver_tee.h \
                 ../include/musicfile.h \
                 ../include/musicfile_wav.h \
                 ../include/musicfile_ogg.h \
                 ../include/loopmusicfile.h \
                 ../include/threadmusicfile.h \
+                ../include/decodethread.h \
+                ../include/threadpolicy.h \
+                ../include/jobscheduler.h \
+                ../include/telemetry.h \
+                ../include/statsdock.h \
+                ../include/exportdock.h \
+                ../include/trace.h \
+                ../include/tracefile.h \
                 ../include/musicdata.h \
                 ../include/loaderinterface.h
 SOURCES      += main.cpp \
                 mainwindow.cpp \
+                batchexport.cpp \
                 pluginloader.cpp \
                 musicplayer.cpp \
+                audiosink.cpp \
+                audiosink_portaudio.cpp \
+                audiosink_null.cpp \
+                audiosink_wav.cpp \
+                resampler.cpp \
                 playlistmodel.cpp \
                 spinboxdelegate.cpp \
                 musicsaver.cpp \
                 musicsaver_wav.cpp \
                 musicsaver_flac.cpp \
+                musicsaver_ogg.cpp \
+                musicsaver_tee.cpp \
                 musicfile.cpp \
                 musicfile_wav.cpp \
                 musicfile_ogg.cpp \
                 loopmusicfile.cpp \
                 threadmusicfile.cpp \
+                decodethread.cpp \
+                threadpolicy.cpp \
+                jobscheduler.cpp \
+                telemetry.cpp \
+                statsdock.cpp \
+                exportdock.cpp \
+                tracefile.cpp \
                 configdialog.cpp
 
+trace {
+    DEFINES += TOUHOU_TRACE
+}
+
 TRANSLATIONS = ../translations/touhou_musicplayer_zh_TW.ts
 
 win32 {
@@ -63,6 +100,7 @@ unix {
     #QMAKE_CXXFLAGS += -pg
     #QMAKE_LFLAGS += -pg
     CONFIG    += link_pkgconfig
-    PKGCONFIG += portaudio-2.0 vorbisfile flac
+    PKGCONFIG += portaudio-2.0 vorbisfile vorbis ogg flac
+    !macx:LIBS += -lrt
 }
 
@@ -0,0 +1,134 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QTreeWidget>
+#include <QHeaderView>
+#include <QTimer>
+#include <QShowEvent>
+#include <QHideEvent>
+#include <QStringList>
+#include <QtAlgorithms>
+#include "statsdock.h"
+#include "telemetry.h"
+#include "decodethread.h"
+
+StatsDock::StatsDock(QWidget* parent) :
+    QDockWidget(tr("Statistics"), parent),
+    _tree(new QTreeWidget(this)),
+    _timer(new QTimer(this))
+{
+    setObjectName("StatsDock");
+    _tree->setColumnCount(2);
+    _tree->setHeaderLabels(QStringList() << tr("Name") << tr("Value"));
+    _tree->setRootIsDecorated(false);
+    _output = _addGroup(tr("Output"));
+    _decode = _addGroup(tr("Decoding"));
+    _tracks = _addGroup(tr("Bytes read"));
+    _tree->expandAll();
+    setWidget(_tree);
+    _timer->setInterval(500);
+    connect(_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+}
+
+void StatsDock::showEvent(QShowEvent* event)
+{
+    refresh();
+    _timer->start();
+    QDockWidget::showEvent(event);
+}
+
+void StatsDock::hideEvent(QHideEvent* event)
+{
+    _timer->stop();
+    QDockWidget::hideEvent(event);
+}
+
+QTreeWidgetItem* StatsDock::_addGroup(const QString& name)
+{
+    QTreeWidgetItem* group = new QTreeWidgetItem(_tree, QStringList(name));
+    group->setFirstColumnSpanned(true);
+    QFont font(group->font(0));
+    font.setBold(true);
+    group->setFont(0, font);
+    return group;
+}
+
+QString StatsDock::_histogram(const Histogram& histogram) const
+{
+    return tr("%1 / %2 / %3 us (median / 99% / max)")
+        .arg(histogram.percentile(0.5)).arg(histogram.percentile(0.99)).arg(histogram.maximum());
+}
+
+// Updates the items of group in place, so the scroll position and the
+// selection survive a refresh; only rows that come or go are touched.
+void StatsDock::_update(QTreeWidgetItem* group, const Values& values)
+{
+    for (int i = 0; i < values.size(); ++i)
+    {
+        int j = i;
+        while (j < group->childCount() && group->child(j)->text(0) != values.at(i).first)
+            ++j;
+        QTreeWidgetItem* item;
+        if (j == group->childCount())
+        {
+            item = new QTreeWidgetItem(QStringList(values.at(i).first));
+            group->insertChild(i, item);
+        }
+        else
+        {
+            item = group->child(j);
+            if (j != i)
+                group->insertChild(i, group->takeChild(j));
+        }
+        if (item->text(1) != values.at(i).second)
+            item->setText(1, values.at(i).second);
+    }
+    while (group->childCount() > values.size())
+        delete group->takeChild(values.size());
+}
+
+void StatsDock::refresh()
+{
+    Values output;
+    output << qMakePair(tr("Callbacks"), QString::number(Telemetry::callbacks()))
+        << qMakePair(tr("Underruns"), QString::number(Telemetry::underruns()))
+        << qMakePair(tr("Buffer fill"), QString("%1%").arg(Telemetry::ringFill() / 10.0, 0, 'f', 1))
+        << qMakePair(tr("Callback time"), _histogram(Telemetry::callbackDuration()))
+        << qMakePair(tr("Callback jitter"), _histogram(Telemetry::callbackJitter()));
+    _update(_output, output);
+
+    // Sorted, the rows keep their place from one refresh to the next.
+    Values decode;
+    QString policy = DecodeThread::policy();
+    decode << qMakePair(tr("Scheduling"), policy.isEmpty() ? tr("Not running") : policy)
+        << qMakePair(tr("Loop seek"), _histogram(Telemetry::loopSeek()));
+    QHash<QString, Telemetry::DecodeStats> decodeStats = Telemetry::decodeStats();
+    QStringList formats = decodeStats.keys();
+    qSort(formats);
+    foreach (const QString& format, formats)
+        decode << qMakePair(format, tr("%1x realtime").arg(decodeStats.value(format).realtimeFactor(), 0, 'f', 1));
+    _update(_decode, decode);
+
+    Values tracks;
+    QHash<QString, qint64> trackBytes = Telemetry::trackBytes();
+    QStringList titles = trackBytes.keys();
+    qSort(titles);
+    foreach (const QString& title, titles)
+        tracks << qMakePair(title, QString::number(trackBytes.value(title)));
+    _update(_tracks, tracks);
+
+    _tree->resizeColumnToContents(0);
+}
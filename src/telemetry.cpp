@@ -0,0 +1,264 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QFile>
+#include <QTimer>
+#include <QSettings>
+#include <QStringList>
+#include <QMutexLocker>
+#include <QtDebug>
+#include <cstdio>
+#include "telemetry.h"
+#include "decodethread.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_MAC)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+namespace
+{
+    const int _noRingFill = 0x7fffffff;
+
+    QString _jsonString(const QString& string)
+    {
+        QString result("\"");
+        foreach (QChar c, string)
+        {
+            if (c == QLatin1Char('"') || c == QLatin1Char('\\'))
+                result += QLatin1Char('\\') + c;
+            else if (c.unicode() < 0x20)
+                result += QString("\\u%1").arg(c.unicode(), 4, 16, QLatin1Char('0'));
+            else
+                result += c;
+        }
+        return result + QLatin1Char('"');
+    }
+}
+
+Histogram::Histogram() :
+    _count(0),
+    _maximum(0)
+{
+}
+
+void Histogram::add(qint64 value)
+{
+    int bucket = 0;
+    for (qint64 v = value; v > 0 && bucket < BucketCount - 1; v >>= 1)
+        ++bucket;
+    _buckets[bucket].ref();
+    _count.ref();
+    const int clamped = static_cast<int>(qMin<qint64>(value, 0x7fffffff));
+    int maximum = _maximum;
+    while (clamped > maximum && !_maximum.testAndSetOrdered(maximum, clamped))
+        maximum = _maximum;
+}
+
+void Histogram::reset()
+{
+    for (int i = 0; i < BucketCount; ++i)
+        _buckets[i].fetchAndStoreRelaxed(0);
+    _count.fetchAndStoreRelaxed(0);
+    _maximum.fetchAndStoreRelaxed(0);
+}
+
+qint64 Histogram::percentile(qreal fraction) const
+{
+    const int count = _count;
+    if (count == 0)
+        return 0;
+    const qint64 wanted = qMax<qint64>(1, static_cast<qint64>(count * fraction + 0.5));
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        seen += _buckets[i];
+        if (seen >= wanted)
+            return (i == 0) ? 0 : qMin<qint64>(Q_INT64_C(1) << i, _maximum);
+    }
+    return _maximum;
+}
+
+QString Histogram::toJson() const
+{
+    return QString("{\"count\":%1,\"p50\":%2,\"p99\":%3,\"max\":%4}")
+        .arg(count()).arg(percentile(0.5)).arg(percentile(0.99)).arg(maximum());
+}
+
+QAtomicInt Telemetry::_callbacks(0);
+QAtomicInt Telemetry::_underruns(0);
+QAtomicInt Telemetry::_ringFill(0);
+QAtomicInt Telemetry::_ringFillLow(_noRingFill);
+Histogram Telemetry::_callbackDuration;
+Histogram Telemetry::_callbackJitter;
+Histogram Telemetry::_loopSeek;
+QMutex Telemetry::_mutex;
+QHash<QString, Telemetry::DecodeStats> Telemetry::_decodeStats;
+QHash<QString, qint64> Telemetry::_trackBytes;
+
+qint64 Telemetry::now()
+{
+#if defined(Q_OS_WIN)
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif defined(Q_OS_MAC)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+        mach_timebase_info(&timebase);
+    return static_cast<qint64>(mach_absolute_time() * timebase.numer / timebase.denom / 1000);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<qint64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void Telemetry::recordCallback(qint64 duration, qint64 interval, qint64 expectedInterval)
+{
+    _callbacks.ref();
+    _callbackDuration.add(duration);
+    if (interval > 0)
+        _callbackJitter.add(qAbs(interval - expectedInterval));
+}
+
+void Telemetry::recordRingFill(int permille)
+{
+    _ringFill.fetchAndStoreRelaxed(permille);
+    int low = _ringFillLow;
+    while (permille < low && !_ringFillLow.testAndSetOrdered(low, permille))
+        low = _ringFillLow;
+}
+
+int Telemetry::takeRingFillLow()
+{
+    int low = _ringFillLow.fetchAndStoreOrdered(_noRingFill);
+    return (low == _noRingFill) ? static_cast<int>(_ringFill) : low;
+}
+
+void Telemetry::recordDecode(const QString& format, qint64 frames, uint samplerate, qint64 duration)
+{
+    if (samplerate == 0)
+        return;
+    QMutexLocker locker(&_mutex);
+    DecodeStats& stats = _decodeStats[format];
+    stats.frames += frames;
+    stats.audioTime += frames * 1000000 / samplerate;
+    stats.decodeTime += duration;
+}
+
+void Telemetry::recordTrackBytes(const QString& track, qint64 bytes)
+{
+    QMutexLocker locker(&_mutex);
+    _trackBytes.insert(track, bytes);
+}
+
+QHash<QString, Telemetry::DecodeStats> Telemetry::decodeStats()
+{
+    QMutexLocker locker(&_mutex);
+    return _decodeStats;
+}
+
+QHash<QString, qint64> Telemetry::trackBytes()
+{
+    QMutexLocker locker(&_mutex);
+    return _trackBytes;
+}
+
+QString Telemetry::toJson()
+{
+    // Built by concatenation; names may contain '%' and must not meet arg().
+    QStringList decode;
+    QHash<QString, DecodeStats> decodeStats = Telemetry::decodeStats();
+    for (QHash<QString, DecodeStats>::const_iterator i = decodeStats.constBegin(); i != decodeStats.constEnd(); ++i)
+    {
+        decode << _jsonString(i.key()) + QString(":{\"frames\":%1,\"realtime\":%2}")
+            .arg(i.value().frames).arg(i.value().realtimeFactor(), 0, 'f', 1);
+    }
+    QStringList tracks;
+    QHash<QString, qint64> trackBytes = Telemetry::trackBytes();
+    for (QHash<QString, qint64>::const_iterator i = trackBytes.constBegin(); i != trackBytes.constEnd(); ++i)
+        tracks << _jsonString(i.key()) + QLatin1Char(':') + QString::number(i.value());
+
+    return QString("{\"time\":%1,\"callbacks\":%2,\"underruns\":%3,\"ringFill\":%4,\"ringFillLow\":%5,")
+            .arg(now()).arg(callbacks()).arg(underruns()).arg(ringFill()).arg(takeRingFillLow()) +
+        "\"callbackDuration\":" + _callbackDuration.toJson() +
+        ",\"callbackJitter\":" + _callbackJitter.toJson() +
+        ",\"loopSeek\":" + _loopSeek.toJson() +
+        ",\"decode\":{" + decode.join(",") +
+        "},\"trackBytes\":{" + tracks.join(",") +
+        "},\"decodePolicy\":" + _jsonString(DecodeThread::policy()) + "}";
+}
+
+TelemetryWriter::TelemetryWriter(QObject* parent) :
+    QObject(parent),
+    _timer(new QTimer(this)),
+    _file(NULL)
+{
+    connect(_timer, SIGNAL(timeout()), this, SLOT(write()));
+    reloadSettings();
+}
+
+TelemetryWriter::~TelemetryWriter()
+{
+    delete _file;
+}
+
+void TelemetryWriter::reloadSettings()
+{
+    QString fileName;
+    int interval;
+    {
+        QSettings settings;
+        settings.beginGroup("General");
+        fileName = settings.value("Statistics File", "-").toString();
+        interval = settings.value("Statistics Interval", 0).toInt();
+        settings.endGroup();
+    }
+    _timer->stop();
+    delete _file;
+    _file = NULL;
+    if (interval <= 0 || fileName.isEmpty())
+        return;
+
+    _file = new QFile(fileName);
+    bool opened = (fileName == "-") ?
+        _file->open(stderr, QIODevice::WriteOnly) :
+        _file->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+    if (!opened)
+    {
+        qWarning() << Q_FUNC_INFO << fileName << _file->errorString();
+        delete _file;
+        _file = NULL;
+        return;
+    }
+    _timer->start(interval);
+}
+
+void TelemetryWriter::write()
+{
+    Q_ASSERT(_file != NULL);
+    _file->write(Telemetry::toJson().toUtf8());
+    _file->write("\n");
+    _file->flush();
+}
@@ -14,16 +14,35 @@
  * You should have received a copy of the GNU General Public License
  * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <QSettings>
+#include <QMutexLocker>
 #include <QtDebug>
+#include <cstring>
 #include "threadmusicfile.h"
+#include "decodethread.h"
+#include "sampleops.h"
+#include "threadpolicy.h"
+#include "telemetry.h"
+#include "trace.h"
 
 const size_t _bufferSize = 1024;
 
 ThreadMusicFile::ThreadMusicFile(const MusicData& musicData, uint totalLoop) :
     _musicFile(new LoopMusicFile(musicData, totalLoop)),
+    _format(musicData.suffix()),
+    _title(musicData.title()),
+    _resampler(NULL),
     _fileBuffer(NULL),
-    _bufferSampleSize(1024*500),
-    _stoped(false)
+    _resampleBuffer(NULL),
+    _ring(NULL),
+    _ringSampleSize(0),
+    _lookaheadSampleSize(0),
+    _fadeSampleSize(0),
+    _generation(0),
+    _fadeRemain(0),
+    _decodedGeneration(0),
+    _opened(false),
+    _memoryLocked(false)
 {
     //qDebug() << Q_FUNC_INFO;
 }
@@ -33,12 +52,52 @@ bool ThreadMusicFile::open(MusicFile::OpenMode mode)
     //qDebug() << Q_FUNC_INFO;
     if (_musicFile == NULL)
         return false;
+    uint historyTime;
+    uint lookaheadTime;
+    uint outputRate;
+    int quality;
+    {
+        QSettings settings;
+        settings.beginGroup("Playback");
+        historyTime = settings.value("Buffer History", 10000U).toUInt();
+        lookaheadTime = settings.value("Buffer Lookahead", 3000U).toUInt();
+        outputRate = settings.value("Output Sample Rate", 0U).toUInt();
+        quality = qBound<int>(Resampler::FastQuality, settings.value("Resampler Quality", Resampler::MediumQuality).toInt(), Resampler::BestQuality);
+        // Decode to float so fades and gain do not requantize; the device
+        // format conversion then happens once, in PortAudio.  The resampler
+        // only works on floats.
+        if (settings.value("Float Processing", true).toBool() || outputRate != 0)
+            _musicFile->setSampleFormat(MusicFile::Float32Format);
+        settings.endGroup();
+    }
     if (_musicFile->open(mode))
     {
-        _samplePos = 0,
-        _musicFile->sampleSeek(0);
+        if (outputRate != 0 && outputRate != _musicFile->samplerate() &&
+            _musicFile->sampleFormat() == MusicFile::Float32Format)
+        {
+            _resampler = new Resampler(channels(), _musicFile->samplerate(), outputRate,
+                    static_cast<Resampler::Quality>(quality), _bufferSize);
+            _resampleBuffer = new char[_resampler->maxOutputFrames(_bufferSize) * blockwidth()];
+        }
+        _lookaheadSampleSize = qMax<qint64>(static_cast<qint64>(lookaheadTime) * samplerate() / 1000, _bufferSize * 4);
+        // The decoder appends whole chunks past the lookahead, so the history
+        // must hold at least one or it overwrites audio not yet played.
+        const qint64 chunkSampleSize = (_resampler != NULL) ? _resampler->maxOutputFrames(_bufferSize) : _bufferSize;
+        _ringSampleSize = _lookaheadSampleSize + qMax<qint64>(static_cast<qint64>(historyTime) * samplerate() / 1000, chunkSampleSize);
+        _fadeSampleSize = samplerate() / 200;
+        _ring = new char[_ringSampleSize * blockwidth()];
         _fileBuffer = new char[blockwidth() * _bufferSize];
-        start();
+        _lockBuffers();
+        // The decoder sees a pending seek to 0 and starts from there.
+        _window.store(_Window());
+        _seekTarget.store(0);
+        _generation = 1;
+        _fadeRemain = 0;
+        _samplePos.store(0);
+        _decodedGeneration = 0;
+        _musicFile->sampleSeek(0);
+        _opened = true;
+        DecodeThread::add(this);
         return true;
     }
     return false;
@@ -47,92 +106,256 @@ bool ThreadMusicFile::open(MusicFile::OpenMode mode)
 void ThreadMusicFile::close()
 {
     //qDebug() << Q_FUNC_INFO << "begin";
-    _stoped = true;
-    //qDebug() << Q_FUNC_INFO << "wait";
-    wait();
-    if (_fileBuffer)
+    if (_opened)
     {
-        delete _fileBuffer;
-        _fileBuffer = NULL;
+        //qDebug() << Q_FUNC_INFO << "wait";
+        DecodeThread::remove(this);
+        _opened = false;
     }
+    _unlockBuffers();
+    delete [] _fileBuffer;
+    _fileBuffer = NULL;
+    delete [] _ring;
+    _ring = NULL;
+    delete [] _resampleBuffer;
+    _resampleBuffer = NULL;
+    delete _resampler;
+    _resampler = NULL;
     //qDebug() << Q_FUNC_INFO << "end";
 }
 
-void ThreadMusicFile::run()
+void ThreadMusicFile::_lockBuffers()
+{
+    if (!ThreadPolicy::memoryLockingEnabled())
+        return;
+    // Everything the decode thread and the stream callback touch while
+    // playing; a page fault here is an audible gap.
+    bool locked = ThreadPolicy::lockMemory(_ring, _ringSampleSize * blockwidth());
+    locked = ThreadPolicy::lockMemory(_fileBuffer, blockwidth() * _bufferSize) && locked;
+    if (_resampleBuffer != NULL)
+        locked = ThreadPolicy::lockMemory(_resampleBuffer, _resampler->maxOutputFrames(_bufferSize) * blockwidth()) && locked;
+    if (!locked)
+        qWarning() << Q_FUNC_INFO << "cannot lock playback buffers in memory";
+    _memoryLocked = true;
+}
+
+void ThreadMusicFile::_unlockBuffers()
+{
+    if (!_memoryLocked)
+        return;
+    ThreadPolicy::unlockMemory(_ring, _ringSampleSize * blockwidth());
+    ThreadPolicy::unlockMemory(_fileBuffer, blockwidth() * _bufferSize);
+    if (_resampleBuffer != NULL)
+        ThreadPolicy::unlockMemory(_resampleBuffer, _resampler->maxOutputFrames(_bufferSize) * blockwidth());
+    _memoryLocked = false;
+}
+
+qint64 ThreadMusicFile::sampleSize() const
+{
+    Q_ASSERT(_musicFile != NULL);
+    if (_resampler != NULL)
+        return _resampler->toOutputFrames(_musicFile->sampleSize());
+    return _musicFile->sampleSize();
+}
+
+uint ThreadMusicFile::samplerate() const
+{
+    Q_ASSERT(_musicFile != NULL);
+    if (_resampler != NULL)
+        return _resampler->outputRate();
+    return _musicFile->samplerate();
+}
+
+qreal ThreadMusicFile::_decodeUrgency() const
+{
+    // Below 0 for a pending seek, the fill level of the lookahead while it
+    // is not full, and 2 when there is nothing to do.
+    if (_generation.fetchAndAddAcquire(0) != _decodedGeneration)
+        return -1.0;
+    const _Window window = _window.load();
+    const qint64 ahead = window.end - _samplePos.load();
+    if (window.ended || ahead >= _lookaheadSampleSize)
+        return 2.0;
+    return static_cast<qreal>(ahead) / _lookaheadSampleSize;
+}
+
+void ThreadMusicFile::_decodeStep()
 {
     //qDebug() << Q_FUNC_INFO;
-    _stoped = false;
-    while (!_stoped)
+    TRACE_ZONE("buffer fill");
+    // The seek target is stored before the generation moves, so it is at
+    // least as new as the generation read here.
+    const int generation = _generation.fetchAndAddAcquire(0);
+    _Window window = _window.load();
+    if (generation != _decodedGeneration)
+    {
+        // A seek outside of the window; start a new one at the target.
+        const qint64 target = _seekTarget.load();
+        window = _Window();
+        window.begin = window.end = target;
+        window.generation = generation;
+        _window.store(window);
+        _musicFile->sampleSeek((_resampler == NULL) ? target : _resampler->seek(target));
+        _decodedGeneration = generation;
+    }
+    const qint64 pos = window.end;
+    const qint64 begin = Telemetry::now();
+    qint64 size = _musicFile->sampleRead(_fileBuffer, _bufferSize);
+    if (size > 0)
+        Telemetry::recordDecode(_format, size, _musicFile->samplerate(), Telemetry::now() - begin);
+    Telemetry::recordTrackBytes(_title, _musicFile->bytesRead());
+    const char* data = _fileBuffer;
+    bool ended = (size <= 0);
+    if (_resampler != NULL && size >= 0)
     {
-        _bufferMutex.lock();
-        while (_buffer.size() >= _bufferSampleSize)
+        ended = (pos >= sampleSize());
+        if (size == 0)
         {
-            while (!_bufferNotFull.wait(&_bufferMutex, 100))
-                if (_stoped)
-                    return;
+            // The source is done but the filter still holds its tail;
+            // flush it with silence up to the output length.
+            size = _bufferSize;
+            memset(_fileBuffer, 0, size * blockwidth());
         }
-        _bufferMutex.unlock();
-        _fillBuffer();
+        size = _resampler->process(reinterpret_cast<const float*>(_fileBuffer), size, reinterpret_cast<float*>(_resampleBuffer));
+        size = qBound(Q_INT64_C(0), size, sampleSize() - pos);
+        data = _resampleBuffer;
+    }
+
+    // If the reader seeked away meanwhile, it ignores this generation's
+    // window and the next step starts over.
+    if (ended)
+    {
+        // End of the track, or a decoder error; wait for the next seek.
+        window.ended = true;
+        _window.store(window);
+    }
+    else
+    {
+        // Slots leave the window before they are overwritten and join it
+        // once they are filled, so the reader never uses a torn one.
+        window.begin = qMax(window.begin, pos + size - _ringSampleSize);
+        _window.store(window);
+        _copyToRing(data, pos, size);
+        window.end = pos + size;
+        _window.store(window);
     }
+    QMutexLocker locker(&_bufferMutex);
+    _bufferNotEmpty.wakeAll();
 }
 
-bool ThreadMusicFile::_fillBuffer()
+void ThreadMusicFile::_copyToRing(const char* data, qint64 pos, qint64 samples)
 {
-    //qDebug() << Q_FUNC_INFO;
-    _bufferMutex.lock();
-    qint64 sample = _musicFile->samplePos() - _buffer.size() / blockwidth();
-    if (sample != _samplePos)
+    const uint width = blockwidth();
+    while (samples > 0)
     {
-        _musicFile->sampleSeek(_samplePos);
-        _buffer.clear();
+        qint64 index = pos % _ringSampleSize;
+        qint64 count = qMin(samples, _ringSampleSize - index);
+        memcpy(_ring + index * width, data, count * width);
+        data += count * width;
+        pos += count;
+        samples -= count;
     }
-    qint64 size = _musicFile->sampleRead(_fileBuffer, _bufferSize);
-    if (size <= 0)
+}
+
+void ThreadMusicFile::_copyFromRing(char* data, qint64 pos, qint64 samples) const
+{
+    const uint width = blockwidth();
+    while (samples > 0)
     {
-        _bufferMutex.unlock();
-        return false;
+        qint64 index = pos % _ringSampleSize;
+        qint64 count = qMin(samples, _ringSampleSize - index);
+        memcpy(data, _ring + index * width, count * width);
+        data += count * width;
+        pos += count;
+        samples -= count;
     }
-    sample = size * blockwidth();
-    for (uint i = 0; i < sample; ++i)
-        _buffer.enqueue(_fileBuffer[i]);
-    //_bufferNotEmpty.wakeAll();
-    _bufferMutex.unlock();
-    return true;
+}
+
+void ThreadMusicFile::_fadeIn(char* data, qint64 samples)
+{
+    samples = qMin(samples, _fadeRemain);
+    if (sampleFormat() == MusicFile::Float32Format)
+        SampleOps::applyFade(reinterpret_cast<float*>(data), samples, channels(), _fadeRemain, _fadeSampleSize, true, false);
+    else
+        SampleOps::applyFade(reinterpret_cast<qint16*>(data), samples, channels(), _fadeRemain, _fadeSampleSize, true, false);
+    _fadeRemain -= samples;
 }
 
 qint64 ThreadMusicFile::sampleRead(char* buffer, qint64 needSample)
 {
     //qDebug() << Q_FUNC_INFO << needSample << _samplePos;
-    needSample = qMin<qint64>(needSample, sampleSize() - _samplePos);
-    int size = needSample * blockwidth();
-    forever
+    const qint64 samplePos = _samplePos.load();
+    needSample = qMin<qint64>(needSample, sampleSize() - samplePos);
+    if (needSample <= 0)
+        return 0;
+    // Only this thread moves the generation; a window of another one is
+    // still on its way.
+    const int generation = _generation;
+    const _Window window = _window.load();
+    const bool current = (window.generation == generation);
+    qint64 available = 0;
+    if (current && samplePos >= window.begin)
     {
-        _bufferMutex.lock();
-        if (_buffer.size() < size)
-        {
-            _bufferMutex.unlock();
-            if (!_fillBuffer())
-            {
-                _bufferMutex.lock();
-                size = _buffer.size();
-                _bufferMutex.unlock();
-            }
-        }
+        available = qBound(Q_INT64_C(0), window.end - samplePos, needSample);
+        _copyFromRing(buffer, samplePos, available);
+        // The decoder may have overwritten the slots meanwhile.
+        if (_window.load().begin > samplePos)
+            available = 0;
+    }
+    if (current && available == 0 && samplePos < _window.load().begin)
+    {
+        // The ring holds later audio by now; decode this part again.
+        _restart(samplePos);
+    }
+    Telemetry::recordRingFill(current ? static_cast<int>(qBound<qint64>(0, (window.end - samplePos) * 1000 / _lookaheadSampleSize, 1000)) : 0);
+    if (_fadeRemain > 0)
+        _fadeIn(buffer, available);
+    if (available < needSample)
+    {
+        // Underrun; keep the device fed and let the decoder catch up.  The
+        // position only advances over audio that was really played.
+        memset(buffer + available * blockwidth(), 0, (needSample - available) * blockwidth());
+        if (current && window.ended && window.end <= samplePos + available)
+            needSample = available;
         else
-        {
-            for (int i = 0; i < size; ++i)
-                buffer[i] = _buffer.dequeue();
-            _samplePos += needSample;
-            _bufferMutex.unlock();
-            _bufferNotFull.wakeAll();
-            return needSample;
-        }
+            Telemetry::recordUnderrun();
     }
+    _samplePos.store(samplePos + available);
+    DecodeThread::wake();
+    return needSample;
 }
 
 bool ThreadMusicFile::sampleSeek(qint64 samples)
 {
     //qDebug() << Q_FUNC_INFO << samples;
-    _samplePos = samples;
+    _samplePos.store(samples);
+    const _Window window = _window.load();
+    if (window.generation == _generation && samples >= window.begin && samples <= window.end)
+        return true;
+    // Outside of what is decoded, restart the decoder at the new position.
+    _restart(samples);
     return true;
 }
+
+void ThreadMusicFile::_restart(qint64 pos)
+{
+    _seekTarget.store(pos);
+    _fadeRemain = _fadeSampleSize;
+    _generation.fetchAndAddRelease(1);
+    DecodeThread::wake();
+}
+
+bool ThreadMusicFile::waitForData(qint64 samples, ulong msec)
+{
+    QMutexLocker locker(&_bufferMutex);
+    samples = qMin(samples, sampleSize() - _samplePos.load());
+    forever
+    {
+        const _Window window = _window.load();
+        if (window.generation == _generation.fetchAndAddAcquire(0) &&
+            (window.ended || window.end - _samplePos.load() >= samples))
+            return true;
+        if (!_bufferNotEmpty.wait(&_bufferMutex, msec))
+            return false;
+    }
+}
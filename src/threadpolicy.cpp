@@ -0,0 +1,144 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QSettings>
+#include <QStringList>
+#include <QtDebug>
+#include "threadpolicy.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_UNIX)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    const char* _schedulingNames[] = { "Normal", "RoundRobin", "Fifo" };
+}
+
+ThreadPolicy::ThreadPolicy(const QString& role) :
+    _role(role),
+    _priority(QThread::HighestPriority),
+    _scheduling(NormalScheduling),
+    _cpu(-1)
+{
+    QSettings settings;
+    settings.beginGroup("Playback");
+    _priority = static_cast<QThread::Priority>(qBound<int>(QThread::IdlePriority,
+                settings.value(role + " Priority", QThread::HighestPriority).toInt(),
+                QThread::TimeCriticalPriority));
+    QString scheduling = settings.value(role + " Scheduling", "Normal").toString();
+    for (int i = NormalScheduling; i <= FifoScheduling; ++i)
+    {
+        if (scheduling.compare(_schedulingNames[i], Qt::CaseInsensitive) == 0)
+            _scheduling = static_cast<Scheduling>(i);
+    }
+    _cpu = settings.value(role + " CPU", -1).toInt();
+    settings.endGroup();
+}
+
+void ThreadPolicy::apply(QThread* thread)
+{
+    Q_ASSERT(thread == QThread::currentThread());
+    QStringList obtained;
+    thread->setPriority(_priority);
+    obtained << QString("priority %1").arg(_priority);
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MAC)
+    if (_scheduling != NormalScheduling)
+    {
+        int policy = (_scheduling == FifoScheduling) ? SCHED_FIFO : SCHED_RR;
+        // Stay in the lower half so the audio server and the kernel's own
+        // threads still win.
+        sched_param param;
+        param.sched_priority = (sched_get_priority_min(policy) + sched_get_priority_max(policy)) / 4;
+        int err = pthread_setschedparam(pthread_self(), policy, &param);
+        if (err == 0)
+            obtained << QString("%1 %2").arg(_schedulingNames[_scheduling]).arg(param.sched_priority);
+        else
+        {
+            qWarning() << Q_FUNC_INFO << _role << ": real time scheduling refused, error" << err;
+            obtained << QString("%1 refused").arg(_schedulingNames[_scheduling]);
+        }
+    }
+#else
+    if (_scheduling != NormalScheduling)
+    {
+        // No real time classes here; the closest is the top thread priority.
+        thread->setPriority(QThread::TimeCriticalPriority);
+        obtained << "time critical";
+    }
+#endif
+
+    if (_cpu >= 0)
+    {
+        bool pinned = false;
+#if defined(Q_OS_LINUX)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(_cpu, &set);
+        pinned = (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+#elif defined(Q_OS_WIN)
+        pinned = (_cpu < 32 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << _cpu) != 0);
+#endif
+        if (pinned)
+            obtained << QString("CPU %1").arg(_cpu);
+        else
+        {
+            qWarning() << Q_FUNC_INFO << _role << ": cannot pin to CPU" << _cpu;
+            obtained << QString("CPU %1 refused").arg(_cpu);
+        }
+    }
+    _obtained = obtained.join(", ");
+    //qDebug() << Q_FUNC_INFO << _role << _obtained;
+}
+
+bool ThreadPolicy::memoryLockingEnabled()
+{
+    QSettings settings;
+    settings.beginGroup("Playback");
+    bool result = settings.value("Lock Memory", false).toBool();
+    settings.endGroup();
+    return result;
+}
+
+bool ThreadPolicy::lockMemory(const void* address, size_t size)
+{
+#if defined(Q_OS_WIN)
+    return VirtualLock(const_cast<void*>(address), size) != 0;
+#elif defined(Q_OS_UNIX)
+    return mlock(address, size) == 0;
+#else
+    Q_UNUSED(address);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+void ThreadPolicy::unlockMemory(const void* address, size_t size)
+{
+#if defined(Q_OS_WIN)
+    VirtualUnlock(const_cast<void*>(address), size);
+#elif defined(Q_OS_UNIX)
+    munlock(address, size);
+#else
+    Q_UNUSED(address);
+    Q_UNUSED(size);
+#endif
+}
@@ -0,0 +1,154 @@
+/**
+ * This file is part of Touhou Music Player.
+ *
+ * Touhou Music Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Touhou Music Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Touhou Music Player.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tracefile.h"
+#ifdef TOUHOU_TRACE
+#include <QMutexLocker>
+#include <QtDebug>
+#include "telemetry.h"
+
+namespace
+{
+    // The events are written in batches, and the queues drained this often.
+    const int _flushSize = 1 << 16;
+    const unsigned long _drainInterval = 50;
+
+    // What the traceSink property points to; it lives until the process
+    // exits, so the copies of TraceSink::instance() may keep its address.
+    QAtomicPointer<TraceSink> _sink;
+}
+
+TraceFile::TraceFile() :
+    _nextTid(0),
+    _dropped(0),
+    _writer(this),
+    _stop(false),
+    _first(true)
+{
+    QByteArray fileName = qgetenv("TOUHOU_TRACE_FILE");
+    _file.setFileName(fileName.isEmpty() ? QString("touhou-musicplayer.trace.json") : QString::fromLocal8Bit(fileName));
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << Q_FUNC_INFO << _file.fileName() << _file.errorString();
+        return;
+    }
+    _file.write("[\n");
+    _writer.start(QThread::LowPriority);
+}
+
+TraceFile::~TraceFile()
+{
+    _sink.testAndSetOrdered(this, NULL);
+    if (!_file.isOpen())
+        return;
+    {
+        QMutexLocker locker(&_stopMutex);
+        _stop = true;
+        _stopCondition.wakeAll();
+    }
+    _writer.wait();
+    _drain();
+    _file.write(_buffer);
+    _file.write("\n]\n");
+    _file.close();
+    if (_dropped != 0)
+        qWarning() << Q_FUNC_INFO << static_cast<int>(_dropped) << "zones dropped";
+}
+
+void TraceFile::install()
+{
+    Q_ASSERT(QCoreApplication::instance() != NULL);
+    if (!_file.isOpen())
+        return;
+    _sink.fetchAndStoreOrdered(this);
+    QCoreApplication::instance()->setProperty("traceSink", qulonglong(reinterpret_cast<quintptr>(&_sink)));
+}
+
+qint64 TraceFile::now()
+{
+    return Telemetry::now();
+}
+
+void TraceFile::complete(const char* name, qint64 begin, qint64 duration)
+{
+    Holder* holder = _holders.localData();
+    Slot* slot = (holder != NULL) ? holder->slot : NULL;
+    for (int i = 0; i < MaxThreads && slot == NULL; ++i)
+    {
+        if (_slots[i].used.testAndSetOrdered(0, 1))
+        {
+            slot = &_slots[i];
+            // tids are not reused, every thread gets a track of its own
+            slot->tid = _nextTid.fetchAndAddRelaxed(1) + 1;
+            _holders.setLocalData(new Holder(slot));
+        }
+    }
+    const Event event = {name, begin, duration};
+    if (slot == NULL || !slot->events.push(event))
+        _dropped.fetchAndAddRelaxed(1);
+}
+
+void TraceFile::_drain()
+{
+    for (int i = 0; i < MaxThreads; ++i)
+    {
+        Slot& slot = _slots[i];
+        if (slot.used.fetchAndAddAcquire(0) == 0)
+            continue;
+        // Read before draining, so nothing the thread queued is left.
+        const bool retired = (slot.retired.fetchAndAddAcquire(0) != 0);
+        Event event;
+        while (slot.events.pop(event))
+        {
+            if (!_first)
+                _buffer += ",\n";
+            _first = false;
+            _buffer += "{\"name\":\"";
+            _buffer += event.name;
+            _buffer += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+            _buffer += QByteArray::number(slot.tid);
+            _buffer += ",\"ts\":";
+            _buffer += QByteArray::number(event.begin);
+            _buffer += ",\"dur\":";
+            _buffer += QByteArray::number(event.duration);
+            _buffer += '}';
+            if (_buffer.size() >= _flushSize)
+            {
+                _file.write(_buffer);
+                _buffer.clear();
+            }
+        }
+        if (retired)
+        {
+            slot.retired.fetchAndStoreRelaxed(0);
+            slot.used.fetchAndStoreRelease(0);
+        }
+    }
+}
+
+void TraceFile::Writer::run()
+{
+    QMutexLocker locker(&_traceFile->_stopMutex);
+    while (!_traceFile->_stop)
+    {
+        _traceFile->_stopCondition.wait(&_traceFile->_stopMutex, _drainInterval);
+        locker.unlock();
+        _traceFile->_drain();
+        locker.relock();
+    }
+}
+
+#endif // TOUHOU_TRACE